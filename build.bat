@@ -52,6 +52,15 @@ if not exist cgltf.lib (
     lib %rootDir%/build/cgltf.obj
 )   
 cl %disabledWarnings% %includeDirs% %debugFlags% %flags% -Fe%output% %source% /incremental %links% %entryPoint% %link_path%
+
+rem CPU tests, no GPU or window needed
+set testSource= %rootDir%/src/resource/meshlet.c %rootDir%/src/resource/simplify.c
+cl %disabledWarnings% %includeDirs% %debugFlags% %flags% -Femeshlet_test %rootDir%/tests/meshlet_test.c %testSource% /link /subsystem:CONSOLE
+meshlet_test.exe
+cl %disabledWarnings% %includeDirs% %debugFlags% %flags% -Fetexture_mips_test %rootDir%/tests/texture_mips_test.c %rootDir%/src/resource/texture_mips.c /link /subsystem:CONSOLE
+texture_mips_test.exe
+cl %disabledWarnings% %includeDirs% %debugFlags% %flags% -Fetexture_compress_test %rootDir%/tests/texture_compress_test.c %rootDir%/src/resource/texture_compress.c /link /subsystem:CONSOLE
+texture_compress_test.exe
 popd
 
 echo.
@@ -0,0 +1,50 @@
+#!/bin/sh
+
+rootDir=$(pwd)
+mkdir -p build
+
+debug=false
+
+if [ "$debug" = true ]; then
+    echo "Compiling in debug mode."
+    echo
+
+    debugFlags="-g -O0 -DAURORA_DEBUG"
+else
+    echo "Compiling in release mode."
+    echo
+
+    debugFlags="-g -O2 -ffast-math"
+fi
+
+output=aurora
+flags="-DVK_NO_PROTOTYPES -D_GNU_SOURCE -pthread"
+disabledWarnings="-Wno-unused-parameter -Wno-sign-compare -Wno-unused-variable -Wno-unused-function -Wno-missing-field-initializers"
+source="$rootDir/src/*.c $rootDir/src/resource/*.c $rootDir/src/gfx/*.c $rootDir/src/core/*.c $rootDir/src/client/*.c $rootDir/src/audio/*.c"
+links="volk.o vma.o spirv_reflect.o stb_image.o cgltf.o -lstdc++ -lm -ldl -pthread"
+includeDirs="-I$rootDir/src -I$rootDir/third_party"
+
+if [ -n "$VULKAN_SDK" ]; then
+    includeDirs="$includeDirs -I$VULKAN_SDK/include"
+fi
+
+cd build
+[ -f volk.o ]          || cc  $includeDirs $flags -O2 -w -c $rootDir/third_party/volk.c          -o volk.o
+[ -f vma.o ]           || c++ $includeDirs $flags -O2 -w -c $rootDir/third_party/vma.cpp         -o vma.o
+[ -f spirv_reflect.o ] || cc  $includeDirs $flags -O2 -w -c $rootDir/third_party/spirv_reflect.c -o spirv_reflect.o
+[ -f stb_image.o ]     || cc  $includeDirs $flags -O2 -w -c $rootDir/third_party/stb_image.c     -o stb_image.o
+[ -f cgltf.o ]         || cc  $includeDirs $flags -O2 -w -c $rootDir/third_party/cgltf.c         -o cgltf.o
+cc -Wall $disabledWarnings $includeDirs $debugFlags $flags -o $output $source $links
+
+# CPU tests, no GPU or window needed
+testSource="$rootDir/src/resource/meshlet.c $rootDir/src/resource/simplify.c"
+cc -Wall $disabledWarnings $includeDirs $debugFlags $flags -o meshlet_test $rootDir/tests/meshlet_test.c $testSource -lm
+./meshlet_test
+cc -Wall $disabledWarnings $includeDirs $debugFlags $flags -o texture_mips_test $rootDir/tests/texture_mips_test.c $rootDir/src/resource/texture_mips.c -lm
+./texture_mips_test
+cc -Wall $disabledWarnings $includeDirs $debugFlags $flags -o texture_compress_test $rootDir/tests/texture_compress_test.c $rootDir/src/resource/texture_compress.c -lm
+./texture_compress_test
+cd ..
+
+echo
+echo "Build finished."
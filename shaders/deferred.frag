@@ -1,4 +1,5 @@
 #version 460
+#extension GL_EXT_nonuniform_qualifier : require
 
 #define PI 3.14159265359
 #define MAX_LIGHTS 512
@@ -24,7 +25,7 @@ layout (binding = 5, set = 0) uniform textureCube   Cubemap;
 layout (binding = 6, set = 0) uniform textureCube   Irradiance;
 layout (binding = 7, set = 0) uniform textureCube   Prefilter;
 layout (binding = 8, set = 0) uniform texture2D     BRDF;
-layout (binding = 0, set = 1) uniform sampler       SamplerHeap[512];
+layout (binding = 0, set = 1) uniform sampler       SamplerHeap[];
 
 layout (binding = 0, set = 2) uniform Lights {
     PointLight lights[MAX_LIGHTS];
@@ -1,4 +1,5 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout (location = 0) in PerVertexData {
     vec3 fPosition;
@@ -13,8 +14,8 @@ layout (location = 1) out vec3 gNormal;
 layout (location = 2) out vec4 gAlbedo;
 layout (location = 3) out vec4 gMetallicRoughness;
 
-layout (binding = 0, set = 1) uniform texture2D TextureHeap[512];
-layout (binding = 0, set = 2) uniform sampler   SamplerHeap[512];
+layout (binding = 0, set = 1) uniform texture2D TextureHeap[];
+layout (binding = 0, set = 2) uniform sampler   SamplerHeap[];
 layout (binding = 0, set = 3) uniform BindlessMaterial {
     uvec4 BindlessIndex; // x = albedo, y = normal, z = mr, w = albedo sampler
     vec3 color_factor;
@@ -30,7 +31,10 @@ layout (binding = 0, set = 5) uniform RenderParams {
 
 vec3 GetNormalFromMap()
 {
-    vec3 tangentNormal = texture(sampler2D(TextureHeap[BindlessIndex.y], SamplerHeap[0]), FragmentIn.fTexcoords).xyz * 2.0 - 1.0;
+    // Only X/Y are stored (BC5), Z is rebuilt from the unit length
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(sampler2D(TextureHeap[BindlessIndex.y], SamplerHeap[BindlessIndex.w]), FragmentIn.fTexcoords).xy * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     vec3 Q1  = dFdx(FragmentIn.fPosition);
     vec3 Q2  = dFdy(FragmentIn.fPosition);
@@ -49,7 +53,7 @@ void main()
 {    
     vec3 N = GetNormalFromMap();
     vec4 alb = texture(sampler2D(TextureHeap[BindlessIndex.x], SamplerHeap[BindlessIndex.w]), FragmentIn.fTexcoords) * vec4(color_factor, 1.0);
-    vec4 mr = texture(sampler2D(TextureHeap[BindlessIndex.z], SamplerHeap[0]), FragmentIn.fTexcoords);
+    vec4 mr = texture(sampler2D(TextureHeap[BindlessIndex.z], SamplerHeap[BindlessIndex.w]), FragmentIn.fTexcoords);
 
     if (metallic_factor > 0)
         mr.b *= metallic_factor;
@@ -0,0 +1,239 @@
+#include "job_system.h"
+
+#include "platform_layer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+typedef struct job job;
+struct job
+{
+    AuroraJobEntry entry;
+    void* data;
+    JobCounter* counter;
+};
+
+// Owner pushes and pops at the bottom, thieves take from the top.
+typedef struct job_queue job_queue;
+struct job_queue
+{
+    Mutex* lock;
+    job jobs[JOB_QUEUE_CAPACITY];
+    u32 top;
+    u32 bottom;
+};
+
+typedef struct job_worker job_worker;
+struct job_worker
+{
+    Thread* thread;
+    u32 index;
+};
+
+typedef struct job_system job_system;
+struct job_system
+{
+    // Queue 0 belongs to every thread that isn't a worker (main, audio...)
+    job_queue* queues;
+    job_worker* workers;
+    u32 queue_count;
+    u32 worker_count;
+
+    Semaphore* wake;
+    volatile i32 quit;
+};
+
+internal job_system s_jobs;
+internal THREAD_LOCAL u32 s_queue_index;
+
+internal b32 job_queue_push(job_queue* queue, job* j)
+{
+    b32 pushed = 0;
+
+    aurora_platform_lock_mutex(queue->lock);
+    if (queue->bottom - queue->top < JOB_QUEUE_CAPACITY)
+    {
+        queue->jobs[queue->bottom % JOB_QUEUE_CAPACITY] = *j;
+        queue->bottom++;
+        pushed = 1;
+    }
+    aurora_platform_unlock_mutex(queue->lock);
+
+    return pushed;
+}
+
+internal b32 job_queue_pop(job_queue* queue, job* out)
+{
+    b32 popped = 0;
+
+    aurora_platform_lock_mutex(queue->lock);
+    if (queue->bottom != queue->top)
+    {
+        queue->bottom--;
+        *out = queue->jobs[queue->bottom % JOB_QUEUE_CAPACITY];
+        popped = 1;
+    }
+    aurora_platform_unlock_mutex(queue->lock);
+
+    return popped;
+}
+
+internal b32 job_queue_steal(job_queue* queue, job* out)
+{
+    b32 stolen = 0;
+
+    aurora_platform_lock_mutex(queue->lock);
+    if (queue->bottom != queue->top)
+    {
+        *out = queue->jobs[queue->top % JOB_QUEUE_CAPACITY];
+        queue->top++;
+        stolen = 1;
+    }
+    aurora_platform_unlock_mutex(queue->lock);
+
+    return stolen;
+}
+
+internal b32 job_find(job* out)
+{
+    u32 self = s_queue_index;
+
+    if (job_queue_pop(&s_jobs.queues[self], out))
+        return 1;
+
+    for (u32 i = 1; i < s_jobs.queue_count; i++)
+    {
+        u32 victim = (self + i) % s_jobs.queue_count;
+        if (job_queue_steal(&s_jobs.queues[victim], out))
+            return 1;
+    }
+
+    return 0;
+}
+
+internal void job_execute(job* j)
+{
+    j->entry(j->data);
+
+    if (j->counter)
+        aurora_platform_atomic_decrement(&j->counter->value);
+}
+
+internal void job_worker_main(Thread* thread)
+{
+    job_worker* worker = (job_worker*)aurora_platform_get_thread_ptr(thread);
+    s_queue_index = worker->index;
+
+    while (!s_jobs.quit)
+    {
+        job j;
+        if (job_find(&j))
+            job_execute(&j);
+        else
+            aurora_platform_wait_semaphore(s_jobs.wake);
+    }
+}
+
+void job_system_init(u32 worker_count)
+{
+    memset(&s_jobs, 0, sizeof(s_jobs));
+
+    if (worker_count == 0)
+    {
+        u32 cores = aurora_platform_get_processor_count();
+        worker_count = cores > 1 ? cores - 1 : 1;
+    }
+    worker_count = min(worker_count, JOB_SYSTEM_MAX_WORKERS);
+
+    s_jobs.worker_count = worker_count;
+    s_jobs.queue_count = worker_count + 1;
+    s_jobs.queues = calloc(s_jobs.queue_count, sizeof(job_queue));
+    s_jobs.workers = calloc(worker_count, sizeof(job_worker));
+    s_jobs.wake = aurora_platform_new_semaphore(0);
+    s_queue_index = 0;
+
+    for (u32 i = 0; i < s_jobs.queue_count; i++)
+        s_jobs.queues[i].lock = aurora_platform_new_mutex(0);
+
+    for (u32 i = 0; i < worker_count; i++)
+    {
+        job_worker* worker = &s_jobs.workers[i];
+        worker->index = i + 1;
+        worker->thread = aurora_platform_new_thread(job_worker_main);
+        aurora_platform_set_thread_ptr(worker->thread, worker);
+        aurora_platform_execute_thread(worker->thread);
+    }
+}
+
+void job_system_free()
+{
+    s_jobs.quit = 1;
+    aurora_platform_signal_semaphore(s_jobs.wake, s_jobs.worker_count);
+
+    for (u32 i = 0; i < s_jobs.worker_count; i++)
+        aurora_platform_free_thread(s_jobs.workers[i].thread);
+
+    for (u32 i = 0; i < s_jobs.queue_count; i++)
+        aurora_platform_free_mutex(s_jobs.queues[i].lock);
+
+    aurora_platform_free_semaphore(s_jobs.wake);
+    free(s_jobs.workers);
+    free(s_jobs.queues);
+    memset(&s_jobs, 0, sizeof(s_jobs));
+}
+
+u32 job_system_worker_count()
+{
+    return s_jobs.worker_count;
+}
+
+void job_submit(AuroraJobEntry entry, void* data, JobCounter* counter)
+{
+    job j;
+    j.entry = entry;
+    j.data = data;
+    j.counter = counter;
+
+    if (counter)
+        aurora_platform_atomic_increment(&counter->value);
+
+    // Not initialised, or the queue is full: run it here rather than dropping it
+    if (s_jobs.queue_count == 0 || !job_queue_push(&s_jobs.queues[s_queue_index], &j))
+    {
+        job_execute(&j);
+        return;
+    }
+
+    aurora_platform_signal_semaphore(s_jobs.wake, 1);
+}
+
+void job_submit_batch(AuroraJobEntry entry, void* data, u64 stride, u32 count, JobCounter* counter)
+{
+    for (u32 i = 0; i < count; i++)
+        job_submit(entry, (u8*)data + i * stride, counter);
+}
+
+void job_wait(JobCounter* counter)
+{
+    while (aurora_platform_atomic_load(&counter->value) > 0)
+    {
+        job j;
+        if (s_jobs.queue_count > 0 && job_find(&j))
+            job_execute(&j);
+        else
+            aurora_platform_yield_thread();
+    }
+}
+
+b32 job_done(JobCounter* counter)
+{
+    // Acquire pairs with the decrement in job_execute, so the job's writes are visible once this says done
+    return aurora_platform_atomic_load(&counter->value) <= 0;
+}
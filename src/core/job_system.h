@@ -0,0 +1,30 @@
+#ifndef JOB_SYSTEM_H_INCLUDED
+#define JOB_SYSTEM_H_INCLUDED
+
+#include "common.h"
+
+#define JOB_SYSTEM_MAX_WORKERS 64
+#define JOB_QUEUE_CAPACITY 4096
+
+typedef void (*AuroraJobEntry)(void* data);
+
+// Incremented by job_submit, decremented when the job finishes. A counter can be shared by many jobs.
+typedef struct JobCounter JobCounter;
+struct JobCounter
+{
+    volatile i32 value;
+};
+
+// worker_count == 0 spawns one worker per logical core, minus the calling thread
+void job_system_init(u32 worker_count);
+void job_system_free();
+u32  job_system_worker_count();
+
+void job_submit(AuroraJobEntry entry, void* data, JobCounter* counter);
+// Submits count jobs, job i receives (u8*)data + i * stride
+void job_submit_batch(AuroraJobEntry entry, void* data, u64 stride, u32 count, JobCounter* counter);
+// Runs queued jobs on the calling thread until the counter reaches zero, safe to call from inside a job
+void job_wait(JobCounter* counter);
+b32  job_done(JobCounter* counter);
+
+#endif
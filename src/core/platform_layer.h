@@ -9,6 +9,7 @@
 
 typedef struct Thread Thread;
 typedef struct Mutex Mutex;
+typedef struct Semaphore Semaphore;
 
 typedef void (*AuroraResizeEvent)(u32, u32);
 typedef void (*AuroraThreadWorker)(Thread*);
@@ -19,6 +20,7 @@ struct AuroraPlatformLayer
 	u32 width;
 	u32 height;
 	b32 quit;
+	b32 headless; // No window or input, the swapchain presents to a VK_EXT_headless_surface
 	
 	char executable_directory[512];
 
@@ -31,6 +33,9 @@ void  	aurora_platform_layer_init();
 void  	aurora_platform_layer_free();
 
 char* 	aurora_platform_read_file(const char* path, u32* out_size);
+// Read-only view of a whole file, NULL if it can't be opened
+void*   aurora_platform_map_file(const char* path, u64* out_size);
+void    aurora_platform_unmap_file(void* data, u64 size);
 
 void  	aurora_platform_open_window(const char* title);
 void  	aurora_platform_update_window();
@@ -59,4 +64,18 @@ void    aurora_platform_lock_mutex(Mutex* mutex);
 void    aurora_platform_unlock_mutex(Mutex* mutex);
 void*   aurora_platform_mutex_get_ptr(Mutex* mutex);
 
+Semaphore* aurora_platform_new_semaphore(u32 initial_count);
+void       aurora_platform_free_semaphore(Semaphore* semaphore);
+void       aurora_platform_wait_semaphore(Semaphore* semaphore);
+void       aurora_platform_signal_semaphore(Semaphore* semaphore, u32 count);
+
+// Atomics return the new value
+// Load with acquire ordering: whatever was written before the store that produced the value is visible after it
+i32     aurora_platform_atomic_load(volatile i32* value);
+i32     aurora_platform_atomic_increment(volatile i32* value);
+i32     aurora_platform_atomic_decrement(volatile i32* value);
+i32     aurora_platform_atomic_add(volatile i32* value, i32 addend);
+void    aurora_platform_yield_thread();
+u32     aurora_platform_get_processor_count();
+
 #endif //PLATFORM_LAYER_H
@@ -0,0 +1,364 @@
+#if !defined(_WIN32)
+
+#include "platform_layer.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+AuroraPlatformLayer platform;
+
+typedef struct Posix_Aurora Posix_Aurora;
+struct Posix_Aurora
+{
+	f64 timer_start;
+};
+
+internal Posix_Aurora posix;
+
+// The only thing a signal handler may write, aurora_platform_update_window passes it on to platform.quit
+internal volatile sig_atomic_t s_quit_requested;
+
+internal void posix_signal_handler(int signal)
+{
+	s_quit_requested = 1;
+}
+
+internal f64 posix_monotonic_seconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (f64)ts.tv_sec + (f64)ts.tv_nsec * 1e-9;
+}
+
+void aurora_platform_layer_init()
+{
+	memset(&platform, 0, sizeof(platform));
+	memset(&posix, 0, sizeof(posix));
+
+	// There is no windowing backend on POSIX yet, so the engine always runs without a display.
+	platform.headless = 1;
+
+	char path[512] = {0};
+	ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (length > 0)
+	{
+		path[length] = '\0';
+		strncpy(platform.executable_directory, dirname(path), sizeof(platform.executable_directory) - 1);
+	}
+	else
+	{
+		getcwd(platform.executable_directory, sizeof(platform.executable_directory));
+	}
+
+	aurora_platform_init_timer();
+}
+
+void aurora_platform_layer_free()
+{
+}
+
+void aurora_platform_open_window(const char* title)
+{
+	// Headless: nothing to open, but still let CI stop the frame loop cleanly.
+	struct sigaction action = {0};
+	action.sa_handler = posix_signal_handler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	platform.quit = 0;
+	if (platform.resize_event != NULL)
+		platform.resize_event(platform.width, platform.height);
+}
+
+void aurora_platform_update_window()
+{
+	if (s_quit_requested)
+		platform.quit = 1;
+}
+
+void aurora_platform_free_window()
+{
+}
+
+char* aurora_platform_read_file(const char* path, u32* out_size)
+{
+	FILE* file = fopen(path, "rb");
+
+	if (!file)
+	{
+		assert(0);
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	u32 filesizepadded = (size % 4 == 0 ? size * 4 : (size + 1) * 4) / 4;
+
+	char* buffer = malloc(filesizepadded);
+	if (!buffer)
+	{
+		fclose(file);
+		*out_size = 0;
+		assert(0);
+		return NULL;
+	}
+
+	fread(buffer, size, sizeof(char), file);
+	fclose(file);
+
+	*out_size = (u32)size;
+	return buffer;
+}
+
+void* aurora_platform_map_file(const char* path, u64* out_size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	*out_size = (u64)info.st_size;
+	return data;
+}
+
+void aurora_platform_unmap_file(void* data, u64 size)
+{
+	munmap(data, (size_t)size);
+}
+
+void aurora_platform_create_vk_surface(VkInstance instance, VkSurfaceKHR* out)
+{
+	VkHeadlessSurfaceCreateInfoEXT surface_create_info = {0};
+	surface_create_info.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+
+	vkCreateHeadlessSurfaceEXT(instance, &surface_create_info, NULL, out);
+}
+
+void aurora_platform_init_timer()
+{
+	posix.timer_start = posix_monotonic_seconds();
+}
+
+f32 aurora_platform_get_time()
+{
+	return (f32)(posix_monotonic_seconds() - posix.timer_start);
+}
+
+b32 aurora_platform_key_pressed(u32 key)
+{
+	return 0;
+}
+
+b32 aurora_platform_mouse_button_pressed(u32 button)
+{
+	return 0;
+}
+
+f32 aurora_platform_get_mouse_x()
+{
+	return 0.0f;
+}
+
+f32 aurora_platform_get_mouse_y()
+{
+	return 0.0f;
+}
+
+struct Thread
+{
+	pthread_t handle;
+	b32 started;
+	void* ptr;
+	b32 working;
+	AuroraThreadWorker worker;
+};
+
+internal void* _thread_worker(void* param)
+{
+	Thread* thread = (Thread*)param;
+
+	thread->working = 1;
+	thread->worker(thread);
+
+	return NULL;
+}
+
+Thread* aurora_platform_new_thread(AuroraThreadWorker worker)
+{
+	Thread* thread = malloc(sizeof(Thread));
+	memset(thread, 0, sizeof(Thread));
+	thread->worker = worker;
+	return thread;
+}
+
+void aurora_platform_free_thread(Thread* thread)
+{
+	aurora_platform_join_thread(thread);
+	free(thread);
+}
+
+void aurora_platform_execute_thread(Thread* thread)
+{
+	thread->started = pthread_create(&thread->handle, NULL, _thread_worker, thread) == 0;
+}
+
+void aurora_platform_join_thread(Thread* thread)
+{
+	thread->working = 0;
+	if (!thread->started) return;
+
+	pthread_join(thread->handle, NULL);
+	thread->started = 0;
+}
+
+b32 aurora_platform_active_thread(Thread* thread)
+{
+	return thread->working;
+}
+
+void* aurora_platform_get_thread_ptr(Thread* thread)
+{
+	return thread->ptr;
+}
+
+void aurora_platform_set_thread_ptr(Thread* thread, void* ptr)
+{
+	thread->ptr = ptr;
+}
+
+struct Mutex
+{
+	pthread_mutex_t handle;
+
+	void* ptr;
+};
+
+Mutex* aurora_platform_new_mutex(u64 size)
+{
+	Mutex* mutex = malloc(sizeof(Mutex));
+	memset(mutex, 0, sizeof(Mutex));
+
+	pthread_mutex_init(&mutex->handle, NULL);
+
+	if (size > 0) {
+		mutex->ptr = malloc(size);
+	}
+
+	return mutex;
+}
+
+void aurora_platform_free_mutex(Mutex* mutex)
+{
+	pthread_mutex_destroy(&mutex->handle);
+
+	if (mutex->ptr)
+		free(mutex->ptr);
+
+	free(mutex);
+}
+
+void aurora_platform_lock_mutex(Mutex* mutex)
+{
+	pthread_mutex_lock(&mutex->handle);
+}
+
+void aurora_platform_unlock_mutex(Mutex* mutex)
+{
+	pthread_mutex_unlock(&mutex->handle);
+}
+
+void* aurora_platform_mutex_get_ptr(Mutex* mutex)
+{
+	return mutex->ptr;
+}
+
+struct Semaphore
+{
+	sem_t handle;
+};
+
+Semaphore* aurora_platform_new_semaphore(u32 initial_count)
+{
+	Semaphore* semaphore = malloc(sizeof(Semaphore));
+
+	sem_init(&semaphore->handle, 0, initial_count);
+
+	return semaphore;
+}
+
+void aurora_platform_free_semaphore(Semaphore* semaphore)
+{
+	sem_destroy(&semaphore->handle);
+	free(semaphore);
+}
+
+void aurora_platform_wait_semaphore(Semaphore* semaphore)
+{
+	while (sem_wait(&semaphore->handle) != 0)
+		continue; // Interrupted by a signal
+}
+
+void aurora_platform_signal_semaphore(Semaphore* semaphore, u32 count)
+{
+	for (u32 i = 0; i < count; i++)
+		sem_post(&semaphore->handle);
+}
+
+i32 aurora_platform_atomic_load(volatile i32* value)
+{
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+i32 aurora_platform_atomic_increment(volatile i32* value)
+{
+	return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+i32 aurora_platform_atomic_decrement(volatile i32* value)
+{
+	return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+i32 aurora_platform_atomic_add(volatile i32* value, i32 addend)
+{
+	return __atomic_add_fetch(value, addend, __ATOMIC_SEQ_CST);
+}
+
+void aurora_platform_yield_thread()
+{
+	sched_yield();
+}
+
+u32 aurora_platform_get_processor_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (u32)count : 1;
+}
+
+#endif
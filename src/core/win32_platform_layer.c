@@ -1,9 +1,13 @@
+#if defined(_WIN32)
+
 #include "platform_layer.h"
 
 #include <Windows.h>
 #include <assert.h>
 #include <Shlwapi.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
 
 AuroraPlatformLayer platform;
 
@@ -51,6 +55,9 @@ void aurora_platform_layer_init()
 	GetModuleFileName(windows.application_hmodule, platform.executable_directory, 512);
     PathRemoveFileSpecA(platform.executable_directory);
 
+	char* headless = getenv("AURORA_HEADLESS");
+	platform.headless = headless && headless[0] == '1';
+
 	aurora_platform_init_timer();
 }
 
@@ -60,6 +67,9 @@ void aurora_platform_layer_free()
 
 void aurora_platform_open_window(const char* title)
 {
+	if (platform.headless)
+		return;
+
 	WNDCLASSA wnd_class = {0};
 	wnd_class.hInstance = (HINSTANCE)windows.application_hmodule;
 	wnd_class.lpszClassName = "aurora_window_class";
@@ -74,6 +84,9 @@ void aurora_platform_open_window(const char* title)
 
 void aurora_platform_update_window()
 {
+	if (platform.headless)
+		return;
+
 	MSG msg;
 	while (PeekMessage(&msg, windows.hwnd, 0, 0, PM_REMOVE))
 	{
@@ -84,6 +97,9 @@ void aurora_platform_update_window()
 
 void aurora_platform_free_window()
 {
+	if (platform.headless)
+		return;
+
 	DestroyWindow(windows.hwnd);
 }
 
@@ -126,8 +142,50 @@ char* aurora_platform_read_file(const char* path, u32* out_size)
 	return NULL;
 }
 
+void* aurora_platform_map_file(const char* path, u64* out_size)
+{
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return NULL;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping)
+		return NULL;
+
+	// The view keeps the mapping alive
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!data)
+		return NULL;
+
+	*out_size = (u64)size.QuadPart;
+	return data;
+}
+
+void aurora_platform_unmap_file(void* data, u64 size)
+{
+	UnmapViewOfFile(data);
+}
+
 void aurora_platform_create_vk_surface(VkInstance instance, VkSurfaceKHR* out)
 {
+	if (platform.headless)
+	{
+		VkHeadlessSurfaceCreateInfoEXT headless_create_info = {0};
+		headless_create_info.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+
+		vkCreateHeadlessSurfaceEXT(instance, &headless_create_info, NULL, out);
+		return;
+	}
+
 	VkWin32SurfaceCreateInfoKHR surface_create_info = {0};
 	surface_create_info.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR;
 	surface_create_info.hinstance = windows.application_hmodule;
@@ -244,9 +302,13 @@ void aurora_platform_set_thread_ptr(Thread* thread, void* ptr)
 	thread->ptr = ptr;
 }
 
+// A critical section stays in user mode unless the lock is actually contended, a kernel mutex costs a syscall
+// per lock. Still recursive, like the kernel mutex was.
+#define WIN32_MUTEX_SPIN_COUNT 4000
+
 struct Mutex
 {
-	HANDLE handle;
+	CRITICAL_SECTION handle;
 	
 	void* ptr;
 };
@@ -254,8 +316,9 @@ struct Mutex
 Mutex* aurora_platform_new_mutex(u64 size)
 {
 	Mutex* mutex = malloc(sizeof(Mutex));
+	memset(mutex, 0, sizeof(Mutex));
 
-	mutex->handle = CreateMutex(NULL, 0, NULL);
+	InitializeCriticalSectionAndSpinCount(&mutex->handle, WIN32_MUTEX_SPIN_COUNT);
 
 	if (size > 0) {
 		mutex->ptr = malloc(size);
@@ -266,7 +329,7 @@ Mutex* aurora_platform_new_mutex(u64 size)
 
 void aurora_platform_free_mutex(Mutex* mutex)
 {
-	CloseHandle(mutex->handle);
+	DeleteCriticalSection(&mutex->handle);
 
 	if (mutex->ptr)
 		free(mutex->ptr);
@@ -276,15 +339,79 @@ void aurora_platform_free_mutex(Mutex* mutex)
 
 void aurora_platform_lock_mutex(Mutex* mutex)
 {
-	WaitForSingleObject(mutex->handle, INFINITE);
+	EnterCriticalSection(&mutex->handle);
 }
 
 void aurora_platform_unlock_mutex(Mutex* mutex)
 {
-	ReleaseMutex(mutex->handle);
+	LeaveCriticalSection(&mutex->handle);
 }
 
 void* aurora_platform_mutex_get_ptr(Mutex* mutex)
 {
 	return mutex->ptr;
-}
\ No newline at end of file
+}
+
+struct Semaphore
+{
+	HANDLE handle;
+};
+
+Semaphore* aurora_platform_new_semaphore(u32 initial_count)
+{
+	Semaphore* semaphore = malloc(sizeof(Semaphore));
+
+	semaphore->handle = CreateSemaphore(NULL, (LONG)initial_count, LONG_MAX, NULL);
+
+	return semaphore;
+}
+
+void aurora_platform_free_semaphore(Semaphore* semaphore)
+{
+	CloseHandle(semaphore->handle);
+	free(semaphore);
+}
+
+void aurora_platform_wait_semaphore(Semaphore* semaphore)
+{
+	WaitForSingleObject(semaphore->handle, INFINITE);
+}
+
+void aurora_platform_signal_semaphore(Semaphore* semaphore, u32 count)
+{
+	ReleaseSemaphore(semaphore->handle, (LONG)count, NULL);
+}
+
+i32 aurora_platform_atomic_load(volatile i32* value)
+{
+	return (i32)ReadAcquire((volatile LONG*)value);
+}
+
+i32 aurora_platform_atomic_increment(volatile i32* value)
+{
+	return (i32)InterlockedIncrement((volatile LONG*)value);
+}
+
+i32 aurora_platform_atomic_decrement(volatile i32* value)
+{
+	return (i32)InterlockedDecrement((volatile LONG*)value);
+}
+
+i32 aurora_platform_atomic_add(volatile i32* value, i32 addend)
+{
+	return (i32)InterlockedExchangeAdd((volatile LONG*)value, (LONG)addend) + addend;
+}
+
+void aurora_platform_yield_thread()
+{
+	SwitchToThread();
+}
+
+u32 aurora_platform_get_processor_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (u32)info.dwNumberOfProcessors;
+}
+
+#endif
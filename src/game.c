@@ -2,6 +2,7 @@
 
 #include <core/platform_layer.h>
 #include <core/random.h>
+#include <core/job_system.h>
 #include <client/camera.h>
 #include <gfx/rhi.h>
 #include <gfx/render_graph.h>
@@ -12,6 +13,7 @@
 #include <resource/mesh.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
 typedef struct GameData GameData;
@@ -28,6 +30,8 @@ struct GameData
     RenderGraphNode* fbp;
 
     Mesh test_model;
+    MeshLoadHandle test_model_load;
+    f64 test_model_load_start;
 
 	Thread* audio_thread;
 	AudioClip debug_music;
@@ -56,6 +60,7 @@ void game_init()
 	platform.height = 720;
 	platform.resize_event = game_resize;
 	aurora_platform_open_window("Aurora Window");
+	job_system_init(0);
 
     rhi_init();
 	fps_camera_init(&data.camera);
@@ -73,18 +78,13 @@ void game_init()
 	}
 	data.rge.light_info.light_count = TEST_LIGHT_COUNT;
 
-	f64 start = aurora_platform_get_time();
+	data.test_model_load_start = aurora_platform_get_time();
 
 #if TEST_MODEL_SPONZA
-	mesh_load(&data.test_model, "assets/Sponza.gltf");
+	data.test_model_load = mesh_load_async(&data.test_model, "assets/Sponza.gltf");
 #elif TEST_MODEL_HELMET
-	mesh_load(&data.test_model, "assets/DamagedHelmet.gltf");
+	data.test_model_load = mesh_load_async(&data.test_model, "assets/DamagedHelmet.gltf");
 #endif
-	f64 end = aurora_platform_get_time();
-	printf("Model loaded in %f seconds", end - start);
-
-	data.rge.models[0] = data.test_model;
-	data.rge.model_count++;
 
     data.gp = create_geometry_pass();
 	data.fxaap = create_fxaa_pass();
@@ -118,6 +118,16 @@ void game_update()
 		if (aurora_platform_key_pressed(KEY_W))
 			data.update_frustum = 0;
 
+		// Frame boundary: nothing is recording, finished loads can upload and join the scene
+		Mesh* resident[MESH_MAX_ASYNC_LOADS];
+		u32 resident_count = mesh_loader_update(resident, MESH_MAX_ASYNC_LOADS);
+		for (u32 i = 0; i < resident_count && data.rge.model_count < RENDER_GRAPH_MAX_MODELS; i++)
+		{
+			data.rge.models[data.rge.model_count++] = resident[i];
+			if (resident[i] == &data.test_model)
+				printf("Model loaded in %f seconds\n", aurora_platform_get_time() - data.test_model_load_start);
+		}
+
 		rhi_begin();
 		update_render_graph(&data.rg, &data.rge);
 		rhi_end();
@@ -137,7 +147,9 @@ void game_update()
 
 		aurora_platform_update_window();
 
+#if defined(_WIN32)
 		system("cls");
+#endif
 	}
 }
 
@@ -148,7 +160,8 @@ void game_exit()
 
     rhi_wait_idle();
 
-	mesh_free(&data.test_model);
+	if (mesh_load_resident(data.test_model_load))
+		mesh_free(&data.test_model);
 
 	free_render_graph(&data.rg, &data.rge);
 
@@ -157,6 +170,7 @@ void game_exit()
 	rhi_free_descriptor_heap(&data.rge.sampler_heap);
 	rhi_shutdown();
 	
+	job_system_free();
 	aurora_platform_free_window();
 	aurora_platform_layer_free();
 
@@ -1,5 +1,8 @@
 #include "final_blit_pass.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 void final_blit_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
 {
 
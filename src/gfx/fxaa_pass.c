@@ -2,6 +2,8 @@
 
 #include <core/platform_layer.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 typedef struct fxaa_pass_data fxaa_pass_data;
 struct fxaa_pass_data
@@ -60,7 +62,7 @@ void fxaa_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
         descriptor.set_layout_count = 2;
         descriptor.depth_biased_enable = 0;
 
-        rhi_init_graphics_pipeline(&data->fxaa_pipeline, &descriptor);
+        rhi_init_graphics_pipeline_async(&data->fxaa_pipeline, &descriptor);
 
         rhi_free_shader(&vs);
         rhi_free_shader(&ps);
@@ -1,7 +1,20 @@
 #include "geometry_pass.h"
 
 #include <core/platform_layer.h>
+#include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+// Coarsest LOD whose simplification error projects to at most this many pixels
+#define GEOMETRY_PASS_LOD_PIXEL_ERROR 1.0f
+
+// Every primitive of every model takes one PrimitiveConstants slot of the frame ring
+#if RENDER_GRAPH_MAX_MODELS * MAX_PRIMITIVES > RHI_FRAME_RING_MAX_DRAWS
+#error "The frame ring can't hold one draw per primitive, raise RHI_FRAME_RING_MAX_DRAWS"
+#endif
 
 typedef struct geometry_pass geometry_pass;
 struct geometry_pass
@@ -36,7 +49,7 @@ struct geometry_pass
     RHI_Image gMetallicRoughness;
 
     RHI_Buffer screen_vertex_buffer;
-    RHI_Buffer render_params_buffer;
+    u32 params_offset;
 
     RHI_DescriptorSetLayout cubemap_set_layout;
     RHI_DescriptorSet cubemap_set;
@@ -50,6 +63,10 @@ struct geometry_pass
     RHI_DescriptorSetLayout params_set_layout;
     RHI_DescriptorSet params_set;
 
+    // PrimitiveConstants of every gbuffer draw, one frame ring slice each
+    RHI_DescriptorSetLayout draw_set_layout;
+    RHI_DescriptorSet draw_set;
+
     RHI_DescriptorSetLayout deferred_set_layout;
     RHI_DescriptorSet deferred_set;
 
@@ -63,6 +80,7 @@ struct geometry_pass
 void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
 {
     geometry_pass* data = node->private_data;
+    assert(sizeof(PrimitiveConstants) <= RHI_FRAME_RING_DRAW_SIZE);
     data->parameters.show_meshlets = 0;
     data->parameters.shade_meshlets = 0;
     
@@ -76,17 +94,18 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
     rhi_allocate_buffer(&data->screen_vertex_buffer, sizeof(quad_vertices), BUFFER_VERTEX);
     rhi_upload_buffer(&data->screen_vertex_buffer, quad_vertices, sizeof(quad_vertices));
 
-    rhi_allocate_buffer(&data->render_params_buffer, sizeof(data->parameters), BUFFER_UNIFORM);
-
     data->nearest_sampler.address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	data->nearest_sampler.filter = VK_FILTER_NEAREST;
 	rhi_init_sampler(&data->nearest_sampler, 1);
-	rhi_push_descriptor_heap_sampler(&execute->sampler_heap, &data->nearest_sampler, 0);
 
     data->linear_sampler.address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
 	data->linear_sampler.filter = VK_FILTER_LINEAR;
 	rhi_init_sampler(&data->linear_sampler, 1);
-	rhi_push_descriptor_heap_sampler(&execute->sampler_heap, &data->linear_sampler, 1);
+
+    // The shaders index SamplerHeap[0] and [1] directly, so these have to be the heap's first allocations
+    i32 nearest_index = rhi_get_sampler_heap_index(&execute->sampler_heap, &data->nearest_sampler);
+    i32 linear_index = rhi_get_sampler_heap_index(&execute->sampler_heap, &data->linear_sampler);
+    assert(nearest_index == 0 && linear_index == 1);
 
     data->cubemap_sampler.address_mode = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
     data->cubemap_sampler.filter = VK_FILTER_LINEAR;
@@ -95,7 +114,7 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
     RHI_RawImage raw_hdr;
     rhi_load_raw_hdr_image(&raw_hdr, "assets/env_map.hdr");
     
-    rhi_upload_image(&data->hdr_cubemap, &raw_hdr, 0);
+    rhi_upload_image(&data->hdr_cubemap, &raw_hdr);
     rhi_free_raw_image(&raw_hdr);
     rhi_allocate_cubemap(&data->cubemap, 512, 512, VK_FORMAT_R16G16B16A16_UNORM, IMAGE_STORAGE, VK_IMAGE_LAYOUT_GENERAL);
     rhi_allocate_cubemap(&data->irradiance, 128, 128, VK_FORMAT_R16G16B16A16_UNORM, IMAGE_STORAGE, VK_IMAGE_LAYOUT_GENERAL);
@@ -110,9 +129,6 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
     rhi_allocate_image(&node->outputs[1], execute->width, execute->height, VK_FORMAT_D24_UNORM_S8_UINT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
     node->output_count = 2;
 
-    RHI_CommandBuffer cmd_buf;
-    rhi_init_cmd_buf(&cmd_buf, COMMAND_BUFFER_COMPUTE);
-
     {
         {
             data->cubemap_set_layout.descriptors[0] = DESCRIPTOR_STORAGE_IMAGE;
@@ -134,7 +150,7 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
             descriptor.shaders.cs = &cs;
             descriptor.depth_biased_enable = 0;
 
-            rhi_init_compute_pipeline(&data->cubemap_pipeline, &descriptor);
+            rhi_init_compute_pipeline_async(&data->cubemap_pipeline, &descriptor);
 
             rhi_free_shader(&cs);
         }
@@ -157,7 +173,7 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
             descriptor.set_layout_count = 1;
             descriptor.shaders.cs = &cs;
 
-            rhi_init_compute_pipeline(&data->irradiance_pipeline, &descriptor);
+            rhi_init_compute_pipeline_async(&data->irradiance_pipeline, &descriptor);
 
             rhi_free_shader(&cs);
         }
@@ -180,7 +196,7 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
             descriptor.set_layout_count = 1;
             descriptor.shaders.cs = &cs;
 
-            rhi_init_compute_pipeline(&data->prefilter_pipeline, &descriptor);
+            rhi_init_compute_pipeline_async(&data->prefilter_pipeline, &descriptor);
 
             rhi_free_shader(&cs);
         }
@@ -202,78 +218,10 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
             descriptor.set_layout_count = 1;
             descriptor.shaders.cs = &cs;
 
-            rhi_init_compute_pipeline(&data->brdf_pipeline, &descriptor);
+            rhi_init_compute_pipeline_async(&data->brdf_pipeline, &descriptor);
 
             rhi_free_shader(&cs);
         }
-
-        // equi to cubemap compute
-        {
-            rhi_begin_cmd_buf(&cmd_buf);
-
-            rhi_cmd_img_transition_layout(&cmd_buf, &data->hdr_cubemap, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
-            rhi_cmd_img_transition_layout(&cmd_buf, &data->cubemap, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
-
-            rhi_descriptor_set_write_storage_image(&data->cubemap_set, &data->hdr_cubemap, &data->nearest_sampler, 0);
-            rhi_descriptor_set_write_storage_image(&data->cubemap_set, &data->cubemap, &data->cubemap_sampler, 1);
-
-            rhi_cmd_set_pipeline(&cmd_buf, &data->cubemap_pipeline);
-            rhi_cmd_set_descriptor_set(&cmd_buf, &data->cubemap_pipeline, &data->cubemap_set, 0);
-            rhi_cmd_dispatch(&cmd_buf, 1024 / 32, 1024 / 32, 6);
-        }
-
-        // irradiance
-        {
-            rhi_cmd_img_transition_layout(&cmd_buf, &data->cubemap, 0, 0, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
-            rhi_cmd_img_transition_layout(&cmd_buf, &data->irradiance, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
-
-            rhi_descriptor_set_write_image_sampler(&data->irradiance_set, &data->cubemap, &data->cubemap_sampler, 0);
-            rhi_descriptor_set_write_storage_image(&data->irradiance_set, &data->irradiance, &data->cubemap_sampler, 1);
-
-            rhi_cmd_set_pipeline(&cmd_buf, &data->irradiance_pipeline);
-            rhi_cmd_set_descriptor_set(&cmd_buf, &data->irradiance_pipeline, &data->irradiance_set, 0);
-            rhi_cmd_dispatch(&cmd_buf, 128 / 32, 128 / 32, 6);
-        }
-
-        // prefilter
-        {
-            rhi_cmd_img_transition_layout(&cmd_buf, &data->prefilter, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
-
-            rhi_descriptor_set_write_image_sampler(&data->prefilter_set, &data->cubemap, &data->cubemap_sampler, 0);
-            rhi_descriptor_set_write_storage_image(&data->prefilter_set, &data->prefilter, &data->cubemap_sampler, 1);
-
-            rhi_cmd_set_pipeline(&cmd_buf, &data->prefilter_pipeline);
-            rhi_cmd_set_descriptor_set(&cmd_buf, &data->prefilter_pipeline, &data->prefilter_set, 0);
-
-            for (u32 i = 0; i < 5; i++)
-	        {
-	        	u32 mip_width = (u32)(512.0f * pow(0.5f, i));
-	        	u32 mip_height = (u32)(512.0f * pow(0.5f, i));
-	        	f32 roughness = (f32)i / (f32)(5 - 1);
-
-	        	hmm_vec4 vec;
-                vec.X = roughness;
-
-	        	rhi_cmd_set_push_constants(&cmd_buf, &data->prefilter_pipeline, &vec, sizeof(hmm_vec4));
-	        	rhi_cmd_dispatch(&cmd_buf, mip_width / 32, mip_height / 32, 6);
-	        }
-        }
-
-        // brdf
-        {
-            rhi_cmd_img_transition_layout(&cmd_buf, &data->brdf, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
-
-            rhi_descriptor_set_write_storage_image(&data->brdf_set, &data->brdf, &data->nearest_sampler, 0);
-
-            rhi_cmd_set_pipeline(&cmd_buf, &data->brdf_pipeline);
-            rhi_cmd_set_descriptor_set(&cmd_buf, &data->brdf_pipeline, &data->brdf_set, 0);
-            rhi_cmd_dispatch(&cmd_buf, 512 / 32, 512 / 32, 6);
-        }
-
-        rhi_submit_cmd_buf(&cmd_buf);
-        rhi_free_cmd_buf(&cmd_buf);
-
-        rhi_free_image(&data->hdr_cubemap);
     }
 
     {
@@ -311,7 +259,7 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
         descriptor.shaders.ps = &fs;
         descriptor.depth_biased_enable = 0;
 
-        rhi_init_graphics_pipeline(&data->skybox_pipeline, &descriptor);
+        rhi_init_graphics_pipeline_async(&data->skybox_pipeline, &descriptor);
         
         rhi_free_shader(&vs);
         rhi_free_shader(&fs);
@@ -341,12 +289,19 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
         rhi_descriptor_set_write_image(&data->deferred_set, &data->prefilter, 7);
         rhi_descriptor_set_write_image(&data->deferred_set, &data->brdf, 8);
 
-        data->params_set_layout.descriptors[0] = DESCRIPTOR_BUFFER;
+        data->params_set_layout.descriptors[0] = DESCRIPTOR_DYNAMIC_BUFFER;
         data->params_set_layout.descriptor_count = 1;
         rhi_init_descriptor_set_layout(&data->params_set_layout);
 
         rhi_init_descriptor_set(&data->params_set, &data->params_set_layout);
-        rhi_descriptor_set_write_buffer(&data->params_set, &data->render_params_buffer, sizeof(data->parameters), 0);
+        rhi_descriptor_set_write_dynamic_buffer(&data->params_set, rhi_get_frame_buffer(), sizeof(data->parameters), 0);
+
+        data->draw_set_layout.descriptors[0] = DESCRIPTOR_DYNAMIC_BUFFER;
+        data->draw_set_layout.descriptor_count = 1;
+        rhi_init_descriptor_set_layout(&data->draw_set_layout);
+
+        rhi_init_descriptor_set(&data->draw_set, &data->draw_set_layout);
+        rhi_descriptor_set_write_dynamic_buffer(&data->draw_set, rhi_get_frame_buffer(), sizeof(PrimitiveConstants), 0);
     }
 
     {
@@ -372,21 +327,22 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
         descriptor.depth_op = VK_COMPARE_OP_LESS;
         descriptor.polygon_mode = VK_POLYGON_MODE_FILL;
         descriptor.primitive_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        descriptor.push_constant_size = sizeof(hmm_mat4);
+        descriptor.push_constant_size = 0;
         descriptor.set_layouts[0] = &execute->camera_descriptor_set_layout;
         descriptor.set_layouts[1] = rhi_get_image_heap_set_layout();
         descriptor.set_layouts[2] = rhi_get_sampler_heap_set_layout();
         descriptor.set_layouts[3] = mesh_loader_get_descriptor_set_layout();
         descriptor.set_layouts[4] = mesh_loader_get_geometry_descriptor_set_layout();
         descriptor.set_layouts[5] = &data->params_set_layout;
-        descriptor.set_layout_count = 6;
+        descriptor.set_layouts[6] = &data->draw_set_layout;
+        descriptor.set_layout_count = 7;
         descriptor.shaders.ts = &ts;
         descriptor.shaders.ms = &ms;
         descriptor.shaders.ps = &fs;
         descriptor.depth_biased_enable = 0;
         descriptor.depth_bounds_enable = 1;
 
-        rhi_init_graphics_pipeline(&data->gbuffer_pipeline, &descriptor);
+        rhi_init_graphics_pipeline_async(&data->gbuffer_pipeline, &descriptor);
 
         rhi_free_shader(&ts);
         rhi_free_shader(&ms);
@@ -421,11 +377,151 @@ void geometry_pass_init(RenderGraphNode* node, RenderGraphExecute* execute)
         descriptor.shaders.ps = &fs;
         descriptor.depth_biased_enable = 0;
 
-        rhi_init_graphics_pipeline(&data->deferred_pipeline, &descriptor);
+        rhi_init_graphics_pipeline_async(&data->deferred_pipeline, &descriptor);
 
         rhi_free_shader(&vs);
         rhi_free_shader(&fs);
     }
+
+    // Baked last so the graphics pipelines above compile while this runs, binding waits on each compute pipeline
+    {
+        RHI_CommandBuffer cmd_buf;
+        rhi_init_cmd_buf(&cmd_buf, COMMAND_BUFFER_COMPUTE);
+
+        // equi to cubemap compute
+        {
+            rhi_begin_cmd_buf(&cmd_buf);
+
+            rhi_cmd_img_transition_layout(&cmd_buf, &data->hdr_cubemap, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+            rhi_cmd_img_transition_layout(&cmd_buf, &data->cubemap, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+            rhi_descriptor_set_write_storage_image(&data->cubemap_set, &data->hdr_cubemap, &data->nearest_sampler, 0);
+            rhi_descriptor_set_write_storage_image(&data->cubemap_set, &data->cubemap, &data->cubemap_sampler, 1);
+
+            rhi_cmd_set_pipeline(&cmd_buf, &data->cubemap_pipeline);
+            rhi_cmd_set_descriptor_set(&cmd_buf, &data->cubemap_pipeline, &data->cubemap_set, 0);
+            rhi_cmd_dispatch(&cmd_buf, 1024 / 32, 1024 / 32, 6);
+        }
+
+        // irradiance
+        {
+            rhi_cmd_img_transition_layout(&cmd_buf, &data->cubemap, 0, 0, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0);
+            rhi_cmd_img_transition_layout(&cmd_buf, &data->irradiance, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+            rhi_descriptor_set_write_image_sampler(&data->irradiance_set, &data->cubemap, &data->cubemap_sampler, 0);
+            rhi_descriptor_set_write_storage_image(&data->irradiance_set, &data->irradiance, &data->cubemap_sampler, 1);
+
+            rhi_cmd_set_pipeline(&cmd_buf, &data->irradiance_pipeline);
+            rhi_cmd_set_descriptor_set(&cmd_buf, &data->irradiance_pipeline, &data->irradiance_set, 0);
+            rhi_cmd_dispatch(&cmd_buf, 128 / 32, 128 / 32, 6);
+        }
+
+        // prefilter
+        {
+            rhi_cmd_img_transition_layout(&cmd_buf, &data->prefilter, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+            rhi_descriptor_set_write_image_sampler(&data->prefilter_set, &data->cubemap, &data->cubemap_sampler, 0);
+            rhi_descriptor_set_write_storage_image(&data->prefilter_set, &data->prefilter, &data->cubemap_sampler, 1);
+
+            rhi_cmd_set_pipeline(&cmd_buf, &data->prefilter_pipeline);
+            rhi_cmd_set_descriptor_set(&cmd_buf, &data->prefilter_pipeline, &data->prefilter_set, 0);
+
+            for (u32 i = 0; i < 5; i++)
+	        {
+	        	u32 mip_width = (u32)(512.0f * pow(0.5f, i));
+	        	u32 mip_height = (u32)(512.0f * pow(0.5f, i));
+	        	f32 roughness = (f32)i / (f32)(5 - 1);
+
+	        	hmm_vec4 vec;
+                vec.X = roughness;
+
+	        	rhi_cmd_set_push_constants(&cmd_buf, &data->prefilter_pipeline, &vec, sizeof(hmm_vec4));
+	        	rhi_cmd_dispatch(&cmd_buf, mip_width / 32, mip_height / 32, 6);
+	        }
+        }
+
+        // brdf
+        {
+            rhi_cmd_img_transition_layout(&cmd_buf, &data->brdf, 0, 0, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+
+            rhi_descriptor_set_write_storage_image(&data->brdf_set, &data->brdf, &data->nearest_sampler, 0);
+
+            rhi_cmd_set_pipeline(&cmd_buf, &data->brdf_pipeline);
+            rhi_cmd_set_descriptor_set(&cmd_buf, &data->brdf_pipeline, &data->brdf_set, 0);
+            rhi_cmd_dispatch(&cmd_buf, 512 / 32, 512 / 32, 6);
+        }
+
+        rhi_submit_cmd_buf(&cmd_buf);
+        rhi_free_cmd_buf(&cmd_buf);
+
+        rhi_free_image(&data->hdr_cubemap);
+    }
+}
+
+// Screen pixels per world unit at the closest point of the bounds, 0 when the camera is inside them.
+// scale is the largest axis scale of the primitive's transform.
+f32 geometry_pass_pixels_per_unit(Primitive* primitive, RenderGraphExecute* execute, f32* scale)
+{
+    hmm_mat4 transform = primitive->constants.transform;
+    hmm_vec4 center = HMM_MultiplyMat4ByVec4(transform, HMM_Vec4(primitive->bounds.X, primitive->bounds.Y, primitive->bounds.Z, 1.0f));
+
+    *scale = 0.0f;
+    for (u32 c = 0; c < 3; c++)
+        *scale = max(*scale, HMM_LengthVec3(HMM_Vec3(transform.Elements[c][0], transform.Elements[c][1], transform.Elements[c][2])));
+
+    f32 distance = HMM_DistanceVec3(center.XYZ, execute->camera.pos) - primitive->bounds.W * *scale;
+    if (distance <= 0.0f)
+        return 0.0f;
+
+    return fabsf(execute->camera.projection.Elements[1][1]) * execute->height * 0.5f / distance;
+}
+
+// Same sphere/plane test as InsideFrustum in gbuffer.task
+b32 geometry_pass_primitive_visible(Primitive* primitive, RenderGraphExecute* execute, f32 scale)
+{
+    hmm_vec4 center = HMM_MultiplyMat4ByVec4(primitive->constants.transform, HMM_Vec4(primitive->bounds.X, primitive->bounds.Y, primitive->bounds.Z, 1.0f));
+    f32 radius = primitive->bounds.W * scale;
+
+    for (u32 i = 0; i < 6; i++)
+    {
+        hmm_vec4 plane = execute->camera.frustrum_planes[i];
+        if (HMM_DotVec3(plane.XYZ, center.XYZ) - plane.W <= -radius)
+            return 0;
+    }
+    return 1;
+}
+
+u32 geometry_pass_select_lod(Primitive* primitive, f32 pixels_per_unit, f32 scale)
+{
+    // Inside the bounds everything is full detail
+    if (pixels_per_unit <= 0.0f)
+        return 0;
+
+    for (u32 lod = primitive->lod_count; lod-- > 1;)
+    {
+        if (primitive->lods[lod].error * scale * pixels_per_unit <= GEOMETRY_PASS_LOD_PIXEL_ERROR)
+            return lod;
+    }
+
+    return 0;
+}
+
+// Columns a, b, c of the upper 3x3: its inverse transpose is (b x c, c x a, a x b) / det
+void geometry_pass_draw_constants(PrimitiveConstants* constants)
+{
+    hmm_mat4* transform = &constants->transform;
+    hmm_vec3 a = HMM_Vec3(transform->Elements[0][0], transform->Elements[0][1], transform->Elements[0][2]);
+    hmm_vec3 b = HMM_Vec3(transform->Elements[1][0], transform->Elements[1][1], transform->Elements[1][2]);
+    hmm_vec3 c = HMM_Vec3(transform->Elements[2][0], transform->Elements[2][1], transform->Elements[2][2]);
+
+    hmm_vec3 bc = HMM_Cross(b, c);
+    f32 det = HMM_DotVec3(a, bc);
+    f32 inv_det = det != 0.0f ? 1.0f / det : 0.0f;
+
+    constants->normal_matrix[0] = HMM_Vec4v(HMM_MultiplyVec3f(bc, inv_det), 0.0f);
+    constants->normal_matrix[1] = HMM_Vec4v(HMM_MultiplyVec3f(HMM_Cross(c, a), inv_det), 0.0f);
+    constants->normal_matrix[2] = HMM_Vec4v(HMM_MultiplyVec3f(HMM_Cross(a, b), inv_det), 0.0f);
+    constants->mean_scale = (HMM_LengthVec3(a) + HMM_LengthVec3(b) + HMM_LengthVec3(c)) / 3.0f;
 }
 
 void geometry_pass_execute_gbuffer(RHI_CommandBuffer* cmd_buf, RenderGraphNode* node, RenderGraphExecute* execute, geometry_pass* data)
@@ -458,21 +554,41 @@ void geometry_pass_execute_gbuffer(RHI_CommandBuffer* cmd_buf, RenderGraphNode*
 
     rhi_cmd_set_viewport(cmd_buf, execute->width, execute->height);
     rhi_cmd_set_pipeline(cmd_buf, &data->gbuffer_pipeline);
-    rhi_cmd_set_descriptor_set(cmd_buf, &data->gbuffer_pipeline, &execute->camera_descriptor_set, 0);
+    rhi_cmd_set_descriptor_set_offset(cmd_buf, &data->gbuffer_pipeline, &execute->camera_descriptor_set, 0, execute->camera_offset);
     rhi_cmd_set_descriptor_heap(cmd_buf, &data->gbuffer_pipeline, &execute->image_heap, 1);
     rhi_cmd_set_descriptor_heap(cmd_buf, &data->gbuffer_pipeline, &execute->sampler_heap, 2);
-    rhi_cmd_set_descriptor_set(cmd_buf, &data->gbuffer_pipeline, &data->params_set, 5);
+    rhi_cmd_set_descriptor_set_offset(cmd_buf, &data->gbuffer_pipeline, &data->params_set, 5, data->params_offset);
     rhi_cmd_set_depth_bounds(cmd_buf, 0.0f, 0.999f);
 
+    f32 lod_scale = fabsf(execute->camera.projection.Elements[1][1]) * execute->height * 0.5f / GEOMETRY_PASS_LOD_PIXEL_ERROR;
+
     for (i32 i = 0; i < execute->model_count; i++)
     {
-        Mesh* model = &execute->models[i];
+        Mesh* model = execute->models[i];
         for (u32 i = 0; i < model->primitive_count; i++)
 	    {
-	    	rhi_cmd_set_push_constants(cmd_buf, &data->gbuffer_pipeline, &model->primitives[i].transform, sizeof(hmm_mat4));
-            rhi_cmd_set_descriptor_set(cmd_buf, &data->gbuffer_pipeline, &model->materials[model->primitives[i].material_index].material_set, 3);
-            rhi_cmd_set_descriptor_set(cmd_buf, &data->gbuffer_pipeline, &model->primitives[i].geometry_descriptor_set, 4);
-	    	rhi_cmd_draw_meshlets(cmd_buf, model->primitives[i].meshlet_count);
+            Primitive* primitive = &model->primitives[i];
+            GLTFMaterial* material = &model->materials[primitive->material_index];
+
+            f32 scale;
+            f32 pixels_per_unit = geometry_pass_pixels_per_unit(primitive, execute, &scale);
+            PrimitiveLod* lod = &primitive->lods[geometry_pass_select_lod(primitive, pixels_per_unit, scale)];
+
+            // Screen diameter of the bounds decides which texture levels stream in, from inside them all of them.
+            // Culled primitives cover nothing and don't bid.
+            if (geometry_pass_primitive_visible(primitive, execute, scale))
+                mesh_request_material_textures(material, pixels_per_unit > 0.0f ? primitive->bounds.W * 2.0f * scale * pixels_per_unit : FLT_MAX);
+
+            u32 draw_offset;
+            PrimitiveConstants* constants = rhi_frame_alloc(sizeof(PrimitiveConstants), &draw_offset);
+            *constants = primitive->constants;
+            constants->lod_scale = lod_scale;
+            geometry_pass_draw_constants(constants);
+
+	    	rhi_cmd_set_descriptor_set_offset(cmd_buf, &data->gbuffer_pipeline, &data->draw_set, 6, draw_offset);
+            rhi_cmd_set_descriptor_set(cmd_buf, &data->gbuffer_pipeline, &material->material_set, 3);
+            rhi_cmd_set_descriptor_set(cmd_buf, &data->gbuffer_pipeline, &lod->geometry_descriptor_set, 4);
+	    	rhi_cmd_draw_meshlets(cmd_buf, (lod->meshlet_count + MESHLET_TASK_GROUP_SIZE - 1) / MESHLET_TASK_GROUP_SIZE);
 	    }
     }
 
@@ -521,8 +637,8 @@ void geometry_pass_execute_deferred(RHI_CommandBuffer* cmd_buf, RenderGraphNode*
     rhi_cmd_set_pipeline(cmd_buf, &data->deferred_pipeline);
     rhi_cmd_set_descriptor_set(cmd_buf, &data->deferred_pipeline, &data->deferred_set, 0);
     rhi_cmd_set_descriptor_heap(cmd_buf, &data->deferred_pipeline, &execute->sampler_heap, 1);
-    rhi_cmd_set_descriptor_set(cmd_buf, &data->deferred_pipeline, &execute->light_descriptor_set, 2);
-    rhi_cmd_set_descriptor_set(cmd_buf, &data->deferred_pipeline, &data->params_set, 3);
+    rhi_cmd_set_descriptor_set_offset(cmd_buf, &data->deferred_pipeline, &execute->light_descriptor_set, 2, execute->light_offset);
+    rhi_cmd_set_descriptor_set_offset(cmd_buf, &data->deferred_pipeline, &data->params_set, 3, data->params_offset);
     rhi_cmd_set_push_constants(cmd_buf, &data->deferred_pipeline, &temp, sizeof(hmm_vec4));
     rhi_cmd_set_vertex_buffer(cmd_buf, &data->screen_vertex_buffer);
     rhi_cmd_draw(cmd_buf, 4);
@@ -599,7 +715,7 @@ void geometry_pass_update(RenderGraphNode* node, RenderGraphExecute* execute)
         data->parameters.shade_meshlets = 0;
 
     RHI_CommandBuffer* cmd_buf = rhi_get_swapchain_cmd_buf();
-    rhi_upload_buffer(&data->render_params_buffer, &data->parameters, sizeof(data->parameters));
+    data->params_offset = rhi_frame_upload(&data->parameters, sizeof(data->parameters));
 
     geometry_pass_execute_gbuffer(cmd_buf, node, execute, data);
     geometry_pass_execute_deferred(cmd_buf, node, execute, data);
@@ -662,12 +778,13 @@ void geometry_pass_free(RenderGraphNode* node, RenderGraphExecute* execute)
     rhi_free_sampler(&data->cubemap_sampler);
     rhi_free_sampler(&data->linear_sampler);
     rhi_free_sampler(&data->nearest_sampler);
+    rhi_free_descriptor_set(&data->draw_set);
+    rhi_free_descriptor_set_layout(&data->draw_set_layout);
     rhi_free_descriptor_set(&data->params_set);
     rhi_free_descriptor_set_layout(&data->params_set_layout);
     rhi_free_descriptor_set(&data->deferred_set);
     rhi_free_descriptor_set_layout(&data->deferred_set_layout);
     rhi_free_buffer(&data->screen_vertex_buffer);
-    rhi_free_buffer(&data->render_params_buffer);
 
     free(data);
 }
@@ -1,6 +1,7 @@
 #include "render_graph.h"
 
 #include <assert.h>
+#include <string.h>
 
 void recursively_add_nodes(RenderGraphNode* node, RenderGraph* graph)
 {
@@ -26,28 +27,25 @@ void init_render_graph(RenderGraph* graph, RenderGraphExecute* execute)
     memset(&execute->light_info, 0, sizeof(execute->light_info));
     graph->node_count = 0;
 
-    rhi_init_descriptor_heap(&execute->image_heap, DESCRIPTOR_HEAP_IMAGE, 512);
-	rhi_init_descriptor_heap(&execute->sampler_heap, DESCRIPTOR_HEAP_SAMPLER, 512);
+    rhi_init_descriptor_heap(&execute->image_heap, DESCRIPTOR_HEAP_IMAGE, min(RENDER_GRAPH_IMAGE_HEAP_SIZE, rhi_get_descriptor_heap_capacity(DESCRIPTOR_HEAP_IMAGE)));
+	rhi_init_descriptor_heap(&execute->sampler_heap, DESCRIPTOR_HEAP_SAMPLER, min(RENDER_GRAPH_SAMPLER_HEAP_SIZE, rhi_get_descriptor_heap_capacity(DESCRIPTOR_HEAP_SAMPLER)));
 	mesh_loader_set_texture_heap(&execute->image_heap);
     mesh_loader_set_sampler_heap(&execute->sampler_heap);
 	mesh_loader_init(4);
 
     execute->camera_descriptor_set_layout.descriptor_count = 1;
-    execute->camera_descriptor_set_layout.descriptors[0] = DESCRIPTOR_BUFFER;
+    execute->camera_descriptor_set_layout.descriptors[0] = DESCRIPTOR_DYNAMIC_BUFFER;
     rhi_init_descriptor_set_layout(&execute->camera_descriptor_set_layout);
 
     execute->light_descriptor_set_layout.descriptor_count = 1;
-    execute->light_descriptor_set_layout.descriptors[0] = DESCRIPTOR_BUFFER;
+    execute->light_descriptor_set_layout.descriptors[0] = DESCRIPTOR_DYNAMIC_BUFFER;
     rhi_init_descriptor_set_layout(&execute->light_descriptor_set_layout);
 
-    rhi_allocate_buffer(&execute->camera_buffer, sizeof(execute->camera), BUFFER_UNIFORM);
-    rhi_allocate_buffer(&execute->light_buffer, sizeof(execute->light_info), BUFFER_UNIFORM);
-    
     rhi_init_descriptor_set(&execute->camera_descriptor_set, &execute->camera_descriptor_set_layout);
-    rhi_descriptor_set_write_buffer(&execute->camera_descriptor_set, &execute->camera_buffer, sizeof(execute->camera), 0);
+    rhi_descriptor_set_write_dynamic_buffer(&execute->camera_descriptor_set, rhi_get_frame_buffer(), sizeof(execute->camera), 0);
 
     rhi_init_descriptor_set(&execute->light_descriptor_set, &execute->light_descriptor_set_layout);
-    rhi_descriptor_set_write_buffer(&execute->light_descriptor_set, &execute->light_buffer, sizeof(execute->light_info), 0);
+    rhi_descriptor_set_write_dynamic_buffer(&execute->light_descriptor_set, rhi_get_frame_buffer(), sizeof(execute->light_info), 0);
 }
 
 void connect_render_graph_nodes(RenderGraph* graph, u32 src_id, u32 dst_id, RenderGraphNode* src_node, RenderGraphNode* dst_node)
@@ -107,11 +105,9 @@ void free_render_graph(RenderGraph* graph, RenderGraphExecute* execute)
     for (u32 i = 0; i < graph->node_count; i++)
         graph->nodes[i]->free(graph->nodes[i], execute);
 
-    rhi_free_buffer(&execute->light_buffer);
     rhi_free_descriptor_set(&execute->light_descriptor_set);
     rhi_free_descriptor_set_layout(&execute->light_descriptor_set_layout);
 
-    rhi_free_buffer(&execute->camera_buffer);
     rhi_free_descriptor_set(&execute->camera_descriptor_set);
     rhi_free_descriptor_set_layout(&execute->camera_descriptor_set_layout);
 }
@@ -124,8 +120,8 @@ void resize_render_graph(RenderGraph* graph, RenderGraphExecute* execute)
 
 void update_render_graph(RenderGraph* graph, RenderGraphExecute* execute)
 {
-    rhi_upload_buffer(&execute->camera_buffer, &execute->camera, sizeof(execute->camera));
-    rhi_upload_buffer(&execute->light_buffer, &execute->light_info, sizeof(execute->light_info));
+    execute->camera_offset = rhi_frame_upload(&execute->camera, sizeof(execute->camera));
+    execute->light_offset = rhi_frame_upload(&execute->light_info, sizeof(execute->light_info));
 
     for (u32 i = 0; i < graph->node_count; i++)
         graph->nodes[i]->update(graph->nodes[i], execute);
@@ -11,6 +11,8 @@
 #define GET_NODE_PORT_INDEX(id) (((1u << 31u) - 1u) & id)
 #define RENDER_GRAPH_MAX_MODELS 512
 #define RENDER_GRAPH_MAX_LIGHTS 512
+#define RENDER_GRAPH_IMAGE_HEAP_SIZE 16384
+#define RENDER_GRAPH_SAMPLER_HEAP_SIZE 1024
 
 typedef struct RenderGraphExecute RenderGraphExecute;
 typedef struct RenderGraphNode RenderGraphNode;
@@ -28,7 +30,8 @@ struct RenderGraphPointLight
 
 struct RenderGraphExecute
 {
-    Mesh models[RENDER_GRAPH_MAX_MODELS];
+    // Resident meshes only, appended at frame boundaries as their loads finish
+    Mesh* models[RENDER_GRAPH_MAX_MODELS];
     i32 model_count;
 
     u32 width;
@@ -37,13 +40,14 @@ struct RenderGraphExecute
     RHI_DescriptorHeap image_heap;
     RHI_DescriptorHeap sampler_heap;
 
-    RHI_Buffer camera_buffer;
+    // Both point into the frame ring, bind them with this frame's offsets
     RHI_DescriptorSet camera_descriptor_set;
     RHI_DescriptorSetLayout camera_descriptor_set_layout;
+    u32 camera_offset;
 
-    RHI_Buffer light_buffer;
     RHI_DescriptorSet light_descriptor_set;
     RHI_DescriptorSetLayout light_descriptor_set_layout;
+    u32 light_offset;
     
     struct {
         RenderGraphPointLight lights[RENDER_GRAPH_MAX_LIGHTS];
@@ -9,6 +9,22 @@ TODO: Global Illumination
 */
 
 #define FRAMES_IN_FLIGHT 2
+// Persistently mapped staging memory shared by every upload, bigger uploads get a one-off buffer
+#define RHI_STAGING_RING_SIZE (64ull * 1024ull * 1024ull)
+#define RHI_UPLOAD_MAX_BATCHES 8
+// Uniform data written every frame (camera, lights, per-draw constants), one region per frame in flight. Sized
+// for the most draws a frame can record, each padded to the largest uniform offset alignment Vulkan allows, plus
+// 1MB for the per-frame blocks. Passes check their worst case against RHI_FRAME_RING_MAX_DRAWS.
+#define RHI_FRAME_RING_MAX_DRAWS (512 * 128)
+#define RHI_FRAME_RING_DRAW_SIZE 256
+#define RHI_FRAME_RING_SIZE (RHI_FRAME_RING_MAX_DRAWS * (u64)RHI_FRAME_RING_DRAW_SIZE + 1024ull * 1024ull)
+// Driver pipeline cache, read at rhi_init and written back at rhi_shutdown
+#define RHI_PIPELINE_CACHE_PATH "pipeline.cache"
+#define RHI_MAX_SHADER_MODULES 64
+#define RHI_MAX_SAMPLERS 256
+#define RHI_MAX_MIP_LEVELS 16
+// Upper bound of a bindless heap, further clamped to the device limits at init
+#define RHI_DESCRIPTOR_HEAP_MAX_SIZE 65536
 #define COMMAND_BUFFER_GRAPHICS 0
 #define COMMAND_BUFFER_COMPUTE 1
 #define COMMAND_BUFFER_UPLOAD 2
@@ -17,6 +33,9 @@ TODO: Global Illumination
 #define BUFFER_VERTEX VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
 #define BUFFER_INDEX VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
 #define BUFFER_UNIFORM VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+// Or'd into the usage of buffers the CPU rewrites, they stay host visible and persistently mapped. Everything else
+// is device local and filled through the staging ring.
+#define BUFFER_DYNAMIC 0x80000000u
 #define IMAGE_RTV VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT
 #define IMAGE_GBUFFER VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT
 #define IMAGE_DSV VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT
@@ -27,6 +46,7 @@ TODO: Global Illumination
 #define DESCRIPTOR_SAMPLED_IMAGE VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
 #define DESCRIPTOR_SAMPLER VK_DESCRIPTOR_TYPE_SAMPLER
 #define DESCRIPTOR_BUFFER VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER
+#define DESCRIPTOR_DYNAMIC_BUFFER VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC
 #define DESCRIPTOR_STORAGE_IMAGE VK_DESCRIPTOR_TYPE_STORAGE_IMAGE
 
 // It's not like I'm going to implement another graphics API for this project, so we'll let the vulkan stuff public for now kekw
@@ -44,6 +64,10 @@ struct RHI_RawImage
     u64 data_size;
 
     VkFormat format;
+    // Levels packed back to back in data, largest first, every one of them is uploaded. data may be NULL when
+    // the raw image only describes a layout (rhi_stage_image).
+    u32 mip_levels;
+    u64 mip_offsets[RHI_MAX_MIP_LEVELS];
 };
 
 typedef struct RHI_Image RHI_Image;
@@ -62,6 +86,16 @@ struct RHI_Image
     u32 mip_levels;
 };
 
+// Mapped upload memory of its own, any thread can fill it
+typedef struct RHI_Staging RHI_Staging;
+struct RHI_Staging
+{
+    VkBuffer buffer;
+    VmaAllocation allocation;
+    void* data;
+    u64 size;
+};
+
 typedef struct RHI_Sampler RHI_Sampler;
 struct RHI_Sampler
 {
@@ -83,6 +117,7 @@ struct RHI_ShaderModule
     VkShaderModule shader_module;
     u32* byte_code;
     u32 byte_code_size;
+    const char* path;
 };
 
 typedef struct RHI_DescriptorSetLayout RHI_DescriptorSetLayout;
@@ -142,6 +177,9 @@ struct RHI_Pipeline
     VkPipelineBindPoint bind_point;
     VkPipeline pipeline;
     VkPipelineLayout pipeline_layout;
+
+    // Set while an async build is in flight
+    void* pending;
 };  
 
 typedef struct RHI_Buffer RHI_Buffer;
@@ -151,16 +189,50 @@ struct RHI_Buffer
     VmaAllocation allocation;
     VkBufferUsageFlagBits usage;
     VmaMemoryUsage memory_usage;
+    u64 size;
+    // Only set for BUFFER_DYNAMIC
+    void* mapped;
 };  
 
+// A heap slot switching to another image while frames in flight may still sample the old one
+typedef struct RHI_DescriptorRewrite RHI_DescriptorRewrite;
+struct RHI_DescriptorRewrite
+{
+    u32 binding;
+    VkImageView image_view;
+    VkImageLayout image_layout;
+    // Bit per frame copy of the heap that still shows the old image
+    u32 pending_sets;
+    // Destroyed once the frames before retire_frame, the last ones that could sample it, have retired
+    RHI_Image replaced;
+    u64 retire_frame;
+};
+
 typedef struct RHI_DescriptorHeap RHI_DescriptorHeap;
 struct RHI_DescriptorHeap
 {
     u32 type;
     u32 size;
     u32 used;
-    VkDescriptorSet set;
-    b32* heap_handle;
+    // One copy per frame in flight, so a slot can be rewritten in the copy whose frame has retired while the
+    // others are still in use. Fresh slots are written to every copy at once.
+    VkDescriptorSet sets[FRAMES_IN_FLIGHT];
+
+    // Stack of free indices
+    u32* free_list;
+    u32 free_count;
+
+    // FIFO of freed indices and the frame they were freed in, they go back on the free list once that frame has
+    // retired on the GPU
+    u32* retired;
+    u64* retired_frames;
+    u32 retired_first;
+    u32 retired_count;
+
+    // Applied to each copy the next time it's bound, in order
+    RHI_DescriptorRewrite* rewrites;
+    u32 rewrite_count;
+    u32 rewrite_capacity;
 };
 
 typedef struct RHI_RenderBegin RHI_RenderBegin;
@@ -202,25 +274,44 @@ void rhi_descriptor_set_write_sampler(RHI_DescriptorSet* set, RHI_Sampler* sampl
 void rhi_descriptor_set_write_image(RHI_DescriptorSet* set, RHI_Image* image, i32 binding);
 void rhi_descriptor_set_write_image_sampler(RHI_DescriptorSet* set, RHI_Image* image, RHI_Sampler* sampler, i32 binding);
 void rhi_descriptor_set_write_buffer(RHI_DescriptorSet* set, RHI_Buffer* buffer, i32 size, i32 binding);
+// For DESCRIPTOR_DYNAMIC_BUFFER bindings, the offset comes from rhi_cmd_set_descriptor_set_offset
+void rhi_descriptor_set_write_dynamic_buffer(RHI_DescriptorSet* set, RHI_Buffer* buffer, i32 size, i32 binding);
 void rhi_descriptor_set_write_storage_image(RHI_DescriptorSet* set, RHI_Image* image, RHI_Sampler* sampler, i32 binding);
 void rhi_descriptor_set_write_storage_buffer(RHI_DescriptorSet* set, RHI_Buffer* buffer, i32 size, i32 binding);
 
 // Samplers
+// Shared by state (filter, address mode, mips), rhi_free_sampler drops a reference
 void rhi_init_sampler(RHI_Sampler* sampler, u32 mips);
 void rhi_free_sampler(RHI_Sampler* sampler);
+// One heap slot per shared sampler, written on first request and released with the sampler's last reference
+i32 rhi_get_sampler_heap_index(RHI_DescriptorHeap* heap, RHI_Sampler* sampler);
 
 // Pipeline/Shaders
+// Modules are shared by path, the byte code is read and the module created only on the first load
 void rhi_load_shader(RHI_ShaderModule* shader, const char* path);
 void rhi_free_shader(RHI_ShaderModule* shader);
 void rhi_init_graphics_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor);
 void rhi_init_compute_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor);
+// Compiled on a worker. The descriptor and shaders are copied, so the caller can free its shaders right away, but
+// the set layouts must outlive the build. rhi_cmd_set_pipeline and rhi_free_pipeline wait for it, or use rhi_wait_pipeline.
+void rhi_init_graphics_pipeline_async(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor);
+void rhi_init_compute_pipeline_async(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor);
+void rhi_wait_pipeline(RHI_Pipeline* pipeline);
 void rhi_free_pipeline(RHI_Pipeline* pipeline);
 
 // Buffer
 void rhi_allocate_buffer(RHI_Buffer* buffer, u64 size, u32 buffer_usage);
 void rhi_free_buffer(RHI_Buffer* buffer);
+// Dynamic buffers are written in place, static ones are staged like images and meant to be written once
 void rhi_upload_buffer(RHI_Buffer* buffer, void* data, u64 size);
 
+// Frame ring: linear allocator on a persistently mapped uniform buffer, reset in rhi_begin once the GPU is done
+// with the frame that last used the same region. Only valid between rhi_begin and rhi_end.
+RHI_Buffer* rhi_get_frame_buffer();
+void* rhi_frame_alloc(u64 size, u32* offset);
+// Copies data into the ring and returns its dynamic offset
+u32 rhi_frame_upload(const void* data, u64 size);
+
 // Raw Image
 void rhi_load_raw_image(RHI_RawImage* image, const char* path);
 void rhi_load_raw_hdr_image(RHI_RawImage* image, const char* path);
@@ -229,15 +320,40 @@ void rhi_free_raw_image(RHI_RawImage* image);
 // Image
 void rhi_allocate_image(RHI_Image* image, i32 width, i32 height, VkFormat format, u32 usage, u32 target_layout);
 void rhi_allocate_cubemap(RHI_Image* image, i32 width, i32 height, VkFormat format, u32 usage, u32 target_layout);
-void rhi_upload_image(RHI_Image* image, RHI_RawImage* raw_image, b32 gen_mips);
+// Staged through the ring and recorded into the open upload batch, nothing waits on the GPU. Batches go out at
+// rhi_end_upload_batch, rhi_flush_uploads, before the frame submit in rhi_end, or when the ring fills up.
+void rhi_upload_image(RHI_Image* image, RHI_RawImage* raw_image);
+// Same upload without the copy: returns the mapped staging memory for raw_image's levels (its data is unused) and
+// the caller writes them there, packed as described, before its next upload or flush
+void* rhi_stage_image(RHI_Image* image, RHI_RawImage* raw_image);
+void rhi_allocate_staging(RHI_Staging* staging, u64 size);
+void rhi_free_staging(RHI_Staging* staging);
+// Creates image with raw_image's layout: levels [0, staged_levels) come from staging at their mip offsets, the
+// rest are copied on the GPU from the smallest levels of source, which must stay alive until this frame retires.
+// The upload takes ownership of staging, which may be NULL when every level is copied.
+void rhi_upload_image_levels(RHI_Image* image, RHI_RawImage* raw_image, RHI_Staging* staging, u32 staged_levels, RHI_Image* source);
+// Uploads between these calls share one submit unless the staging ring fills up first
+void rhi_begin_upload_batch();
+void rhi_end_upload_batch();
+void rhi_flush_uploads();
+// Timeline value of the batch the next upload lands in, rhi_upload_done turns true once it has retired
+u64 rhi_upload_ticket();
+b32 rhi_upload_done(u64 ticket);
 void rhi_free_image(RHI_Image* image);
 void rhi_resize_image(RHI_Image* image, i32 width, i32 height);
 
 // Descriptor heap
+// size can go up to rhi_get_descriptor_heap_capacity(type)
 void rhi_init_descriptor_heap(RHI_DescriptorHeap* heap, u32 type, u32 size);
+u32 rhi_get_descriptor_heap_capacity(u32 type);
+// O(1), returns -1 when the heap is full
 i32 rhi_find_available_descriptor(RHI_DescriptorHeap* heap);
 void rhi_push_descriptor_heap_image(RHI_DescriptorHeap* heap, RHI_Image* image, i32 binding);
 void rhi_push_descriptor_heap_sampler(RHI_DescriptorHeap* heap, RHI_Sampler* sampler, i32 binding);
+// Points a slot that frames in flight may be sampling at another image, the index stays the same. Takes
+// ownership of replaced (the slot's previous image) and destroys it once no frame can read it anymore.
+void rhi_replace_descriptor_heap_image(RHI_DescriptorHeap* heap, RHI_Image* image, i32 binding, RHI_Image* replaced);
+// The index is only reused once every frame that may still read it has retired
 void rhi_free_descriptor(RHI_DescriptorHeap* heap, u32 descriptor);
 void rhi_free_descriptor_heap(RHI_DescriptorHeap* heap);
 
@@ -255,6 +371,8 @@ void rhi_cmd_set_vertex_buffer(RHI_CommandBuffer* buf, RHI_Buffer* buffer);
 void rhi_cmd_set_index_buffer(RHI_CommandBuffer* buf, RHI_Buffer* buffer);
 void rhi_cmd_set_descriptor_heap(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, RHI_DescriptorHeap* heap, i32 binding);
 void rhi_cmd_set_descriptor_set(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, RHI_DescriptorSet* set, i32 binding);
+// For sets holding a single DESCRIPTOR_DYNAMIC_BUFFER
+void rhi_cmd_set_descriptor_set_offset(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, RHI_DescriptorSet* set, i32 binding, u32 offset);
 void rhi_cmd_set_push_constants(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, void* data, u32 size);
 void rhi_cmd_set_depth_bounds(RHI_CommandBuffer* buf, f32 min, f32 max);
 void rhi_cmd_draw(RHI_CommandBuffer* buf, u32 count);
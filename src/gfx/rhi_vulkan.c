@@ -1,6 +1,7 @@
 #include "rhi.h"
 
 #include <core/platform_layer.h>
+#include <core/job_system.h>
 #include "vk_utils.h"
 
 #include <spirv_reflect.h>
@@ -12,10 +13,79 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
+#include <limits.h>
 
 #define vk_check(result) assert(result == VK_SUCCESS)
 #define ARRAY_SIZE(array) sizeof(array) / sizeof(array[0])
 
+// One submit pair of the upload engine: copies on the transfer queue, then ownership acquire, mips and final
+// layouts on the graphics queue
+typedef struct vk_upload_batch vk_upload_batch;
+struct vk_upload_batch
+{
+    VkCommandBuffer copy;
+    VkCommandBuffer finish;
+    u32 upload_count;
+
+    // finish_semaphore reaches value once the batch has retired, its ring space ends at ring_end
+    u64 value;
+    u64 ring_end;
+
+    // Uploads bigger than the whole ring and RHI_Staging handed over get their own buffer, destroyed on retire
+    VkBuffer* staging_buffers;
+    VmaAllocation* staging_allocations;
+    u32 staging_count;
+    u32 staging_capacity;
+};
+
+typedef struct vk_shader_entry vk_shader_entry;
+struct vk_shader_entry
+{
+    char path[256];
+    RHI_ShaderModule module;
+    u32 refs;
+};
+
+typedef struct vk_sampler_entry vk_sampler_entry;
+struct vk_sampler_entry
+{
+    VkFilter filter;
+    VkSamplerAddressMode address_mode;
+    u32 mips;
+    VkSampler sampler;
+    u32 refs;
+
+    RHI_DescriptorHeap* heap;
+    i32 heap_index;
+};
+
+// Owns copies of everything the build reads, set layouts aside
+typedef struct vk_pipeline_job vk_pipeline_job;
+struct vk_pipeline_job
+{
+    RHI_Pipeline* pipeline;
+    RHI_PipelineDescriptor descriptor;
+    RHI_ShaderModule shaders[5];
+    JobCounter counter;
+    f32 time;
+};
+
+// Our header in front of the driver's blob, the driver validates its own on top of it
+#define VK_PIPELINE_CACHE_MAGIC 0x43504c41 // ALPC
+#define VK_PIPELINE_CACHE_VERSION 1
+
+typedef struct vk_pipeline_cache_header vk_pipeline_cache_header;
+struct vk_pipeline_cache_header
+{
+    u32 magic;
+    u32 version;
+    u8 driver_uuid[VK_UUID_SIZE];
+    u8 device_uuid[VK_UUID_SIZE];
+    u32 driver_version;
+    u32 pad;
+    u64 data_size;
+};
+
 typedef struct vk_state vk_state;
 struct vk_state
 {
@@ -30,13 +100,17 @@ struct vk_state
     VkPhysicalDevice physical_device;
     u32 graphics_family;
     u32 compute_family;
+    u32 transfer_family;
     VkPhysicalDeviceProperties2 physical_device_properties_2;
     VkPhysicalDeviceFeatures2 physical_device_features;
     VkPhysicalDeviceMeshShaderPropertiesNV mesh_shader_properties;
+    VkPhysicalDeviceIDProperties id_properties;
+    VkPhysicalDeviceDescriptorIndexingProperties indexing_properties;
 
     VkDevice device;
     VkQueue graphics_queue;
     VkQueue compute_queue;
+    VkQueue transfer_queue;
     char* device_extensions[64];
     i32 device_extension_count;
     VkCommandPool graphics_pool;
@@ -60,11 +134,59 @@ struct vk_state
 
     VmaAllocator allocator;
     VkDescriptorPool descriptor_pool;
+    // Heap sets only, they need an update after bind pool
+    VkDescriptorPool heap_pool;
     VkDescriptorSetLayout image_heap_layout;
     VkDescriptorSetLayout sampler_heap_layout;
 
     RHI_DescriptorSetLayout rhi_image_heap;
     RHI_DescriptorSetLayout rhi_sampler_heap;
+
+    // Descriptors per heap type, clamped to the device limits
+    u32 heap_capacity[2];
+
+    // Frame numbers: frame_number is the frame being recorded, completed_frame the newest one whose fence was waited on
+    u64 frame_number;
+    u64 completed_frame;
+    u64 fence_frames[FRAMES_IN_FLIGHT];
+
+    VkPipelineCache pipeline_cache;
+    b32 pipeline_cache_warm;
+    f32 pipeline_time;
+    u32 pipeline_count;
+
+    vk_shader_entry shaders[RHI_MAX_SHADER_MODULES];
+    vk_sampler_entry samplers[RHI_MAX_SAMPLERS];
+
+    // Upload engine: a persistently mapped staging ring and batches in flight, oldest first. Ring positions are
+    // monotonic byte counters, the buffer offset is the counter modulo RHI_STAGING_RING_SIZE.
+    struct {
+        VkCommandPool transfer_pool;
+        VkCommandPool graphics_pool;
+        VkSemaphore copy_semaphore;
+        VkSemaphore finish_semaphore;
+        u64 submitted_value;
+
+        VkBuffer ring;
+        VmaAllocation ring_allocation;
+        u8* ring_data;
+        u64 ring_head;
+        u64 ring_tail;
+        u64 alignment;
+
+        vk_upload_batch batches[RHI_UPLOAD_MAX_BATCHES];
+        u32 first_batch;
+        u32 batch_count;
+        b32 recording;
+        b32 open;
+    } upload;
+
+    // Frame ring, region image_index * RHI_FRAME_RING_SIZE belongs to the frame being recorded
+    struct {
+        RHI_Buffer buffer;
+        u64 head;
+        u64 alignment;
+    } frame;
 };
 
 vk_state state;
@@ -137,9 +259,15 @@ void rhi_make_instance()
                     state.extensions[state.extension_count++] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
                 }
 
+#if defined(VK_USE_PLATFORM_WIN32_KHR)
                 if (!strcmp(VK_KHR_WIN32_SURFACE_EXTENSION_NAME, instance_extensions[i].extensionName)) {
                     state.extensions[state.extension_count++] = VK_KHR_WIN32_SURFACE_EXTENSION_NAME;
                 }
+#endif
+
+                if (platform.headless && !strcmp(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME, instance_extensions[i].extensionName)) {
+                    state.extensions[state.extension_count++] = VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME;
+                }
 
                 assert(state.extension_count < 64);
             }
@@ -188,8 +316,12 @@ void rhi_make_physical_device()
 
     state.physical_device_properties_2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
     state.mesh_shader_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_PROPERTIES_NV;
+    state.id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    state.indexing_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
 
     state.physical_device_properties_2.pNext = &state.mesh_shader_properties;
+    state.mesh_shader_properties.pNext = &state.id_properties;
+    state.id_properties.pNext = &state.indexing_properties;
     vkGetPhysicalDeviceProperties2(state.physical_device, &state.physical_device_properties_2);
 
     state.physical_device_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
@@ -200,6 +332,7 @@ void rhi_make_physical_device()
     vkGetPhysicalDeviceQueueFamilyProperties(state.physical_device, &queue_family_count, NULL);
 
     VkQueueFamilyProperties* queue_families = malloc(sizeof(VkQueueFamilyProperties) * queue_family_count);
+    u32 transfer_family = UINT32_MAX;
     if (queue_families)
     {
         vkGetPhysicalDeviceQueueFamilyProperties(state.physical_device, &queue_family_count, queue_families);
@@ -215,8 +348,16 @@ void rhi_make_physical_device()
             {
                 state.compute_family = i;
             }
+
+            // A family that can only copy is the dedicated DMA engine
+            if ((queue_families[i].queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queue_families[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+            {
+                transfer_family = i;
+            }
         }
 
+        state.transfer_family = transfer_family != UINT32_MAX ? transfer_family : state.graphics_family;
+
         free(queue_families);
     }
 }
@@ -241,11 +382,15 @@ void rhi_make_device()
     compute_queue_create_info.queueCount = 1;
     compute_queue_create_info.pQueuePriorities = &queuePriority;
 
+    VkDeviceQueueCreateInfo transfer_queue_create_info = graphics_queue_create_info;
+    transfer_queue_create_info.queueFamilyIndex = state.transfer_family;
+
     VkPhysicalDeviceFeatures features = {0};
     features.samplerAnisotropy = 1;
     features.fillModeNonSolid = 1;
     features.geometryShader = 1;
     features.pipelineStatisticsQuery = 1;
+    features.textureCompressionBC = 1;
 
     state.physical_device_features.features = features;
 
@@ -263,10 +408,19 @@ void rhi_make_device()
     mesh_shader_features.meshShader = VK_TRUE;
     mesh_shader_features.pNext = &features8;
 
+    VkPhysicalDeviceTimelineSemaphoreFeatures timeline_features = {0};
+    timeline_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timeline_features.timelineSemaphore = 1;
+    timeline_features.pNext = &mesh_shader_features;
+
     VkPhysicalDeviceDescriptorIndexingFeatures indexing_features = {0};
     indexing_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
     indexing_features.descriptorBindingPartiallyBound = 1;
-    indexing_features.pNext = &mesh_shader_features;
+    indexing_features.descriptorBindingUpdateUnusedWhilePending = 1;
+    indexing_features.descriptorBindingVariableDescriptorCount = 1;
+    indexing_features.descriptorBindingSampledImageUpdateAfterBind = 1;
+    indexing_features.runtimeDescriptorArray = 1;
+    indexing_features.pNext = &timeline_features;
 
     VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_features = { 0 };
     dynamic_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
@@ -322,12 +476,14 @@ void rhi_make_device()
         free(properties);
     }
 
-    VkDeviceQueueCreateInfo queue_create_infos[2] = {graphics_queue_create_info, compute_queue_create_info};
+    VkDeviceQueueCreateInfo queue_create_infos[3] = {graphics_queue_create_info, compute_queue_create_info};
     i32 queue_create_info_count = 2;
+    if (state.transfer_family != state.graphics_family && state.transfer_family != state.compute_family)
+        queue_create_infos[queue_create_info_count++] = transfer_queue_create_info;
 
     VkDeviceCreateInfo create_info = {0};
     create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    create_info.queueCreateInfoCount = 2;
+    create_info.queueCreateInfoCount = queue_create_info_count;
     create_info.pQueueCreateInfos = queue_create_infos;
     create_info.enabledExtensionCount = state.device_extension_count;
     create_info.ppEnabledExtensionNames = (const char* const*)state.device_extensions;
@@ -341,6 +497,7 @@ void rhi_make_device()
     volkLoadDevice(state.device);
     vkGetDeviceQueue(state.device, state.graphics_family, 0, &state.graphics_queue);
     vkGetDeviceQueue(state.device, state.compute_family, 0, &state.compute_queue);
+    vkGetDeviceQueue(state.device, state.transfer_family, 0, &state.transfer_queue);
 }
 
 void rhi_make_swapchain()
@@ -508,32 +665,61 @@ void rhi_make_allocator()
     assert(result == VK_SUCCESS);
 }
 
+// Some headroom for the regular sets bound next to a heap, the update after bind limits count them too
+internal u32 rhi_heap_capacity(u32 per_stage_limit, u32 per_set_limit)
+{
+    u32 limit = min(per_stage_limit, per_set_limit);
+    return min(RHI_DESCRIPTOR_HEAP_MAX_SIZE, limit - min(limit / 2, 64));
+}
+
 void rhi_make_descriptors()
 {
+    VkPhysicalDeviceDescriptorIndexingProperties* limits = &state.indexing_properties;
+    state.heap_capacity[DESCRIPTOR_HEAP_IMAGE] = rhi_heap_capacity(limits->maxPerStageDescriptorUpdateAfterBindSampledImages, limits->maxDescriptorSetUpdateAfterBindSampledImages);
+    state.heap_capacity[DESCRIPTOR_HEAP_SAMPLER] = rhi_heap_capacity(limits->maxPerStageDescriptorUpdateAfterBindSamplers, limits->maxDescriptorSetUpdateAfterBindSamplers);
+
     VkDescriptorPoolSize sizes[] = {
         { VK_DESCRIPTOR_TYPE_SAMPLER, 4096 },
         { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 4096 },
         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4096 },
-        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4096 }
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 4096 },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4096 },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 256 }
     };
 
     VkDescriptorPoolCreateInfo pool_info = {0};
     pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     pool_info.pPoolSizes = sizes;
-    pool_info.poolSizeCount = 4;
+    pool_info.poolSizeCount = sizeof(sizes) / sizeof(sizes[0]);
     pool_info.maxSets = 2048;
     pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
 
     VkResult res = vkCreateDescriptorPool(state.device, &pool_info, NULL, &state.descriptor_pool);
     vk_check(res);
 
+    // One heap of each type, every heap has a set per frame in flight
+    VkDescriptorPoolSize heap_sizes[] = {
+        { VK_DESCRIPTOR_TYPE_SAMPLER, FRAMES_IN_FLIGHT * state.heap_capacity[DESCRIPTOR_HEAP_SAMPLER] },
+        { VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, FRAMES_IN_FLIGHT * state.heap_capacity[DESCRIPTOR_HEAP_IMAGE] }
+    };
+
+    pool_info.pPoolSizes = heap_sizes;
+    pool_info.poolSizeCount = sizeof(heap_sizes) / sizeof(heap_sizes[0]);
+    pool_info.maxSets = 2 * FRAMES_IN_FLIGHT;
+    pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT | VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+
+    res = vkCreateDescriptorPool(state.device, &pool_info, NULL, &state.heap_pool);
+    vk_check(res);
+
     VkDescriptorSetLayoutBinding binding = {0};
     binding.binding = 0;
-    binding.descriptorCount = 2048;
+    binding.descriptorCount = state.heap_capacity[DESCRIPTOR_HEAP_IMAGE];
     binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
     binding.stageFlags = VK_SHADER_STAGE_ALL;
 
-    VkDescriptorBindingFlags flag = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+    // Streamed in meshes fill free heap slots while earlier frames are still in flight, each heap picks its own size
+    VkDescriptorBindingFlags flag = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+        | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT;
     VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags = {0};
     binding_flags.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
     binding_flags.bindingCount = 1;
@@ -544,25 +730,382 @@ void rhi_make_descriptors()
     set_layout_info.bindingCount = 1;
     set_layout_info.pBindings = &binding;
     set_layout_info.pNext = &binding_flags;
+    set_layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
     
     res = vkCreateDescriptorSetLayout(state.device, &set_layout_info, NULL, &state.image_heap_layout);
     vk_check(res);
 
     binding.binding = 0;
+    binding.descriptorCount = state.heap_capacity[DESCRIPTOR_HEAP_SAMPLER];
     binding.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
 
     res = vkCreateDescriptorSetLayout(state.device, &set_layout_info, NULL, &state.sampler_heap_layout);
     vk_check(res);
 
     state.rhi_image_heap.descriptors[0] = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
-    state.rhi_image_heap.descriptor_count = 2048;
+    state.rhi_image_heap.descriptor_count = state.heap_capacity[DESCRIPTOR_HEAP_IMAGE];
     state.rhi_image_heap.layout = state.image_heap_layout;
 
     state.rhi_sampler_heap.descriptors[0] = VK_DESCRIPTOR_TYPE_SAMPLER;
-    state.rhi_sampler_heap.descriptor_count = 2048;
+    state.rhi_sampler_heap.descriptor_count = state.heap_capacity[DESCRIPTOR_HEAP_SAMPLER];
     state.rhi_sampler_heap.layout = state.sampler_heap_layout;
 }
 
+void rhi_make_upload()
+{
+    VkCommandPoolCreateInfo pool_info = {0};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    pool_info.queueFamilyIndex = state.transfer_family;
+    vk_check(vkCreateCommandPool(state.device, &pool_info, NULL, &state.upload.transfer_pool));
+    pool_info.queueFamilyIndex = state.graphics_family;
+    vk_check(vkCreateCommandPool(state.device, &pool_info, NULL, &state.upload.graphics_pool));
+
+    for (u32 i = 0; i < RHI_UPLOAD_MAX_BATCHES; i++)
+    {
+        VkCommandBufferAllocateInfo alloc_info = {0};
+        alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        alloc_info.commandBufferCount = 1;
+
+        alloc_info.commandPool = state.upload.transfer_pool;
+        vk_check(vkAllocateCommandBuffers(state.device, &alloc_info, &state.upload.batches[i].copy));
+        alloc_info.commandPool = state.upload.graphics_pool;
+        vk_check(vkAllocateCommandBuffers(state.device, &alloc_info, &state.upload.batches[i].finish));
+    }
+
+    VkSemaphoreTypeCreateInfo timeline_info = {0};
+    timeline_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    timeline_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    timeline_info.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphore_info = {0};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = &timeline_info;
+
+    vk_check(vkCreateSemaphore(state.device, &semaphore_info, NULL, &state.upload.copy_semaphore));
+    vk_check(vkCreateSemaphore(state.device, &semaphore_info, NULL, &state.upload.finish_semaphore));
+
+    VkBufferCreateInfo ring_info = {0};
+    ring_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    ring_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    ring_info.size = RHI_STAGING_RING_SIZE;
+
+    VmaAllocationCreateInfo ring_alloc_info = {0};
+    ring_alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    ring_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo ring_allocation_info = {0};
+    vk_check(vmaCreateBuffer(state.allocator, &ring_info, &ring_alloc_info, &state.upload.ring, &state.upload.ring_allocation, &ring_allocation_info));
+    state.upload.ring_data = (u8*)ring_allocation_info.pMappedData;
+
+    // Buffer to image copies want at least texel (and 4 byte) aligned offsets, 16 covers every format we upload
+    state.upload.alignment = max(16, state.physical_device_properties_2.properties.limits.optimalBufferCopyOffsetAlignment);
+}
+
+internal vk_upload_batch* rhi_upload_batch(u32 index)
+{
+    return &state.upload.batches[(state.upload.first_batch + index) % RHI_UPLOAD_MAX_BATCHES];
+}
+
+// Retires every submitted batch the GPU is done with. With wait set, blocks until at least the oldest one is.
+internal void rhi_upload_retire(b32 wait)
+{
+    u32 in_flight = state.upload.batch_count - (state.upload.recording ? 1 : 0);
+    if (in_flight == 0)
+        return;
+
+    if (wait)
+    {
+        VkSemaphoreWaitInfo wait_info = {0};
+        wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        wait_info.semaphoreCount = 1;
+        wait_info.pSemaphores = &state.upload.finish_semaphore;
+        wait_info.pValues = &rhi_upload_batch(0)->value;
+        vkWaitSemaphores(state.device, &wait_info, UINT64_MAX);
+    }
+
+    u64 completed = 0;
+    vkGetSemaphoreCounterValue(state.device, state.upload.finish_semaphore, &completed);
+
+    while (in_flight > 0 && rhi_upload_batch(0)->value <= completed)
+    {
+        vk_upload_batch* batch = rhi_upload_batch(0);
+
+        for (u32 i = 0; i < batch->staging_count; i++)
+            vmaDestroyBuffer(state.allocator, batch->staging_buffers[i], batch->staging_allocations[i]);
+        batch->staging_count = 0;
+
+        state.upload.ring_tail = batch->ring_end;
+        state.upload.first_batch = (state.upload.first_batch + 1) % RHI_UPLOAD_MAX_BATCHES;
+        state.upload.batch_count--;
+        in_flight--;
+    }
+}
+
+// The batch uploads are recorded into, opened on first use
+internal vk_upload_batch* rhi_upload_recording_batch()
+{
+    if (!state.upload.recording)
+    {
+        if (state.upload.batch_count == RHI_UPLOAD_MAX_BATCHES)
+            rhi_upload_retire(1);
+
+        vk_upload_batch* batch = rhi_upload_batch(state.upload.batch_count++);
+        batch->upload_count = 0;
+        state.upload.recording = 1;
+
+        VkCommandBufferBeginInfo begin_info = {0};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vk_check(vkResetCommandBuffer(batch->copy, 0));
+        vk_check(vkResetCommandBuffer(batch->finish, 0));
+        vk_check(vkBeginCommandBuffer(batch->copy, &begin_info));
+        vk_check(vkBeginCommandBuffer(batch->finish, &begin_info));
+    }
+
+    return rhi_upload_batch(state.upload.batch_count - 1);
+}
+
+// Copy submit signals copy_semaphore, the graphics half waits on it and signals finish_semaphore. Nothing blocks,
+// retirement is picked up by rhi_upload_retire.
+internal void rhi_upload_submit()
+{
+    if (!state.upload.recording)
+        return;
+
+    vk_upload_batch* batch = rhi_upload_batch(state.upload.batch_count - 1);
+    vk_check(vkEndCommandBuffer(batch->copy));
+    vk_check(vkEndCommandBuffer(batch->finish));
+
+    batch->value = ++state.upload.submitted_value;
+    batch->ring_end = state.upload.ring_head;
+
+    VkTimelineSemaphoreSubmitInfo copy_timeline = {0};
+    copy_timeline.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    copy_timeline.signalSemaphoreValueCount = 1;
+    copy_timeline.pSignalSemaphoreValues = &batch->value;
+
+    VkSubmitInfo copy_submit = {0};
+    copy_submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    copy_submit.pNext = &copy_timeline;
+    copy_submit.commandBufferCount = 1;
+    copy_submit.pCommandBuffers = &batch->copy;
+    copy_submit.signalSemaphoreCount = 1;
+    copy_submit.pSignalSemaphores = &state.upload.copy_semaphore;
+
+    vk_check(vkQueueSubmit(state.transfer_queue, 1, &copy_submit, VK_NULL_HANDLE));
+
+    VkTimelineSemaphoreSubmitInfo finish_timeline = {0};
+    finish_timeline.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    finish_timeline.waitSemaphoreValueCount = 1;
+    finish_timeline.pWaitSemaphoreValues = &batch->value;
+    finish_timeline.signalSemaphoreValueCount = 1;
+    finish_timeline.pSignalSemaphoreValues = &batch->value;
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+
+    VkSubmitInfo finish_submit = {0};
+    finish_submit.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    finish_submit.pNext = &finish_timeline;
+    finish_submit.waitSemaphoreCount = 1;
+    finish_submit.pWaitSemaphores = &state.upload.copy_semaphore;
+    finish_submit.pWaitDstStageMask = &wait_stage;
+    finish_submit.commandBufferCount = 1;
+    finish_submit.pCommandBuffers = &batch->finish;
+    finish_submit.signalSemaphoreCount = 1;
+    finish_submit.pSignalSemaphores = &state.upload.finish_semaphore;
+
+    vk_check(vkQueueSubmit(state.graphics_queue, 1, &finish_submit, VK_NULL_HANDLE));
+
+    state.upload.recording = 0;
+}
+
+// The recording batch destroys the buffer once it has retired
+internal void rhi_upload_own_staging(VkBuffer buffer, VmaAllocation allocation)
+{
+    vk_upload_batch* batch = rhi_upload_recording_batch();
+    if (batch->staging_count == batch->staging_capacity)
+    {
+        batch->staging_capacity = max(batch->staging_capacity * 2, 8);
+        batch->staging_buffers = realloc(batch->staging_buffers, batch->staging_capacity * sizeof(VkBuffer));
+        batch->staging_allocations = realloc(batch->staging_allocations, batch->staging_capacity * sizeof(VmaAllocation));
+    }
+    batch->staging_buffers[batch->staging_count] = buffer;
+    batch->staging_allocations[batch->staging_count] = allocation;
+    batch->staging_count++;
+}
+
+// Reserves size bytes of staging memory for the recording batch. Waits on older batches when the ring is full.
+internal void* rhi_upload_stage(u64 size, VkBuffer* buffer, u64* offset)
+{
+    if (size > RHI_STAGING_RING_SIZE)
+    {
+        VkBufferCreateInfo staging_info = {0};
+        staging_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        staging_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        staging_info.size = size;
+
+        VmaAllocationCreateInfo staging_alloc_info = {0};
+        staging_alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+        staging_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+        VmaAllocation allocation;
+        VmaAllocationInfo allocation_info = {0};
+        vk_check(vmaCreateBuffer(state.allocator, &staging_info, &staging_alloc_info, buffer, &allocation, &allocation_info));
+        rhi_upload_own_staging(*buffer, allocation);
+
+        *offset = 0;
+        return allocation_info.pMappedData;
+    }
+
+    for (;;)
+    {
+        u64 start = (state.upload.ring_head + state.upload.alignment - 1) / state.upload.alignment * state.upload.alignment;
+
+        // Never straddle the end of the buffer, skip to the start instead
+        if (start / RHI_STAGING_RING_SIZE != (start + size - 1) / RHI_STAGING_RING_SIZE)
+            start = (start / RHI_STAGING_RING_SIZE + 1) * RHI_STAGING_RING_SIZE;
+
+        if (start + size - state.upload.ring_tail <= RHI_STAGING_RING_SIZE)
+        {
+            state.upload.ring_head = start + size;
+            *buffer = state.upload.ring;
+            *offset = start % RHI_STAGING_RING_SIZE;
+            return state.upload.ring_data + *offset;
+        }
+
+        // Full: what is recorded has to go out before its space can come back
+        if (state.upload.recording && rhi_upload_batch(state.upload.batch_count - 1)->upload_count > 0)
+            rhi_upload_submit();
+        else if (state.upload.batch_count == (state.upload.recording ? 1 : 0))
+            state.upload.ring_tail = state.upload.ring_head;
+        rhi_upload_retire(1);
+    }
+}
+
+// Submits and blocks until every upload has landed
+internal void rhi_upload_drain()
+{
+    rhi_upload_submit();
+    while (state.upload.batch_count > 0)
+        rhi_upload_retire(1);
+}
+
+void rhi_free_upload()
+{
+    rhi_upload_drain();
+
+    for (u32 i = 0; i < RHI_UPLOAD_MAX_BATCHES; i++)
+    {
+        free(state.upload.batches[i].staging_buffers);
+        free(state.upload.batches[i].staging_allocations);
+    }
+
+    vmaDestroyBuffer(state.allocator, state.upload.ring, state.upload.ring_allocation);
+    vkDestroySemaphore(state.device, state.upload.finish_semaphore, NULL);
+    vkDestroySemaphore(state.device, state.upload.copy_semaphore, NULL);
+    vkDestroyCommandPool(state.device, state.upload.graphics_pool, NULL);
+    vkDestroyCommandPool(state.device, state.upload.transfer_pool, NULL);
+}
+
+void rhi_make_frame_ring()
+{
+    rhi_allocate_buffer(&state.frame.buffer, RHI_FRAME_RING_SIZE * FRAMES_IN_FLIGHT, BUFFER_UNIFORM | BUFFER_DYNAMIC);
+    state.frame.alignment = max(16, state.physical_device_properties_2.properties.limits.minUniformBufferOffsetAlignment);
+    state.frame.head = 0;
+}
+
+void rhi_free_frame_ring()
+{
+    rhi_free_buffer(&state.frame.buffer);
+}
+
+void rhi_make_pipeline_cache()
+{
+    VkPipelineCacheCreateInfo create_info = {0};
+    create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+
+    u8* data = NULL;
+    FILE* file = fopen(RHI_PIPELINE_CACHE_PATH, "rb");
+    if (file)
+    {
+        vk_pipeline_cache_header header;
+        b32 valid = fread(&header, sizeof(header), 1, file) == 1
+            && header.magic == VK_PIPELINE_CACHE_MAGIC
+            && header.version == VK_PIPELINE_CACHE_VERSION
+            && header.driver_version == state.physical_device_properties_2.properties.driverVersion
+            && memcmp(header.driver_uuid, state.id_properties.driverUUID, VK_UUID_SIZE) == 0
+            && memcmp(header.device_uuid, state.id_properties.deviceUUID, VK_UUID_SIZE) == 0;
+
+        if (valid && header.data_size > 0)
+        {
+            data = malloc(header.data_size);
+            if (fread(data, header.data_size, 1, file) == 1)
+            {
+                create_info.initialDataSize = header.data_size;
+                create_info.pInitialData = data;
+            }
+        }
+
+        if (!create_info.pInitialData)
+            printf("Pipeline cache: %s is stale or from another device, rebuilding\n", RHI_PIPELINE_CACHE_PATH);
+        fclose(file);
+    }
+
+    VkResult res = vkCreatePipelineCache(state.device, &create_info, NULL, &state.pipeline_cache);
+    if (res != VK_SUCCESS && create_info.pInitialData)
+    {
+        create_info.initialDataSize = 0;
+        create_info.pInitialData = NULL;
+        res = vkCreatePipelineCache(state.device, &create_info, NULL, &state.pipeline_cache);
+    }
+    vk_check(res);
+
+    state.pipeline_cache_warm = create_info.pInitialData != NULL;
+    free(data);
+}
+
+void rhi_free_pipeline_cache()
+{
+    printf("Pipelines: %u created in %.2f ms (%s cache)\n", state.pipeline_count, state.pipeline_time * 1000.0f, state.pipeline_cache_warm ? "warm" : "cold");
+
+    size_t size = 0;
+    vkGetPipelineCacheData(state.device, state.pipeline_cache, &size, NULL);
+
+    u8* data = size ? malloc(size) : NULL;
+    if (data && vkGetPipelineCacheData(state.device, state.pipeline_cache, &size, data) == VK_SUCCESS)
+    {
+        vk_pipeline_cache_header header = {0};
+        header.magic = VK_PIPELINE_CACHE_MAGIC;
+        header.version = VK_PIPELINE_CACHE_VERSION;
+        header.driver_version = state.physical_device_properties_2.properties.driverVersion;
+        header.data_size = size;
+        memcpy(header.driver_uuid, state.id_properties.driverUUID, VK_UUID_SIZE);
+        memcpy(header.device_uuid, state.id_properties.deviceUUID, VK_UUID_SIZE);
+
+        // Written aside and renamed so a crash never leaves a truncated cache behind
+        char temp_path[512];
+        snprintf(temp_path, sizeof(temp_path), "%s.tmp", RHI_PIPELINE_CACHE_PATH);
+
+        FILE* file = fopen(temp_path, "wb");
+        if (file)
+        {
+            b32 written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, size, 1, file) == 1;
+            written = fclose(file) == 0 && written;
+
+            remove(RHI_PIPELINE_CACHE_PATH);
+            if (!written || rename(temp_path, RHI_PIPELINE_CACHE_PATH) != 0)
+                remove(temp_path);
+        }
+    }
+
+    free(data);
+    vkDestroyPipelineCache(state.device, state.pipeline_cache, NULL);
+}
+
 void rhi_init()
 {
     memset(&state, 0, sizeof(vk_state));
@@ -576,7 +1119,10 @@ void rhi_init()
     rhi_make_sync();
     rhi_make_cmd();
     rhi_make_allocator();
+    rhi_make_pipeline_cache();
     rhi_make_descriptors();
+    rhi_make_upload();
+    rhi_make_frame_ring();
 }
 
 void rhi_begin()
@@ -589,6 +1135,14 @@ void rhi_begin()
     vkResetFences(state.device, 1, &state.swap_chain_fences[state.image_index]);
     vkResetCommandBuffer(cmd_buf->buf, 0);
 
+    // A fence also covers every earlier submit on the queue
+    state.completed_frame = max(state.completed_frame, state.fence_frames[state.image_index]);
+    state.frame_number++;
+
+    // The fence above covers the last frame that wrote this region
+    state.frame.head = 0;
+    rhi_upload_retire(0);
+
     rhi_begin_cmd_buf(cmd_buf);
 }
 
@@ -597,6 +1151,12 @@ void rhi_end()
     RHI_CommandBuffer cmd_buf = state.swap_chain_cmd_bufs[state.image_index];
     rhi_end_cmd_buf(&cmd_buf);
 
+    if (state.frame.head > 0)
+        vmaFlushAllocation(state.allocator, state.frame.buffer.allocation, state.image_index * RHI_FRAME_RING_SIZE, state.frame.head);
+
+    // Pending uploads go ahead of the frame on the graphics queue, so this frame can already sample them
+    rhi_upload_submit();
+
     VkSubmitInfo submit_info = { 0 };
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
@@ -616,6 +1176,7 @@ void rhi_end()
 
     VkResult result = vkQueueSubmit(state.graphics_queue, 1, &submit_info, state.swap_chain_fences[state.image_index]);
     vk_check(result);
+    state.fence_frames[state.image_index] = state.frame_number;
 }
 
 void rhi_present()
@@ -638,8 +1199,12 @@ void rhi_shutdown()
 {
     vkDeviceWaitIdle(state.device);
 
+    rhi_free_upload();
+    rhi_free_frame_ring();
+    rhi_free_pipeline_cache();
     vkDestroyDescriptorSetLayout(state.device, state.sampler_heap_layout, NULL);
     vkDestroyDescriptorSetLayout(state.device, state.image_heap_layout, NULL);
+    vkDestroyDescriptorPool(state.device, state.heap_pool, NULL);
     vkDestroyDescriptorPool(state.device, state.descriptor_pool, NULL);
     vmaDestroyAllocator(state.allocator);
 
@@ -783,6 +1348,25 @@ void rhi_descriptor_set_write_buffer(RHI_DescriptorSet* set, RHI_Buffer* buffer,
     vkUpdateDescriptorSets(state.device, 1, &write, 0, NULL);
 }
 
+void rhi_descriptor_set_write_dynamic_buffer(RHI_DescriptorSet* set, RHI_Buffer* buffer, i32 size, i32 binding)
+{
+    VkDescriptorBufferInfo buffer_info = {0};
+    buffer_info.buffer = buffer->buffer;
+    buffer_info.offset = 0;
+    buffer_info.range = size;
+
+    VkWriteDescriptorSet write = {0};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set->set;
+    write.dstBinding = binding;
+    write.descriptorCount = 1;
+    write.dstArrayElement = 0;
+    write.pBufferInfo = &buffer_info;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+
+    vkUpdateDescriptorSets(state.device, 1, &write, 0, NULL);
+}
+
 void rhi_descriptor_set_write_storage_image(RHI_DescriptorSet* set, RHI_Image* image, RHI_Sampler* sampler, i32 binding)
 {
     VkDescriptorImageInfo image_info = {0};
@@ -859,8 +1443,33 @@ void rhi_descriptor_set_write_image_sampler(RHI_DescriptorSet* set, RHI_Image* i
     vkUpdateDescriptorSets(state.device, 1, &write, 0, NULL);
 }
 
+internal vk_sampler_entry* rhi_find_sampler(VkSampler sampler)
+{
+    for (u32 i = 0; i < RHI_MAX_SAMPLERS; i++)
+    {
+        if (state.samplers[i].refs > 0 && state.samplers[i].sampler == sampler)
+            return &state.samplers[i];
+    }
+    return NULL;
+}
+
 void rhi_init_sampler(RHI_Sampler* sampler, u32 mips)
 {
+    vk_sampler_entry* entry = NULL;
+    for (u32 i = 0; i < RHI_MAX_SAMPLERS; i++)
+    {
+        vk_sampler_entry* candidate = &state.samplers[i];
+        if (candidate->refs > 0 && candidate->filter == sampler->filter && candidate->address_mode == sampler->address_mode && candidate->mips == mips)
+        {
+            candidate->refs++;
+            sampler->sampler = candidate->sampler;
+            return;
+        }
+        if (!entry && candidate->refs == 0)
+            entry = candidate;
+    }
+    assert(entry);
+
     VkSamplerCreateInfo create_info = {0};
     create_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
     create_info.magFilter = sampler->filter;
@@ -881,33 +1490,112 @@ void rhi_init_sampler(RHI_Sampler* sampler, u32 mips)
 
     VkResult res = vkCreateSampler(state.device, &create_info, NULL, &sampler->sampler);
     vk_check(res);
+
+    entry->filter = sampler->filter;
+    entry->address_mode = sampler->address_mode;
+    entry->mips = mips;
+    entry->sampler = sampler->sampler;
+    entry->refs = 1;
+    entry->heap = NULL;
+    entry->heap_index = -1;
 }
 
 void rhi_free_sampler(RHI_Sampler* sampler)
 {
-    vkDestroySampler(state.device, sampler->sampler, NULL);
+    vk_sampler_entry* entry = rhi_find_sampler(sampler->sampler);
+    assert(entry);
+
+    if (--entry->refs == 0)
+    {
+        if (entry->heap)
+            rhi_free_descriptor(entry->heap, entry->heap_index);
+        vkDestroySampler(state.device, entry->sampler, NULL);
+        memset(entry, 0, sizeof(*entry));
+    }
+    sampler->sampler = VK_NULL_HANDLE;
+}
+
+i32 rhi_get_sampler_heap_index(RHI_DescriptorHeap* heap, RHI_Sampler* sampler)
+{
+    vk_sampler_entry* entry = rhi_find_sampler(sampler->sampler);
+    assert(entry && (!entry->heap || entry->heap == heap));
+
+    if (!entry->heap)
+    {
+        entry->heap_index = rhi_find_available_descriptor(heap);
+        assert(entry->heap_index >= 0);
+        entry->heap = heap;
+        rhi_push_descriptor_heap_sampler(heap, sampler, entry->heap_index);
+    }
+    return entry->heap_index;
 }
 
 void rhi_load_shader(RHI_ShaderModule* shader, const char* path)
 {
-    shader->byte_code = (u32*)aurora_platform_read_file(path, &shader->byte_code_size);
+    vk_shader_entry* entry = NULL;
+    for (u32 i = 0; i < RHI_MAX_SHADER_MODULES; i++)
+    {
+        vk_shader_entry* candidate = &state.shaders[i];
+        if (candidate->refs > 0 && strcmp(candidate->path, path) == 0)
+        {
+            candidate->refs++;
+            *shader = candidate->module;
+            return;
+        }
+        if (!entry && candidate->refs == 0)
+            entry = candidate;
+    }
+    assert(entry && strlen(path) < sizeof(entry->path));
+
+    strcpy(entry->path, path);
+    entry->module.path = entry->path;
+    entry->module.byte_code = (u32*)aurora_platform_read_file(path, &entry->module.byte_code_size);
     
     VkShaderModuleCreateInfo create_info = {0};
     create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    create_info.codeSize = shader->byte_code_size;
-    create_info.pCode = shader->byte_code;
+    create_info.codeSize = entry->module.byte_code_size;
+    create_info.pCode = entry->module.byte_code;
     
-    VkResult res = vkCreateShaderModule(state.device, &create_info, NULL, &shader->shader_module);
+    VkResult res = vkCreateShaderModule(state.device, &create_info, NULL, &entry->module.shader_module);
     vk_check(res);
+
+    entry->refs = 1;
+    *shader = entry->module;
 }
 
 void rhi_free_shader(RHI_ShaderModule* shader)
 {
-    vkDestroyShaderModule(state.device, shader->shader_module, NULL);
-    free(shader->byte_code);
+    for (u32 i = 0; i < RHI_MAX_SHADER_MODULES; i++)
+    {
+        vk_shader_entry* entry = &state.shaders[i];
+        if (entry->refs > 0 && entry->module.shader_module == shader->shader_module)
+        {
+            if (--entry->refs == 0)
+            {
+                vkDestroyShaderModule(state.device, entry->module.shader_module, NULL);
+                free(entry->module.byte_code);
+                memset(entry, 0, sizeof(*entry));
+            }
+            break;
+        }
+    }
+    memset(shader, 0, sizeof(*shader));
 }
 
-void rhi_init_graphics_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
+internal void rhi_retain_shader(RHI_ShaderModule* shader)
+{
+    for (u32 i = 0; i < RHI_MAX_SHADER_MODULES; i++)
+    {
+        if (state.shaders[i].refs > 0 && state.shaders[i].module.shader_module == shader->shader_module)
+        {
+            state.shaders[i].refs++;
+            return;
+        }
+    }
+    assert(0);
+}
+
+internal void rhi_build_graphics_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
 {
     pipeline->bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
     pipeline->pipeline_type = PIPELINE_GRAPHICS;
@@ -1147,13 +1835,13 @@ void rhi_init_graphics_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor*
     pipeline_info.pVertexInputState = &vertex_input_state_info;
     pipeline_info.pInputAssemblyState = &input_assembly;
 
-    res = vkCreateGraphicsPipelines(state.device, VK_NULL_HANDLE, 1, &pipeline_info, NULL, &pipeline->pipeline);
+    res = vkCreateGraphicsPipelines(state.device, state.pipeline_cache, 1, &pipeline_info, NULL, &pipeline->pipeline);
     vk_check(res);
 
     free(states);
 }
 
-void rhi_init_compute_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
+internal void rhi_build_compute_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
 {
     pipeline->bind_point = VK_PIPELINE_BIND_POINT_COMPUTE;
     pipeline->pipeline_type = PIPELINE_COMPUTE;
@@ -1190,29 +1878,127 @@ void rhi_init_compute_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* d
     info.stage.pName = "main";
     info.layout = pipeline->pipeline_layout;
 
-    res = vkCreateComputePipelines(state.device, VK_NULL_HANDLE, 1, &info, NULL, &pipeline->pipeline);
+    res = vkCreateComputePipelines(state.device, state.pipeline_cache, 1, &info, NULL, &pipeline->pipeline);
     vk_check(res);
 }
 
+internal void rhi_pipeline_job(void* ptr)
+{
+    vk_pipeline_job* job = (vk_pipeline_job*)ptr;
+
+    f32 start = aurora_platform_get_time();
+    if (job->pipeline->pipeline_type == PIPELINE_COMPUTE)
+        rhi_build_compute_pipeline(job->pipeline, &job->descriptor);
+    else
+        rhi_build_graphics_pipeline(job->pipeline, &job->descriptor);
+    job->time = aurora_platform_get_time() - start;
+}
+
+// Everything touching the shader table happens here, on the thread that owns the RHI
+internal void rhi_submit_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor, u32 type)
+{
+    vk_pipeline_job* job = calloc(1, sizeof(vk_pipeline_job));
+    job->pipeline = pipeline;
+    job->descriptor = *descriptor;
+
+    RHI_ShaderModule** stages[] = { &job->descriptor.shaders.vs, &job->descriptor.shaders.ps, &job->descriptor.shaders.cs, &job->descriptor.shaders.ms, &job->descriptor.shaders.ts };
+    b32 used[] = { type == PIPELINE_GRAPHICS && !descriptor->use_mesh_shaders, type == PIPELINE_GRAPHICS, type == PIPELINE_COMPUTE, type == PIPELINE_GRAPHICS && descriptor->use_mesh_shaders, type == PIPELINE_GRAPHICS && descriptor->use_mesh_shaders };
+    for (u32 i = 0; i < ARRAY_SIZE(stages); i++)
+    {
+        if (!used[i])
+        {
+            *stages[i] = NULL;
+            continue;
+        }
+        job->shaders[i] = **stages[i];
+        *stages[i] = &job->shaders[i];
+        rhi_retain_shader(&job->shaders[i]);
+    }
+
+    pipeline->pipeline_type = type;
+    pipeline->bind_point = type == PIPELINE_COMPUTE ? VK_PIPELINE_BIND_POINT_COMPUTE : VK_PIPELINE_BIND_POINT_GRAPHICS;
+    pipeline->pending = job;
+
+    job_submit(rhi_pipeline_job, job, &job->counter);
+}
+
+void rhi_wait_pipeline(RHI_Pipeline* pipeline)
+{
+    vk_pipeline_job* job = (vk_pipeline_job*)pipeline->pending;
+    if (!job)
+        return;
+
+    job_wait(&job->counter);
+    pipeline->pending = NULL;
+
+    const char* name = job->descriptor.shaders.cs ? job->descriptor.shaders.cs->path : job->descriptor.shaders.ps->path;
+    state.pipeline_time += job->time;
+    state.pipeline_count++;
+    printf("Pipeline %s: %.2f ms (%s cache)\n", name, job->time * 1000.0f, state.pipeline_cache_warm ? "warm" : "cold");
+
+    for (u32 i = 0; i < ARRAY_SIZE(job->shaders); i++)
+    {
+        if (job->shaders[i].shader_module)
+            rhi_free_shader(&job->shaders[i]);
+    }
+    free(job);
+}
+
+void rhi_init_graphics_pipeline_async(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
+{
+    rhi_submit_pipeline(pipeline, descriptor, PIPELINE_GRAPHICS);
+}
+
+void rhi_init_compute_pipeline_async(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
+{
+    rhi_submit_pipeline(pipeline, descriptor, PIPELINE_COMPUTE);
+}
+
+void rhi_init_graphics_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
+{
+    rhi_submit_pipeline(pipeline, descriptor, PIPELINE_GRAPHICS);
+    rhi_wait_pipeline(pipeline);
+}
+
+void rhi_init_compute_pipeline(RHI_Pipeline* pipeline, RHI_PipelineDescriptor* descriptor)
+{
+    rhi_submit_pipeline(pipeline, descriptor, PIPELINE_COMPUTE);
+    rhi_wait_pipeline(pipeline);
+}
+
 void rhi_free_pipeline(RHI_Pipeline* pipeline)
 {
+    rhi_wait_pipeline(pipeline);
+
     vkDestroyPipeline(state.device, pipeline->pipeline, NULL);
     vkDestroyPipelineLayout(state.device, pipeline->pipeline_layout, NULL);
 }
 
 void rhi_allocate_buffer(RHI_Buffer* buffer, u64 size, u32 buffer_usage)
 {
+    b32 dynamic = (buffer_usage & BUFFER_DYNAMIC) != 0;
+
+    buffer->usage = (VkBufferUsageFlagBits)(buffer_usage & ~BUFFER_DYNAMIC);
+    buffer->memory_usage = (VmaMemoryUsage)vk_get_memory_usage(buffer_usage);
+    buffer->size = size;
+    buffer->mapped = NULL;
+
     VkBufferCreateInfo buffer_create_info = {0};
     buffer_create_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     buffer_create_info.size = size;
     buffer_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    buffer_create_info.usage = (VkBufferUsageFlagBits)buffer_usage;
+    buffer_create_info.usage = buffer->usage | (dynamic ? 0 : VK_BUFFER_USAGE_TRANSFER_DST_BIT);
 
     VmaAllocationCreateInfo allocation_create_info = {0};
-    allocation_create_info.usage = vk_get_memory_usage(buffer_create_info.usage);
+    allocation_create_info.usage = buffer->memory_usage;
+    allocation_create_info.flags = dynamic ? VMA_ALLOCATION_CREATE_MAPPED_BIT : 0;
 
-    VkResult result = vmaCreateBuffer(state.allocator, &buffer_create_info, &allocation_create_info, &buffer->buffer, &buffer->allocation, NULL);
+    VmaAllocationInfo allocation_info = {0};
+    VkResult result = vmaCreateBuffer(state.allocator, &buffer_create_info, &allocation_create_info, &buffer->buffer, &buffer->allocation, &allocation_info);
     vk_check(result);
+
+    if (dynamic)
+        buffer->mapped = allocation_info.pMappedData;
 }
 
 void rhi_free_buffer(RHI_Buffer* buffer)
@@ -1222,10 +2008,74 @@ void rhi_free_buffer(RHI_Buffer* buffer)
 
 void rhi_upload_buffer(RHI_Buffer* buffer, void* data, u64 size)
 {
-    void* buf = NULL;
-    vk_check(vmaMapMemory(state.allocator, buffer->allocation, &buf));
-    memcpy(buf, data, size);
-    vmaUnmapMemory(state.allocator, buffer->allocation);
+    assert(size <= buffer->size);
+
+    if (buffer->mapped)
+    {
+        memcpy(buffer->mapped, data, size);
+        vmaFlushAllocation(state.allocator, buffer->allocation, 0, size);
+        return;
+    }
+
+    if (size == 0)
+        return;
+
+    VkBuffer staging_buffer;
+    u64 staging_offset;
+    void* staging_data = rhi_upload_stage(size, &staging_buffer, &staging_offset);
+    memcpy(staging_data, data, size);
+
+    vk_upload_batch* batch = rhi_upload_recording_batch();
+    batch->upload_count++;
+
+    VkBufferCopy region = {0};
+    region.srcOffset = staging_offset;
+    region.dstOffset = 0;
+    region.size = size;
+    vkCmdCopyBuffer(batch->copy, staging_buffer, buffer->buffer, 1, &region);
+
+    // Same family: the semaphore between the two halves already makes the copy visible
+    if (state.transfer_family != state.graphics_family)
+    {
+        VkBufferMemoryBarrier handoff = {0};
+        handoff.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        handoff.srcQueueFamilyIndex = state.transfer_family;
+        handoff.dstQueueFamilyIndex = state.graphics_family;
+        handoff.buffer = buffer->buffer;
+        handoff.offset = 0;
+        handoff.size = VK_WHOLE_SIZE;
+
+        handoff.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        handoff.dstAccessMask = 0;
+        vkCmdPipelineBarrier(batch->copy, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 1, &handoff, 0, NULL);
+
+        handoff.srcAccessMask = 0;
+        handoff.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+        vkCmdPipelineBarrier(batch->finish, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 1, &handoff, 0, NULL);
+    }
+}
+
+RHI_Buffer* rhi_get_frame_buffer()
+{
+    return &state.frame.buffer;
+}
+
+void* rhi_frame_alloc(u64 size, u32* offset)
+{
+    u64 start = (state.frame.head + state.frame.alignment - 1) & ~(state.frame.alignment - 1);
+    assert(start + size <= RHI_FRAME_RING_SIZE);
+    state.frame.head = start + size;
+
+    u64 region = state.image_index * RHI_FRAME_RING_SIZE;
+    *offset = (u32)(region + start);
+    return (u8*)state.frame.buffer.mapped + region + start;
+}
+
+u32 rhi_frame_upload(const void* data, u64 size)
+{
+    u32 offset;
+    memcpy(rhi_frame_alloc(size, &offset), data, size);
+    return offset;
 }
 
 void rhi_allocate_image(RHI_Image* image, i32 width, i32 height, VkFormat format, u32 usage, u32 target_layout)
@@ -1345,84 +2195,6 @@ void rhi_allocate_cubemap(RHI_Image* image, i32 width, i32 height, VkFormat form
     rhi_submit_upload_cmd_buf(&temp);
 }
 
-void rhi_generate_mipmaps(RHI_Image* image)
-{
-    RHI_CommandBuffer cmd_buf;
-    rhi_init_cmd_buf(&cmd_buf, COMMAND_BUFFER_GRAPHICS);
-
-    rhi_begin_cmd_buf(&cmd_buf);
-
-    VkImageMemoryBarrier barrier;
-    memset(&barrier, 0, sizeof(barrier));
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = image->image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
-    i32 mip_width = image->width;
-    i32 mip_height = image->height;
-
-    for (u32 i = 1; i < image->mip_levels; i++)
-    {
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-        vkCmdPipelineBarrier(cmd_buf.buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
-
-        VkImageBlit blit;
-        memset(&blit, 0, sizeof(blit));
-        blit.srcOffsets[0].x = 0;
-        blit.srcOffsets[0].y = 0;
-        blit.srcOffsets[0].z = 0;
-        blit.srcOffsets[1].x = mip_width;
-        blit.srcOffsets[1].y = mip_height;
-        blit.srcOffsets[1].z = 1;
-        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.srcSubresource.mipLevel = i - 1;
-        blit.srcSubresource.baseArrayLayer = 0;
-        blit.srcSubresource.layerCount = 1;
-        blit.dstOffsets[0].x = 0;
-        blit.dstOffsets[0].y = 0;
-        blit.dstOffsets[0].z = 0;
-        blit.dstOffsets[1].x = mip_width > 1 ? mip_width / 2 : 1;
-        blit.dstOffsets[1].y = mip_height > 1 ? mip_height / 2 : 1;
-        blit.dstOffsets[1].z = 1;
-        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.dstSubresource.mipLevel = i;
-        blit.dstSubresource.baseArrayLayer = 0;
-        blit.dstSubresource.layerCount = 1;
-
-        vkCmdBlitImage(cmd_buf.buf, image->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
-
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-        vkCmdPipelineBarrier(cmd_buf.buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
-
-        if (mip_width > 1) mip_width /= 2;
-        if (mip_height > 1) mip_height /= 2;
-    }
-
-    barrier.subresourceRange.baseMipLevel = image->mip_levels - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(cmd_buf.buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
-
-    rhi_submit_cmd_buf(&cmd_buf);
-}
-
 void rhi_load_raw_image(RHI_RawImage* image, const char* path)
 {
     u32 channels;
@@ -1430,6 +2202,8 @@ void rhi_load_raw_image(RHI_RawImage* image, const char* path)
     //assert(image->data);
     image->data_size = image->width * image->height * 4;
     image->format = VK_FORMAT_R8G8B8A8_UNORM;
+    image->mip_levels = 1;
+    image->mip_offsets[0] = 0;
 }
 
 void rhi_load_raw_hdr_image(RHI_RawImage* image, const char* path)
@@ -1439,6 +2213,8 @@ void rhi_load_raw_hdr_image(RHI_RawImage* image, const char* path)
     assert(image->data);
     image->data_size = image->width * image->height * 4 * sizeof(u16);
     image->format = VK_FORMAT_R16G16B16A16_UNORM;
+    image->mip_levels = 1;
+    image->mip_offsets[0] = 0;
 }
 
 void rhi_free_raw_image(RHI_RawImage* image)
@@ -1446,16 +2222,31 @@ void rhi_free_raw_image(RHI_RawImage* image)
     free(image->data);
 }
 
-void rhi_upload_image(RHI_Image* image, RHI_RawImage* raw_image, b32 gen_mips)
+// Mips are never generated here, the raw image carries every level it should have (see texture_load)
+void rhi_upload_image(RHI_Image* image, RHI_RawImage* raw_image)
 {
+    memcpy(rhi_stage_image(image, raw_image), raw_image->data, raw_image->data_size);
+}
+
+// Creates the image and records its upload: levels [0, staged_levels) from the staging buffer at the raw image's
+// offsets, the others copied on the graphics queue from the last levels of source
+internal void rhi_record_image_upload(RHI_Image* image, RHI_RawImage* raw_image, VkBuffer staging_buffer, u64 staging_offset, u32 staged_levels, RHI_Image* source)
+{
+    // Block compressed images can't be storage images
+    b32 compressed = vk_is_block_compressed(raw_image->format);
+    u32 raw_levels = max(raw_image->mip_levels, 1);
+    u32 copied_levels = raw_levels - staged_levels;
+    assert(staged_levels <= raw_levels);
+    assert(copied_levels == 0 || (source && source->format == raw_image->format && copied_levels <= source->mip_levels));
+
     image->format = raw_image->format;
     image->extent.width = raw_image->width;
     image->extent.height = raw_image->height;
     image->width = raw_image->width;
     image->height = raw_image->height;
-    image->usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    image->usage = compressed ? VK_IMAGE_USAGE_SAMPLED_BIT : VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
     image->image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    image->mip_levels = gen_mips == 1 ? (u32)(floor(log2(max(image->width, image->height))) + 1) : 1;
+    image->mip_levels = raw_levels;
     
     VkImageCreateInfo image_create_info = { 0 };
     image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1468,7 +2259,7 @@ void rhi_upload_image(RHI_Image* image, RHI_RawImage* raw_image, b32 gen_mips)
     image_create_info.arrayLayers = 1;
     image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
     image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | image->usage;
     image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
     image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
@@ -1478,45 +2269,89 @@ void rhi_upload_image(RHI_Image* image, RHI_RawImage* raw_image, b32 gen_mips)
     VkResult res = vmaCreateImage(state.allocator, &image_create_info, &allocation, &image->image, &image->allocation, NULL);
     vk_check(res);
 
-    VkBuffer staging_buffer = VK_NULL_HANDLE;
-    VmaAllocation staging_buffer_allocation = VK_NULL_HANDLE;
-    VmaAllocationInfo staging_buffer_allocation_info = {0};
+    // Every staged level goes out in the same copy, one region each
+    VkBufferImageCopy image_copy_regions[RHI_MAX_MIP_LEVELS];
+    memset(image_copy_regions, 0, sizeof(image_copy_regions));
+    for (u32 i = 0; i < staged_levels; i++)
+    {
+        VkBufferImageCopy* region = &image_copy_regions[i];
+        region->bufferOffset = staging_offset + raw_image->mip_offsets[i];
+        region->imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region->imageSubresource.mipLevel = i;
+        region->imageSubresource.baseArrayLayer = 0;
+        region->imageSubresource.layerCount = 1;
+        region->imageExtent.width = max(image->width >> i, 1);
+        region->imageExtent.height = max(image->height >> i, 1);
+        region->imageExtent.depth = 1;
+    }
 
-    VkBufferCreateInfo staging_buffer_info = { 0 };
-    staging_buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    staging_buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    staging_buffer_info.size = raw_image->data_size;
+    vk_upload_batch* batch = rhi_upload_recording_batch();
+    batch->upload_count++;
 
-    VmaAllocationCreateInfo staging_buffer_alloc_info = { 0 };
-    staging_buffer_alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    RHI_CommandBuffer copy = { batch->copy, COMMAND_BUFFER_UPLOAD };
+    RHI_CommandBuffer finish = { batch->finish, COMMAND_BUFFER_GRAPHICS };
 
-    res = vmaCreateBuffer(state.allocator, &staging_buffer_info, &staging_buffer_alloc_info, &staging_buffer, &staging_buffer_allocation, NULL);
-    vk_check(res);
+    rhi_cmd_img_transition_layout(&copy, image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
+    if (staged_levels > 0)
+        vkCmdCopyBufferToImage(copy.buf, staging_buffer, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, staged_levels, image_copy_regions);
 
-    void* upload_data;
-    vmaMapMemory(state.allocator, staging_buffer_allocation, &upload_data);
-    memcpy(upload_data, raw_image->data, raw_image->data_size);
-    vmaUnmapMemory(state.allocator, staging_buffer_allocation);
+    // Levels copied from source are written on the graphics queue, which owns source, so the image stays a
+    // transfer destination until they are in
+    VkImageLayout handoff_layout = copied_levels > 0 ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    VkBufferImageCopy image_copy_region = {0};
-    image_copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    image_copy_region.imageSubresource.mipLevel = 0;
-    image_copy_region.imageSubresource.baseArrayLayer = 0;
-    image_copy_region.imageSubresource.layerCount = 1;
-    image_copy_region.imageExtent.width = image->width;
-    image_copy_region.imageExtent.height = image->height;
-    image_copy_region.imageExtent.depth = 1;
+    if (state.transfer_family != state.graphics_family)
+    {
+        // Queue family ownership transfer: the same barrier is released on the transfer queue and acquired on graphics
+        VkImageMemoryBarrier handoff = {0};
+        handoff.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        handoff.srcQueueFamilyIndex = state.transfer_family;
+        handoff.dstQueueFamilyIndex = state.graphics_family;
+        handoff.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        handoff.newLayout = handoff_layout;
+        handoff.image = image->image;
+        handoff.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        handoff.subresourceRange.levelCount = image->mip_levels;
+        handoff.subresourceRange.layerCount = 1;
+
+        handoff.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        handoff.dstAccessMask = 0;
+        vkCmdPipelineBarrier(copy.buf, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0, NULL, 1, &handoff);
+
+        handoff.srcAccessMask = 0;
+        handoff.dstAccessMask = copied_levels > 0 ? VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(finish.buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, copied_levels > 0 ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &handoff);
+    }
+    else if (copied_levels == 0)
+    {
+        rhi_cmd_img_transition_layout(&finish, image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0);
+    }
 
-    RHI_CommandBuffer temp;
-    rhi_init_upload_cmd_buf(&temp);
-    rhi_begin_cmd_buf(&temp);
-    rhi_cmd_img_transition_layout(&temp, image, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
-    vkCmdCopyBufferToImage(temp.buf, staging_buffer, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &image_copy_region);
-    if (!gen_mips) rhi_cmd_img_transition_layout(&temp, image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0);
-    rhi_end_cmd_buf(&temp);
-    rhi_submit_upload_cmd_buf(&temp);
+    if (copied_levels > 0)
+    {
+        // source is still sampled by frames in flight, it goes back to being shader readable right after
+        u32 source_first = source->mip_levels - copied_levels;
+        rhi_cmd_img_transition_layout(&finish, source, VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0);
 
-    vmaDestroyBuffer(state.allocator, staging_buffer, staging_buffer_allocation);
+        VkImageCopy level_copies[RHI_MAX_MIP_LEVELS];
+        memset(level_copies, 0, sizeof(level_copies));
+        for (u32 i = 0; i < copied_levels; i++)
+        {
+            VkImageCopy* region = &level_copies[i];
+            region->srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region->srcSubresource.mipLevel = source_first + i;
+            region->srcSubresource.layerCount = 1;
+            region->dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region->dstSubresource.mipLevel = staged_levels + i;
+            region->dstSubresource.layerCount = 1;
+            region->extent.width = max(image->width >> (staged_levels + i), 1);
+            region->extent.height = max(image->height >> (staged_levels + i), 1);
+            region->extent.depth = 1;
+        }
+        vkCmdCopyImage(finish.buf, source->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, copied_levels, level_copies);
+
+        rhi_cmd_img_transition_layout(&finish, source, VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0);
+        rhi_cmd_img_transition_layout(&finish, image, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0);
+    }
 
     VkImageViewCreateInfo view_info = { 0 };
     view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -1535,8 +2370,86 @@ void rhi_upload_image(RHI_Image* image, RHI_RawImage* raw_image, b32 gen_mips)
 
     res = vkCreateImageView(state.device, &view_info, NULL, &image->image_view);
     assert(res == VK_SUCCESS);
+}
+
+// The copy is recorded before the levels are written, which is fine as long as the batch isn't submitted
+// in between, and only rhi_upload_stage or a flush on this thread can do that
+void* rhi_stage_image(RHI_Image* image, RHI_RawImage* raw_image)
+{
+    VkBuffer staging_buffer;
+    u64 staging_offset;
+    void* staging_data = rhi_upload_stage(raw_image->data_size, &staging_buffer, &staging_offset);
+
+    rhi_record_image_upload(image, raw_image, staging_buffer, staging_offset, max(raw_image->mip_levels, 1), NULL);
+    return staging_data;
+}
+
+void rhi_allocate_staging(RHI_Staging* staging, u64 size)
+{
+    VkBufferCreateInfo staging_info = {0};
+    staging_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    staging_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    staging_info.size = max(size, 1);
+
+    VmaAllocationCreateInfo staging_alloc_info = {0};
+    staging_alloc_info.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+    staging_alloc_info.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+    VmaAllocationInfo allocation_info = {0};
+    vk_check(vmaCreateBuffer(state.allocator, &staging_info, &staging_alloc_info, &staging->buffer, &staging->allocation, &allocation_info));
+    staging->data = allocation_info.pMappedData;
+    staging->size = size;
+}
+
+void rhi_free_staging(RHI_Staging* staging)
+{
+    vmaDestroyBuffer(state.allocator, staging->buffer, staging->allocation);
+    memset(staging, 0, sizeof(RHI_Staging));
+}
+
+void rhi_upload_image_levels(RHI_Image* image, RHI_RawImage* raw_image, RHI_Staging* staging, u32 staged_levels, RHI_Image* source)
+{
+    if (staging && staging->buffer != VK_NULL_HANDLE)
+    {
+        rhi_upload_own_staging(staging->buffer, staging->allocation);
+        rhi_record_image_upload(image, raw_image, staging->buffer, 0, staged_levels, source);
+        memset(staging, 0, sizeof(RHI_Staging));
+    }
+    else
+    {
+        assert(staged_levels == 0);
+        rhi_record_image_upload(image, raw_image, VK_NULL_HANDLE, 0, 0, source);
+    }
+}
 
-    if (gen_mips) rhi_generate_mipmaps(image);
+void rhi_begin_upload_batch()
+{
+    assert(!state.upload.open);
+    state.upload.open = 1;
+}
+
+void rhi_end_upload_batch()
+{
+    assert(state.upload.open);
+    state.upload.open = 0;
+    rhi_upload_submit();
+}
+
+void rhi_flush_uploads()
+{
+    rhi_upload_submit();
+}
+
+u64 rhi_upload_ticket()
+{
+    return state.upload.submitted_value + (state.upload.recording ? 1 : 0);
+}
+
+b32 rhi_upload_done(u64 ticket)
+{
+    u64 completed = 0;
+    vkGetSemaphoreCounterValue(state.device, state.upload.finish_semaphore, &completed);
+    return completed >= ticket;
 }
 
 void rhi_free_image(RHI_Image* image)
@@ -1558,43 +2471,73 @@ void rhi_resize_image(RHI_Image* image, i32 width, i32 height)
 
 void rhi_init_descriptor_heap(RHI_DescriptorHeap* heap, u32 type, u32 size)
 {
+    assert(size > 0 && size <= state.heap_capacity[type]);
+
     memset(heap, 0, sizeof(RHI_DescriptorHeap));
-    heap->heap_handle = malloc(sizeof(b32) * size);
-    memset(heap->heap_handle, 0, sizeof(b32) * size);
     heap->type = type;
     heap->used = 0;
     heap->size = size;
 
+    // Lowest index on top, so the first allocations of a fresh heap come out as 0, 1, 2...
+    heap->free_list = malloc(sizeof(u32) * size);
+    for (u32 i = 0; i < size; i++)
+        heap->free_list[i] = size - 1 - i;
+    heap->free_count = size;
+
+    heap->retired = malloc(sizeof(u32) * size);
+    heap->retired_frames = malloc(sizeof(u64) * size);
+
+    u32 counts[FRAMES_IN_FLIGHT];
+    VkDescriptorSetLayout layouts[FRAMES_IN_FLIGHT];
+    for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++)
+    {
+        counts[i] = size;
+        layouts[i] = type == DESCRIPTOR_HEAP_IMAGE ? state.image_heap_layout : state.sampler_heap_layout;
+    }
+
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variable_count_info = {0};
+    variable_count_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO;
+    variable_count_info.descriptorSetCount = FRAMES_IN_FLIGHT;
+    variable_count_info.pDescriptorCounts = counts;
+
     VkDescriptorSetAllocateInfo descriptor_set_info = {0};
     descriptor_set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    descriptor_set_info.descriptorSetCount = 1;
-    descriptor_set_info.descriptorPool = state.descriptor_pool;
-    descriptor_set_info.pSetLayouts = type == DESCRIPTOR_HEAP_IMAGE ? &state.image_heap_layout : &state.sampler_heap_layout;
+    descriptor_set_info.pNext = &variable_count_info;
+    descriptor_set_info.descriptorSetCount = FRAMES_IN_FLIGHT;
+    descriptor_set_info.descriptorPool = state.heap_pool;
+    descriptor_set_info.pSetLayouts = layouts;
 
-    VkResult res = vkAllocateDescriptorSets(state.device, &descriptor_set_info, &heap->set);
+    VkResult res = vkAllocateDescriptorSets(state.device, &descriptor_set_info, heap->sets);
     vk_check(res);
 }
 
+u32 rhi_get_descriptor_heap_capacity(u32 type)
+{
+    return state.heap_capacity[type];
+}
+
 i32 rhi_find_available_descriptor(RHI_DescriptorHeap* heap)
 {
-    for (i32 i = 0; i < heap->size; i++)
+    // Frees are queued in frame order, so only the front needs checking
+    while (heap->retired_count > 0 && heap->retired_frames[heap->retired_first] <= state.completed_frame)
     {
-        if (heap->heap_handle[i] == 0)
-        {
-            heap->heap_handle[i] = 1;
-            heap->used++;
-            return i;
-        }
+        heap->free_list[heap->free_count++] = heap->retired[heap->retired_first];
+        heap->retired_first = (heap->retired_first + 1) % heap->size;
+        heap->retired_count--;
     }
 
-    return -1;
+    if (heap->free_count == 0)
+        return -1;
+
+    heap->used++;
+    return (i32)heap->free_list[--heap->free_count];
 }
 
-void rhi_push_descriptor_heap_image(RHI_DescriptorHeap* heap, RHI_Image* image, i32 binding)
+internal void rhi_write_descriptor_heap_image(RHI_DescriptorHeap* heap, u32 set, VkImageView image_view, VkImageLayout image_layout, i32 binding)
 {
     VkDescriptorImageInfo image_info = {0};
-    image_info.imageLayout = image->image_layout;
-    image_info.imageView = image->image_view;
+    image_info.imageLayout = image_layout;
+    image_info.imageView = image_view;
     image_info.sampler = VK_NULL_HANDLE;
 
     VkWriteDescriptorSet write = {0};
@@ -1603,12 +2546,64 @@ void rhi_push_descriptor_heap_image(RHI_DescriptorHeap* heap, RHI_Image* image,
     write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
     write.dstArrayElement = binding;
     write.dstBinding = 0;
-    write.dstSet = heap->set;
+    write.dstSet = heap->sets[set];
     write.pImageInfo = &image_info;
 
     vkUpdateDescriptorSets(state.device, 1, &write, 0, NULL);
 }
 
+void rhi_push_descriptor_heap_image(RHI_DescriptorHeap* heap, RHI_Image* image, i32 binding)
+{
+    for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++)
+        rhi_write_descriptor_heap_image(heap, i, image->image_view, image->image_layout, binding);
+}
+
+void rhi_replace_descriptor_heap_image(RHI_DescriptorHeap* heap, RHI_Image* image, i32 binding, RHI_Image* replaced)
+{
+    if (heap->rewrite_count == heap->rewrite_capacity)
+    {
+        heap->rewrite_capacity = max(heap->rewrite_capacity * 2, 64);
+        heap->rewrites = realloc(heap->rewrites, heap->rewrite_capacity * sizeof(RHI_DescriptorRewrite));
+    }
+
+    RHI_DescriptorRewrite* rewrite = &heap->rewrites[heap->rewrite_count++];
+    rewrite->binding = binding;
+    rewrite->image_view = image->image_view;
+    rewrite->image_layout = image->image_layout;
+    rewrite->pending_sets = (1u << FRAMES_IN_FLIGHT) - 1;
+    rewrite->replaced = *replaced;
+    rewrite->retire_frame = 0;
+}
+
+// The copy bound this frame belongs to the swap chain image whose fence rhi_begin waited on, nothing in flight
+// reads it anymore
+internal void rhi_apply_descriptor_rewrites(RHI_DescriptorHeap* heap)
+{
+    u32 set = state.image_index;
+    u32 kept = 0;
+
+    for (u32 i = 0; i < heap->rewrite_count; i++)
+    {
+        RHI_DescriptorRewrite* rewrite = &heap->rewrites[i];
+        if (rewrite->pending_sets & (1u << set))
+        {
+            rhi_write_descriptor_heap_image(heap, set, rewrite->image_view, rewrite->image_layout, rewrite->binding);
+            rewrite->pending_sets &= ~(1u << set);
+            if (!rewrite->pending_sets)
+                rewrite->retire_frame = state.frame_number;
+        }
+
+        if (!rewrite->pending_sets && rewrite->retire_frame <= state.completed_frame + 1)
+        {
+            rhi_free_image(&rewrite->replaced);
+            continue;
+        }
+        heap->rewrites[kept++] = *rewrite;
+    }
+
+    heap->rewrite_count = kept;
+}
+
 void rhi_push_descriptor_heap_sampler(RHI_DescriptorHeap* heap, RHI_Sampler* sampler, i32 binding)
 {
     VkDescriptorImageInfo image_info = {0};
@@ -1622,22 +2617,47 @@ void rhi_push_descriptor_heap_sampler(RHI_DescriptorHeap* heap, RHI_Sampler* sam
     write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
     write.dstArrayElement = binding;
     write.dstBinding = 0;
-    write.dstSet = heap->set;
     write.pImageInfo = &image_info;
 
-    vkUpdateDescriptorSets(state.device, 1, &write, 0, NULL);
+    for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++)
+    {
+        write.dstSet = heap->sets[i];
+        vkUpdateDescriptorSets(state.device, 1, &write, 0, NULL);
+    }
 }
 
 void rhi_free_descriptor(RHI_DescriptorHeap* heap, u32 descriptor)
 {
-    heap->heap_handle[descriptor] = 0;
+    assert(descriptor < heap->size && heap->retired_count < heap->size);
+
+    u32 slot = (heap->retired_first + heap->retired_count) % heap->size;
+    heap->retired[slot] = descriptor;
+    heap->retired_frames[slot] = state.frame_number;
+    heap->retired_count++;
     heap->used--;
+
+    // The slot is going away, rewrites still queued for it must not land on whoever gets it next
+    for (u32 i = 0; i < heap->rewrite_count; i++)
+    {
+        RHI_DescriptorRewrite* rewrite = &heap->rewrites[i];
+        if (rewrite->binding == descriptor && rewrite->pending_sets)
+        {
+            rewrite->pending_sets = 0;
+            rewrite->retire_frame = state.frame_number + 1;
+        }
+    }
 }
 
 void rhi_free_descriptor_heap(RHI_DescriptorHeap* heap)
 {
-    vkFreeDescriptorSets(state.device, state.descriptor_pool, 1, &heap->set);
-    free(heap->heap_handle);
+    for (u32 i = 0; i < heap->rewrite_count; i++)
+        rhi_free_image(&heap->rewrites[i].replaced);
+    free(heap->rewrites);
+
+    vkFreeDescriptorSets(state.device, state.heap_pool, FRAMES_IN_FLIGHT, heap->sets);
+    free(heap->retired_frames);
+    free(heap->retired);
+    free(heap->free_list);
 }
 
 void rhi_init_cmd_buf(RHI_CommandBuffer* buf, u32 command_buffer_type)
@@ -1677,6 +2697,12 @@ void rhi_submit_cmd_buf(RHI_CommandBuffer* buf)
 {   
     rhi_end_cmd_buf(buf);
 
+    // Uploads finish on the graphics queue, only submission order covers them there
+    if (buf->command_buffer_type == COMMAND_BUFFER_COMPUTE)
+        rhi_upload_drain();
+    else
+        rhi_upload_submit();
+
     VkQueue submit_queue = buf->command_buffer_type == COMMAND_BUFFER_GRAPHICS ? state.graphics_queue : state.compute_queue;
 
     VkSubmitInfo submit_info = { 0 };
@@ -1700,6 +2726,8 @@ void rhi_submit_cmd_buf(RHI_CommandBuffer* buf)
 
 void rhi_submit_upload_cmd_buf(RHI_CommandBuffer* buf)
 {
+    rhi_upload_submit();
+
     VkSubmitInfo submit_info = { 0 };
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.commandBufferCount = 1;
@@ -1748,6 +2776,7 @@ void rhi_cmd_set_viewport(RHI_CommandBuffer* buf, u32 width, u32 height)
 
 void rhi_cmd_set_pipeline(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline)
 {
+    rhi_wait_pipeline(pipeline);
     vkCmdBindPipeline(buf->buf, pipeline->bind_point, pipeline->pipeline);
 }
 
@@ -1766,7 +2795,9 @@ void rhi_cmd_set_index_buffer(RHI_CommandBuffer* buf, RHI_Buffer* buffer)
 
 void rhi_cmd_set_descriptor_heap(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, RHI_DescriptorHeap* heap, i32 binding)
 {
-    vkCmdBindDescriptorSets(buf->buf, pipeline->bind_point, pipeline->pipeline_layout, binding, 1, &heap->set, 0, NULL);
+    if (heap->rewrite_count > 0)
+        rhi_apply_descriptor_rewrites(heap);
+    vkCmdBindDescriptorSets(buf->buf, pipeline->bind_point, pipeline->pipeline_layout, binding, 1, &heap->sets[state.image_index], 0, NULL);
 }
 
 void rhi_cmd_set_descriptor_set(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, RHI_DescriptorSet* set, i32 binding)
@@ -1774,6 +2805,11 @@ void rhi_cmd_set_descriptor_set(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline,
     vkCmdBindDescriptorSets(buf->buf, pipeline->bind_point, pipeline->pipeline_layout, binding, 1, &set->set, 0, NULL);
 }
 
+void rhi_cmd_set_descriptor_set_offset(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, RHI_DescriptorSet* set, i32 binding, u32 offset)
+{
+    vkCmdBindDescriptorSets(buf->buf, pipeline->bind_point, pipeline->pipeline_layout, binding, 1, &set->set, 1, &offset);
+}
+
 void rhi_cmd_set_push_constants(RHI_CommandBuffer* buf, RHI_Pipeline* pipeline, void* data, u32 size)
 {
     vkCmdPushConstants(buf->buf, pipeline->pipeline_layout, VK_SHADER_STAGE_ALL, 0, size, data);
@@ -143,17 +143,14 @@ u32 vk_get_format_size(VkFormat format)
     return 0;
 }
 
-u32 vk_get_memory_usage(VkBufferUsageFlagBits flags)
+u32 vk_get_memory_usage(u32 buffer_usage)
 {
-    VkBufferUsageFlagBits vertex = BUFFER_VERTEX;
-    VkBufferUsageFlagBits index = BUFFER_INDEX;
-    VkBufferUsageFlagBits uniform = BUFFER_UNIFORM;
-
-    if (flags == vertex)
-        return VMA_MEMORY_USAGE_CPU_TO_GPU;
-    if (flags == index)
+    if (buffer_usage & BUFFER_DYNAMIC)
         return VMA_MEMORY_USAGE_CPU_TO_GPU;
-    if (flags == uniform)
-        return VMA_MEMORY_USAGE_CPU_ONLY;
-    return 0;
+    return VMA_MEMORY_USAGE_GPU_ONLY;
+}
+
+b32 vk_is_block_compressed(VkFormat format)
+{
+    return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
 }
\ No newline at end of file
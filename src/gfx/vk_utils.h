@@ -6,6 +6,7 @@
 
 u32 vk_get_image_aspect(u32 format);
 u32 vk_get_format_size(VkFormat format);
-u32 vk_get_memory_usage(VkBufferUsageFlagBits flags);
+u32 vk_get_memory_usage(u32 buffer_usage);
+b32 vk_is_block_compressed(VkFormat format);
 
 #endif
\ No newline at end of file
@@ -1,14 +1,22 @@
 #include "mesh.h"
+#include "meshlet.h"
+#include "vertex_cache.h"
+#include "simplify.h"
+#include "texture.h"
+#include "texture_mips.h"
 
 #include <core/platform_layer.h>
+#include <core/job_system.h>
 
 #include <cgltf.h>
 
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <limits.h>
 #include <float.h>
+#include <math.h>
 
 #define cgltf_call(call) do { cgltf_result _result = (call); assert(_result == cgltf_result_success); } while(0)
 
@@ -17,42 +25,44 @@ internal RHI_DescriptorHeap* s_sampler_heap;
 internal RHI_DescriptorSetLayout s_descriptor_set_layout;
 internal RHI_DescriptorSetLayout s_meshlet_set_layout;
 
-typedef struct aabb aabb;
-struct aabb
+// Texture cache: one decode, image and image heap slot per file, shared by every material of every mesh
+// that references it. Acquired from loader jobs, uploaded and released on the thread owning the RHI.
+typedef struct mesh_texture mesh_texture;
+struct mesh_texture
 {
-    hmm_vec3 min;
-    hmm_vec3 max;
+    char path[512];
+    u64 path_hash;
+    u32 role;
+    u32 refs;
+
+    // Loaded once by the first request that references the file, the others wait on it. Usually only the
+    // layout, the levels are read from the file whenever they are uploaded. When streaming, the decode job
+    // reads a small enough tail into tail so its upload doesn't touch the file.
+    TextureSource source;
+    void* tail;
+    JobCounter decoded;
+
+    RHI_Image image;
+    i32 bindless_index;
+
+    // The image holds levels [resident_level, mip_levels), the source has all of them. The slot is
+    // repointed when residency changes, so materials never see the index move.
+    u32 mip_levels;
+    u32 resident_level;
+    u32 tail_level;
+    // Largest screen size anything drawn with the texture had in the last recorded frame, 0 when unused
+    f32 requested_pixels;
+
+    // Levels [stream_level, resident_level) being read into stream_staging by a job. The texture is left out of
+    // streaming decisions until mesh_texture_stream picks the read up, and its slot isn't reused before that.
+    b32 streaming;
+    u32 stream_level;
+    RHI_Staging stream_staging;
+    JobCounter streamed;
 };
 
-typedef struct meshlet_vector meshlet_vector;
-struct meshlet_vector
-{
-    Meshlet* meshlets;
-    u32 used;
-    u32 size;
-};
-
-void init_meshlet_vector(meshlet_vector* vec, u32 start_size)
-{
-    vec->meshlets = calloc(start_size, sizeof(Meshlet));
-    vec->size = start_size;
-    vec->used = 0;
-}
-
-void free_meshlet_vector(meshlet_vector* vec)
-{
-    free(vec->meshlets);
-}
-
-void push_meshlet(meshlet_vector* vec, Meshlet m)
-{
-    if (vec->used >= vec->size)
-    {
-        vec->size *= 2;
-        vec->meshlets = realloc(vec->meshlets, vec->size * sizeof(Meshlet));
-    }
-    vec->meshlets[vec->used++] = m;
-}
+internal mesh_texture s_textures[MESH_MAX_TEXTURES];
+internal Mutex* s_texture_lock;
 
 void mesh_loader_init(i32 dset_layout_binding)
 {
@@ -62,14 +72,13 @@ void mesh_loader_init(i32 dset_layout_binding)
 
     s_meshlet_set_layout.descriptors[0] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     s_meshlet_set_layout.descriptors[1] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    s_meshlet_set_layout.descriptor_count = 2;
+    s_meshlet_set_layout.descriptors[2] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    s_meshlet_set_layout.descriptors[3] = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    s_meshlet_set_layout.descriptor_count = 4;
     rhi_init_descriptor_set_layout(&s_meshlet_set_layout);
-}
 
-void mesh_loader_free()
-{
-    rhi_free_descriptor_set_layout(&s_meshlet_set_layout);
-    rhi_free_descriptor_set_layout(&s_descriptor_set_layout);
+    s_texture_lock = aurora_platform_new_mutex(0);
+    texture_mips_init();
 }
 
 RHI_DescriptorSetLayout* mesh_loader_get_descriptor_set_layout()
@@ -135,38 +144,434 @@ void* cgltf_get_accessor_data(cgltf_accessor* accessor, u32* component_size, u32
     *component_count = cgltf_comp_count(accessor->type);
 
     cgltf_buffer_view* view = accessor->buffer_view;
-    return OFFSET_PTR_BYTES(void, view->buffer->data, view->offset);
+    return OFFSET_PTR_BYTES(void, view->buffer->data, view->offset + accessor->offset);
 }
 
-void mesh_load_albedo(Thread* thread)
+void mesh_texture_decode(void* data)
 {
-    GLTFMaterial* mat = (GLTFMaterial*)aurora_platform_get_thread_ptr(thread);
+    mesh_texture* texture = (mesh_texture*)data;
+
+    texture_load(&texture->source, texture->path, texture->role);
+
+    RHI_RawImage* raw = &texture->source.raw;
+    texture->mip_levels = max(raw->mip_levels, 1);
+    texture->tail_level = 0;
+    if (MESH_TEXTURE_STREAMING)
+    {
+        while (texture->tail_level + 1 < texture->mip_levels
+            && max(raw->width >> texture->tail_level, raw->height >> texture->tail_level) > MESH_TEXTURE_TAIL_SIZE)
+            texture->tail_level++;
+    }
+    texture->resident_level = texture->tail_level;
 
-    rhi_load_raw_image(&mat->raw_color, mat->albedo_path);
+    u64 size = raw->data_size - raw->mip_offsets[texture->resident_level];
+    if (MESH_TEXTURE_STREAMING && !raw->data && size <= MESH_TEXTURE_TAIL_READ_BYTES)
+    {
+        texture->tail = malloc(max(size, 1));
+        if (!texture_read_levels(&texture->source, texture->resident_level, texture->mip_levels - texture->resident_level, texture->tail))
+        {
+            printf("Failed to read texture levels from %s\n", texture->source.file);
+            memset(texture->tail, 0, size);
+        }
+    }
 }
 
-void mesh_load_normal(Thread* thread)
+// Returns a handle to the cached texture, the first reference to a file starts decoding it
+u32 mesh_texture_acquire(const char* path, u32 role)
 {
-    GLTFMaterial* mat = (GLTFMaterial*)aurora_platform_get_thread_ptr(thread);
+    u64 hash = fnv1a_64((const u8*)path, strlen(path), 0xcbf29ce484222325ull);
+    mesh_texture* texture = NULL;
 
-    rhi_load_raw_image(&mat->raw_normal, mat->normal_path);
+    aurora_platform_lock_mutex(s_texture_lock);
+    for (u32 i = 0; i < MESH_MAX_TEXTURES; i++)
+    {
+        mesh_texture* candidate = &s_textures[i];
+        if (candidate->refs > 0 && candidate->path_hash == hash && candidate->role == role && strcmp(candidate->path, path) == 0)
+        {
+            candidate->refs++;
+            aurora_platform_unlock_mutex(s_texture_lock);
+            return i + 1;
+        }
+        if (!texture && candidate->refs == 0 && !candidate->streaming)
+            texture = candidate;
+    }
+    assert(texture);
+
+    memset(texture, 0, sizeof(mesh_texture));
+    strncpy(texture->path, path, sizeof(texture->path) - 1);
+    texture->path_hash = hash;
+    texture->role = role;
+    texture->refs = 1;
+    texture->bindless_index = -1;
+
+    // Submitted under the lock so a second request never sees the entry before its counter is raised
+    if (MULTITHREADING_ENABLED)
+        job_submit(mesh_texture_decode, texture, &texture->decoded);
+    else
+        mesh_texture_decode(texture);
+    aurora_platform_unlock_mutex(s_texture_lock);
+
+    return (u32)(texture - s_textures) + 1;
+}
+
+void mesh_texture_wait(u32 handle)
+{
+    if (handle)
+        job_wait(&s_textures[handle - 1].decoded);
+}
+
+internal u64 mesh_texture_level_bytes(mesh_texture* texture, u32 level)
+{
+    u64 end = level + 1 < texture->mip_levels ? texture->source.raw.mip_offsets[level + 1] : texture->source.raw.data_size;
+    return end - texture->source.raw.mip_offsets[level];
 }
 
-void mesh_load_pbr(Thread* thread)
+internal u64 mesh_texture_resident_bytes(mesh_texture* texture, u32 first_level)
 {
-    GLTFMaterial* mat = (GLTFMaterial*)aurora_platform_get_thread_ptr(thread);
+    return texture->source.raw.data_size - texture->source.raw.mip_offsets[first_level];
+}
 
-    rhi_load_raw_image(&mat->raw_pbr, mat->mr_path);
+// Screen pixels per texel across if level were the largest one resident, > 1 means it's stretched
+internal f32 mesh_texture_level_value(mesh_texture* texture, u32 level)
+{
+    u32 size = max(max(texture->source.raw.width >> level, texture->source.raw.height >> level), 1);
+    return texture->requested_pixels / (f32)size;
 }
 
-void cgltf_process_primitive(cgltf_primitive* cgltf_primitive, u32* primitive_index, Mesh* m, hmm_mat4 transform)
+// Layout of levels [first_level, mip_levels) packed on their own, largest first
+internal RHI_RawImage mesh_texture_levels(mesh_texture* texture, u32 first_level)
 {
-    Primitive* pri = &m->primitives[(*primitive_index)++];
-    pri->transform = transform;
+    RHI_RawImage* raw = &texture->source.raw;
+    u64 skipped = raw->mip_offsets[first_level];
+
+    RHI_RawImage levels = *raw;
+    levels.width = max(raw->width >> first_level, 1);
+    levels.height = max(raw->height >> first_level, 1);
+    levels.data = NULL;
+    levels.data_size = raw->data_size - skipped;
+    levels.mip_levels = texture->mip_levels - first_level;
+    for (u32 i = 0; i < levels.mip_levels; i++)
+        levels.mip_offsets[i] = raw->mip_offsets[first_level + i] - skipped;
+    return levels;
+}
+
+// New image holding levels [first_level, mip_levels). Only the levels larger than the resident ones are taken
+// from staging, the others are copied on the GPU from the current image, which the caller hands over for replacement.
+internal void mesh_texture_change_levels(mesh_texture* texture, RHI_Image* image, u32 first_level, RHI_Staging* staging)
+{
+    RHI_Image current = *image;
+    RHI_RawImage levels = mesh_texture_levels(texture, first_level);
+    u32 staged_levels = first_level < texture->resident_level ? texture->resident_level - first_level : 0;
+
+    rhi_upload_image_levels(image, &levels, staging, staged_levels, &current);
+}
+
+void mesh_texture_read(void* data)
+{
+    mesh_texture* texture = (mesh_texture*)data;
+
+    if (!texture_read_levels(&texture->source, texture->stream_level, texture->resident_level - texture->stream_level, texture->stream_staging.data))
+    {
+        printf("Failed to read texture levels from %s\n", texture->source.file);
+        memset(texture->stream_staging.data, 0, texture->stream_staging.size);
+    }
+}
+
+// Uploads on first use and returns the texture's image heap slot
+i32 mesh_texture_upload(u32 handle)
+{
+    mesh_texture* texture = &s_textures[handle - 1];
+
+    if (texture->image.image == VK_NULL_HANDLE)
+    {
+        RHI_RawImage levels = mesh_texture_levels(texture, texture->resident_level);
+        void* staging = rhi_stage_image(&texture->image, &levels);
+        if (texture->tail)
+        {
+            memcpy(staging, texture->tail, levels.data_size);
+        }
+        else if (!texture_read_levels(&texture->source, texture->resident_level, levels.mip_levels, staging))
+        {
+            printf("Failed to read texture levels from %s\n", texture->source.file);
+            memset(staging, 0, levels.data_size);
+        }
+
+        free(texture->tail);
+        texture->tail = NULL;
+        if (!MESH_TEXTURE_STREAMING)
+            texture_free(&texture->source);
+
+        texture->bindless_index = rhi_find_available_descriptor(s_image_heap);
+        rhi_push_descriptor_heap_image(s_image_heap, &texture->image, texture->bindless_index);
+    }
+    return texture->bindless_index;
+}
+
+internal void mesh_texture_request(u32 handle, f32 pixels)
+{
+    if (handle)
+        s_textures[handle - 1].requested_pixels = max(s_textures[handle - 1].requested_pixels, pixels);
+}
+
+void mesh_request_material_textures(GLTFMaterial* material, f32 pixels)
+{
+    mesh_texture_request(material->albedo_texture, pixels);
+    mesh_texture_request(material->normal_texture, pixels);
+    mesh_texture_request(material->metallic_roughness_texture, pixels);
+}
+
+// Swaps in the levels whose reads have finished, then moves textures towards the levels last frame asked for.
+// Planned on target levels first, so a texture moving several levels is rebuilt once. Dropped levels are
+// applied right away, larger ones are read on the job system and applied by a later call.
+internal void mesh_texture_stream()
+{
+    if (!MESH_TEXTURE_STREAMING)
+        return;
+
+    aurora_platform_lock_mutex(s_texture_lock);
+
+    u32 targets[MESH_MAX_TEXTURES];
+    u64 resident = 0;
+    u64 streamed = 0;
+    for (u32 i = 0; i < MESH_MAX_TEXTURES; i++)
+    {
+        mesh_texture* texture = &s_textures[i];
+        if (texture->streaming && job_done(&texture->streamed))
+        {
+            texture->streaming = 0;
+            if (texture->refs == 0)
+            {
+                // Released while its read was in flight
+                rhi_free_staging(&texture->stream_staging);
+                texture_free(&texture->source);
+                memset(texture, 0, sizeof(mesh_texture));
+            }
+            else
+            {
+                RHI_Image replaced = texture->image;
+                mesh_texture_change_levels(texture, &texture->image, texture->stream_level, &texture->stream_staging);
+                rhi_replace_descriptor_heap_image(s_image_heap, &texture->image, texture->bindless_index, &replaced);
+                texture->resident_level = texture->stream_level;
+            }
+        }
+
+        targets[i] = texture->resident_level;
+        if (texture->refs > 0 && texture->image.image != VK_NULL_HANDLE)
+            resident += mesh_texture_resident_bytes(texture, texture->resident_level);
+        if (texture->streaming)
+        {
+            resident += texture->stream_staging.size;
+            streamed += texture->stream_staging.size;
+        }
+    }
+
+    for (;;)
+    {
+        // Most stretched texture first, it gets one level larger per pass
+        i32 best = -1;
+        f32 best_value = 1.0f;
+        for (u32 i = 0; i < MESH_MAX_TEXTURES; i++)
+        {
+            mesh_texture* texture = &s_textures[i];
+            if (texture->refs == 0 || texture->image.image == VK_NULL_HANDLE || texture->streaming || targets[i] == 0)
+                continue;
+
+            f32 value = mesh_texture_level_value(texture, targets[i]);
+            if (value > best_value)
+            {
+                best = i;
+                best_value = value;
+            }
+        }
+        if (best < 0)
+            break;
+
+        // Bytes still being read count against this frame's share
+        mesh_texture* texture = &s_textures[best];
+        u64 bytes = mesh_texture_level_bytes(texture, targets[best] - 1);
+        if (streamed > 0 && streamed + bytes > MESH_TEXTURE_STREAM_BYTES_PER_FRAME)
+            break;
+
+        // Make room by dropping the top level of whatever is stretched far less. The factor of 4 keeps a
+        // dropped level from winning its place back from the one that replaced it.
+        while (resident + bytes > MESH_TEXTURE_BUDGET)
+        {
+            i32 victim = -1;
+            f32 victim_value = best_value * 0.25f;
+            for (u32 i = 0; i < MESH_MAX_TEXTURES; i++)
+            {
+                mesh_texture* candidate = &s_textures[i];
+                if ((i32)i == best || candidate->refs == 0 || candidate->image.image == VK_NULL_HANDLE || candidate->streaming || targets[i] >= candidate->tail_level)
+                    continue;
+
+                f32 value = mesh_texture_level_value(candidate, targets[i]);
+                if (value < victim_value)
+                {
+                    victim = i;
+                    victim_value = value;
+                }
+            }
+            if (victim < 0)
+                break;
+
+            resident -= mesh_texture_level_bytes(&s_textures[victim], targets[victim]);
+            targets[victim]++;
+        }
+        if (resident + bytes > MESH_TEXTURE_BUDGET)
+            break;
+
+        resident += bytes;
+        streamed += bytes;
+        targets[best]--;
+    }
+
+    u32 reads[MESH_MAX_TEXTURES];
+    u32 read_count = 0;
+    for (u32 i = 0; i < MESH_MAX_TEXTURES; i++)
+    {
+        mesh_texture* texture = &s_textures[i];
+        texture->requested_pixels = 0.0f;
+        if (texture->refs == 0 || texture->image.image == VK_NULL_HANDLE || texture->streaming || targets[i] == texture->resident_level)
+            continue;
+
+        if (targets[i] > texture->resident_level)
+        {
+            RHI_Image replaced = texture->image;
+            mesh_texture_change_levels(texture, &texture->image, targets[i], NULL);
+            rhi_replace_descriptor_heap_image(s_image_heap, &texture->image, texture->bindless_index, &replaced);
+            texture->resident_level = targets[i];
+            continue;
+        }
+
+        texture->streaming = 1;
+        texture->stream_level = targets[i];
+        rhi_allocate_staging(&texture->stream_staging, texture->source.raw.mip_offsets[texture->resident_level] - texture->source.raw.mip_offsets[targets[i]]);
+        reads[read_count++] = i;
+    }
+
+    aurora_platform_unlock_mutex(s_texture_lock);
+
+    // Only this thread picks reads up or releases textures, nothing touches the entries before they're submitted
+    for (u32 i = 0; i < read_count; i++)
+    {
+        mesh_texture* texture = &s_textures[reads[i]];
+        if (MULTITHREADING_ENABLED)
+            job_submit(mesh_texture_read, texture, &texture->streamed);
+        else
+            mesh_texture_read(texture);
+    }
+}
 
-    if (cgltf_primitive->type != cgltf_primitive_type_triangles)
+void mesh_texture_release(u32 handle)
+{
+    if (!handle)
         return;
 
+    mesh_texture* texture = &s_textures[handle - 1];
+    // Outside the lock, job_wait may run a loader job that acquires textures
+    job_wait(&texture->decoded);
+
+    aurora_platform_lock_mutex(s_texture_lock);
+    assert(texture->refs > 0);
+    if (--texture->refs == 0)
+    {
+        if (texture->image.image != VK_NULL_HANDLE)
+        {
+            rhi_free_image(&texture->image);
+            rhi_free_descriptor(s_image_heap, texture->bindless_index);
+        }
+        free(texture->tail);
+        texture->tail = NULL;
+
+        // A read in flight still uses the source and staging, mesh_texture_stream frees them once it's done
+        if (!texture->streaming)
+        {
+            texture_free(&texture->source);
+            memset(texture, 0, sizeof(mesh_texture));
+        }
+    }
+    aurora_platform_unlock_mutex(s_texture_lock);
+}
+
+typedef struct temp_mat temp_mat;
+struct temp_mat
+{
+    i32 albedo_idx;
+    i32 normal_idx;
+    i32 mr_idx;
+    i32 sampler_idx;
+    hmm_vec3 bc_factor;
+    f32 m_factor;
+    f32 r_factor;
+    hmm_vec3 pad;
+};
+
+// CPU side of a primitive, filled on a worker and consumed by the upload stage
+typedef struct primitive_build primitive_build;
+struct primitive_build
+{
+    cgltf_primitive* source;
+    Primitive* primitive;
+
+    Vertex* vertices;
+    GPUVertex* gpu_vertices;
+    u32* indices;
+    u32 vertex_count;
+    u32 index_count;
+
+    MeshletData lods[MESH_MAX_LODS];
+    f32 lod_errors[MESH_MAX_LODS];
+    u32 lod_index_counts[MESH_MAX_LODS];
+    u32 lod_count;
+
+    VertexCacheStats cache_before;
+    VertexCacheStats cache_after;
+
+    // Arrays point into a mapped mesh cache instead of being owned
+    b32 cooked;
+};
+
+typedef struct mesh_build mesh_build;
+struct mesh_build
+{
+    Mesh* mesh;
+    cgltf_data* data;
+
+    primitive_build* primitives;
+    u32 primitive_count;
+
+    // glTF material index -> Mesh material index, materials shared by several primitives are decoded once
+    i32* material_remap;
+};
+
+// Everything a load carries from the thread preparing it to the one uploading it
+typedef struct mesh_load_job mesh_load_job;
+struct mesh_load_job
+{
+    Mesh* mesh;
+    char path[512];
+    mesh_build build;
+
+    // Set on a cache hit, the builds point into it
+    u8* blob;
+    u64 blob_size;
+};
+
+typedef struct mesh_load_request mesh_load_request;
+struct mesh_load_request
+{
+    mesh_load_job job;
+    JobCounter counter;
+    u32 generation;
+    b32 active;
+};
+
+internal mesh_load_request s_requests[MESH_MAX_ASYNC_LOADS];
+
+void cgltf_unpack_primitive(primitive_build* build)
+{
+    cgltf_primitive* cgltf_primitive = build->source;
+
     cgltf_attribute* position_attribute = 0;
     cgltf_attribute* texcoord_attribute = 0;
     cgltf_attribute* normal_attribute = 0;
@@ -183,22 +588,21 @@ void cgltf_process_primitive(cgltf_primitive* cgltf_primitive, u32* primitive_in
     assert(position_attribute && texcoord_attribute && normal_attribute);
 
     u32 vertex_count = (u32)normal_attribute->data->count;
-    u64 vertices_size = vertex_count * sizeof(Vertex);
-    Vertex* vertices = (Vertex*)malloc(vertices_size);
-    memset(vertices, 0, sizeof(vertices));
+    Vertex* vertices = (Vertex*)calloc(vertex_count, sizeof(Vertex));
 
     {
         u32 component_size, component_count;
         f32* src = (f32*)cgltf_get_accessor_data(position_attribute->data, &component_size, &component_count);
         assert(component_size == 4);
+        u32 stride = (u32)(position_attribute->data->stride / component_size);
 
         if (src)
         {
             for (u32 vertex_index = 0; vertex_index < vertex_count; vertex_index++)
             {
-                vertices[vertex_index].position.X = src[vertex_index * component_count + 0];
-                vertices[vertex_index].position.Y = src[vertex_index * component_count + 1];
-                vertices[vertex_index].position.Z = src[vertex_index * component_count + 2];
+                vertices[vertex_index].position.X = src[vertex_index * stride + 0];
+                vertices[vertex_index].position.Y = src[vertex_index * stride + 1];
+                vertices[vertex_index].position.Z = src[vertex_index * stride + 2];
             }
         }
     }
@@ -207,13 +611,14 @@ void cgltf_process_primitive(cgltf_primitive* cgltf_primitive, u32* primitive_in
         u32 component_size, component_count;
         f32* src = (f32*)cgltf_get_accessor_data(texcoord_attribute->data, &component_size, &component_count);
         assert(component_size == 4);
+        u32 stride = (u32)(texcoord_attribute->data->stride / component_size);
 
         if (src)
         {
             for (u32 vertex_index = 0; vertex_index < vertex_count; vertex_index++)
             {
-                vertices[vertex_index].uv.X = src[vertex_index * component_count + 0];
-                vertices[vertex_index].uv.Y = src[vertex_index * component_count + 1];
+                vertices[vertex_index].uv.X = src[vertex_index * stride + 0];
+                vertices[vertex_index].uv.Y = src[vertex_index * stride + 1];
             }
         }
     }
@@ -222,276 +627,376 @@ void cgltf_process_primitive(cgltf_primitive* cgltf_primitive, u32* primitive_in
         u32 component_size, component_count;
         f32* src = (f32*)cgltf_get_accessor_data(normal_attribute->data, &component_size, &component_count);
         assert(component_size == 4);
+        u32 stride = (u32)(normal_attribute->data->stride / component_size);
 
         if (src)
         {
             for (u32 vertex_index = 0; vertex_index < vertex_count; vertex_index++)
             {
-                vertices[vertex_index].normals.X = src[vertex_index * component_count + 0];
-                vertices[vertex_index].normals.Y = src[vertex_index * component_count + 1];
-                vertices[vertex_index].normals.Z = src[vertex_index * component_count + 2];
+                vertices[vertex_index].normals.X = src[vertex_index * stride + 0];
+                vertices[vertex_index].normals.Y = src[vertex_index * stride + 1];
+                vertices[vertex_index].normals.Z = src[vertex_index * stride + 2];
             }
         }
     }
 
-    pri->index_count = (u32)cgltf_primitive->indices->count;
-    u32 index_size = pri->index_count * sizeof(u32);
-    u32* indices = (u32*)malloc(index_size);
-    memset(indices, 0, index_size);
+    u32 index_count = cgltf_primitive->indices ? (u32)cgltf_primitive->indices->count : vertex_count;
+    u32* indices = (u32*)malloc(index_count * sizeof(u32));
 
+    if (cgltf_primitive->indices != NULL)
     {
-        if (cgltf_primitive->indices != NULL)
-        {
-            for (u32 k = 0; k < (u32)cgltf_primitive->indices->count; k++)
-                indices[k] = (u32)(cgltf_accessor_read_index(cgltf_primitive->indices, k));
-        }
+        for (u32 k = 0; k < index_count; k++)
+            indices[k] = (u32)(cgltf_accessor_read_index(cgltf_primitive->indices, k));
+    }
+    else
+    {
+        for (u32 k = 0; k < index_count; k++)
+            indices[k] = k;
     }
 
-    rhi_allocate_buffer(&pri->vertex_buffer, vertices_size, BUFFER_VERTEX);
-    rhi_upload_buffer(&pri->vertex_buffer, vertices, vertices_size);
+    build->vertices = vertices;
+    build->vertex_count = vertex_count;
+    build->indices = indices;
+    build->index_count = index_count;
+}
 
-    rhi_allocate_buffer(&pri->index_buffer, index_size, BUFFER_INDEX);
-    rhi_upload_buffer(&pri->index_buffer, indices, index_size);
+// Round to nearest, denormals flush to zero
+u16 mesh_quantize_half(f32 v)
+{
+    union { f32 f; u32 u; } bits;
+    bits.f = v;
 
-    // MAKE MESHLETS
+    u32 sign = (bits.u >> 16) & 0x8000;
+    i32 magnitude = bits.u & 0x7fffffff;
 
-    meshlet_vector vec;
-    init_meshlet_vector(&vec, 256);
+    i32 half = (magnitude - (112 << 23) + (1 << 12)) >> 13;
+    if (magnitude < (113 << 23)) half = 0;
+    if (magnitude >= (143 << 23)) half = 0x7c00;
+    if (magnitude > (255 << 23)) half = 0x7e00;
 
-    u8* meshlet_vertices = (u8*)malloc(sizeof(u8) * vertex_count);
-    memset(meshlet_vertices, 0xff, sizeof(u8) * vertex_count);
+    return (u16)(sign | half);
+}
 
-    Meshlet ml;
-    memset(&ml, 0, sizeof(ml));
+i16 mesh_quantize_snorm16(f32 v)
+{
+    v = max(-1.0f, min(1.0f, v));
+    return (i16)(v * 32767.0f + (v >= 0.0f ? 0.5f : -0.5f));
+}
 
-    for (i64 i = 0; i < pri->index_count; i += 3)
+hmm_vec2 mesh_octahedral_encode(hmm_vec3 n)
+{
+    f32 l1 = fabsf(n.X) + fabsf(n.Y) + fabsf(n.Z);
+    if (l1 <= FLT_EPSILON)
+        return HMM_Vec2(0.0f, 0.0f);
+
+    hmm_vec2 p = HMM_Vec2(n.X / l1, n.Y / l1);
+    if (n.Z < 0.0f)
     {
-        u32 a = indices[i + 0];
-        u32 b = indices[i + 1];
-        u32 c = indices[i + 2];
+        f32 x = (1.0f - fabsf(p.Y)) * (p.X >= 0.0f ? 1.0f : -1.0f);
+        f32 y = (1.0f - fabsf(p.X)) * (p.Y >= 0.0f ? 1.0f : -1.0f);
+        p = HMM_Vec2(x, y);
+    }
+    return p;
+}
 
-        u8 av = meshlet_vertices[a];
-        u8 bv = meshlet_vertices[b];
-        u8 cv = meshlet_vertices[c];
+void mesh_encode_vertices(primitive_build* build)
+{
+    PrimitiveConstants* constants = &build->primitive->constants;
+    constants->position_offset = HMM_Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    constants->position_scale = HMM_Vec4(1.0f, 1.0f, 1.0f, 0.0f);
 
-        u32 used_extra = (av == 0xff) + (bv == 0xff) + (cv == 0xff);
+    build->gpu_vertices = (GPUVertex*)malloc(max(build->vertex_count, 1) * sizeof(GPUVertex));
 
-        if (ml.vertex_count + used_extra > MAX_MESHLET_VERTICES || ml.triangle_count >= MAX_MESHLET_TRIANGLES)
-        {
-            push_meshlet(&vec, ml);
-            
-            for (size_t j = 0; j < ml.vertex_count; ++j)
-                meshlet_vertices[ml.vertices[j]] = 0xff;
+#if MESH_QUANTIZED_VERTICES
+    hmm_vec3 bmin = HMM_Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    hmm_vec3 bmax = HMM_Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (u32 i = 0; i < build->vertex_count; i++)
+    {
+        hmm_vec3 p = build->vertices[i].position;
+        bmin = HMM_Vec3(min(bmin.X, p.X), min(bmin.Y, p.Y), min(bmin.Z, p.Z));
+        bmax = HMM_Vec3(max(bmax.X, p.X), max(bmax.Y, p.Y), max(bmax.Z, p.Z));
+    }
 
-            memset(&ml, 0, sizeof(ml));
-        }
+    hmm_vec3 extent = build->vertex_count ? HMM_SubtractVec3(bmax, bmin) : HMM_Vec3(0.0f, 0.0f, 0.0f);
+    f32 scale[3] = { extent.X, extent.Y, extent.Z };
+    for (u32 k = 0; k < 3; k++)
+        scale[k] = scale[k] > 0.0f ? scale[k] : 1.0f;
 
-        if (av == 0xff)
-        {
-            av = ml.vertex_count;
-            ml.vertices[ml.vertex_count++] = a;
-        }
+    if (build->vertex_count)
+        constants->position_offset = HMM_Vec4(bmin.X, bmin.Y, bmin.Z, 0.0f);
+    constants->position_scale = HMM_Vec4(scale[0], scale[1], scale[2], 0.0f);
 
-        if (bv == 0xff)
-        {
-            bv = ml.vertex_count;
-            ml.vertices[ml.vertex_count++] = b;
-        }
+    for (u32 i = 0; i < build->vertex_count; i++)
+    {
+        const Vertex* src = &build->vertices[i];
+        PackedVertex* dst = &build->gpu_vertices[i];
 
-        if (cv == 0xff)
+        for (u32 k = 0; k < 3; k++)
         {
-            cv = ml.vertex_count;
-            ml.vertices[ml.vertex_count++] = c;
+            f32 t = (src->position.Elements[k] - constants->position_offset.Elements[k]) / scale[k];
+            dst->position[k] = (u16)(max(0.0f, min(1.0f, t)) * 65535.0f + 0.5f);
         }
+        dst->pad = 0;
 
-        ml.indices[ml.triangle_count * 3 + 0] = av;
-        ml.indices[ml.triangle_count * 3 + 1] = bv;
-        ml.indices[ml.triangle_count * 3 + 2] = cv;
-        ml.triangle_count++;
+        hmm_vec2 oct = mesh_octahedral_encode(src->normals);
+        dst->normal[0] = mesh_quantize_snorm16(oct.X);
+        dst->normal[1] = mesh_quantize_snorm16(oct.Y);
+
+        dst->uv[0] = mesh_quantize_half(src->uv.X);
+        dst->uv[1] = mesh_quantize_half(src->uv.Y);
     }
+#else
+    memcpy(build->gpu_vertices, build->vertices, build->vertex_count * sizeof(Vertex));
+#endif
+}
 
-    if (ml.triangle_count)
-        push_meshlet(&vec, ml);
+void mesh_compute_bounds(primitive_build* build)
+{
+    hmm_vec3 bmin = HMM_Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    hmm_vec3 bmax = HMM_Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (u32 i = 0; i < build->vertex_count; i++)
+    {
+        hmm_vec3 p = build->vertices[i].position;
+        bmin = HMM_Vec3(min(bmin.X, p.X), min(bmin.Y, p.Y), min(bmin.Z, p.Z));
+        bmax = HMM_Vec3(max(bmax.X, p.X), max(bmax.Y, p.Y), max(bmax.Z, p.Z));
+    }
 
-    // Bounding Sphere
+    hmm_vec4* bounds = &build->primitive->bounds;
+    *bounds = HMM_Vec4(0.0f, 0.0f, 0.0f, 0.0f);
+    if (build->vertex_count == 0)
+        return;
 
-    for (u32 i = 0; i < vec.used; i++)
+    bounds->XYZ = HMM_MultiplyVec3f(HMM_AddVec3(bmin, bmax), 0.5f);
+    for (u32 i = 0; i < build->vertex_count; i++)
+        bounds->W = max(bounds->W, HMM_DistanceVec3(bounds->XYZ, build->vertices[i].position));
+}
+
+// Each level is simplified from the previous one and meshletized on its own
+void mesh_build_lods(primitive_build* build)
+{
+    b32 double_sided = build->source->material && build->source->material->double_sided;
+
+    if (MESH_CLUSTER_LOD)
     {
-        aabb bbox;
-        memset(&bbox, 0, sizeof(aabb));
+        meshlet_build_hierarchy(&build->lods[0], build->vertices, build->vertex_count, build->indices, build->index_count, double_sided);
+        build->lod_errors[0] = 0.0f;
+        build->lod_index_counts[0] = build->index_count;
+        build->lod_count = 1;
+        return;
+    }
+
+    u32* lod_indices = malloc(max(build->index_count, 1) * sizeof(u32));
+    u32* previous_indices = malloc(max(build->index_count, 1) * sizeof(u32));
+    const u32* source = build->indices;
+    u32 source_count = build->index_count;
+    f32 error = 0.0f;
 
-        bbox.min = HMM_Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
-        bbox.max = HMM_Vec3(FLT_MIN, FLT_MIN, FLT_MIN);
+    for (u32 lod = 0; lod < MESH_MAX_LODS; lod++)
+    {
+        const u32* indices = build->indices;
+        u32 count = build->index_count;
 
-        for (u32 j = 0; j < vec.meshlets[i].vertex_count; ++j)
+        if (lod > 0)
         {
-            u32 a = vec.meshlets[i].indices[j];
-            const Vertex* va = &vertices[vec.meshlets[i].vertices[a]];
+            // Nothing to gain below a single meshlet
+            if (source_count / 3 <= MAX_MESHLET_TRIANGLES)
+                break;
 
-            bbox.min.X = min(bbox.min.X, va->position.X);
-            bbox.min.Y = min(bbox.min.Y, va->position.Y);
-            bbox.min.Z = min(bbox.min.Z, va->position.Z);
+            f32 lod_error = 0.0f;
+            count = simplify_mesh(lod_indices, source, source_count, build->vertices, build->vertex_count, source_count / 6 * 3, FLT_MAX, &lod_error);
 
-            bbox.max.X = max(bbox.max.X, va->position.X);
-            bbox.max.Y = max(bbox.max.Y, va->position.Y);
-            bbox.max.Z = max(bbox.max.Z, va->position.Z);
-        }
+            // Borders and seam corners are locked and seams only slide along themselves, once they dominate another
+            // level barely helps
+            if (count == 0 || count > source_count * 3 / 4)
+                break;
 
-        hmm_vec3 bbox_extent = HMM_MultiplyVec3f(HMM_SubtractVec3(bbox.max, bbox.min), 0.5f);
-        hmm_vec3 bbox_center = HMM_AddVec3(bbox.min, bbox_extent);
+            indices = lod_indices;
+            error += lod_error;
+        }
 
-        vec.meshlets[i].sphere.XYZ = bbox_center;
+        meshlet_build(&build->lods[lod], build->vertices, build->vertex_count, indices, count);
+        meshlet_compute_bounds(&build->lods[lod], build->vertices, double_sided);
+        build->lod_errors[lod] = error;
+        build->lod_index_counts[lod] = count;
+        build->lod_count++;
 
-        for (u32 j = 0; j < vec.meshlets[i].vertex_count; ++j)
+        if (lod > 0)
         {
-            u32 a = vec.meshlets[i].indices[j];
-            const Vertex* va = &vertices[vec.meshlets[i].vertices[a]];
-
-            vec.meshlets[i].sphere.W = max(vec.meshlets[i].sphere.W, HMM_DistanceVec3(vec.meshlets[i].sphere.XYZ, va->position));
+            u32* swap = previous_indices;
+            previous_indices = lod_indices;
+            lod_indices = swap;
+            source = previous_indices;
         }
+        source_count = count;
     }
 
-    rhi_allocate_buffer(&pri->meshlet_buffer, vec.used * sizeof(Meshlet), BUFFER_VERTEX);
-    rhi_upload_buffer(&pri->meshlet_buffer, vec.meshlets, vec.used * sizeof(Meshlet));
+    free(previous_indices);
+    free(lod_indices);
+}
 
-    rhi_init_descriptor_set(&pri->geometry_descriptor_set, &s_meshlet_set_layout);
-    rhi_descriptor_set_write_storage_buffer(&pri->geometry_descriptor_set, &pri->vertex_buffer, vertices_size, 0);
-    rhi_descriptor_set_write_storage_buffer(&pri->geometry_descriptor_set, &pri->meshlet_buffer, vec.used * sizeof(Meshlet), 1);
+void mesh_build_primitive(void* data)
+{
+    primitive_build* build = (primitive_build*)data;
 
-    typedef struct temp_mat
-    {
-        i32 albedo_idx;
-        i32 normal_idx;
-        i32 mr_idx;
-        i32 sampler_idx;
-        hmm_vec3 bc_factor;
-        f32 m_factor;
-        f32 r_factor;
-        hmm_vec3 pad;
-    } temp_mat;
+    cgltf_unpack_primitive(build);
 
-    // Load textures
+    if (MESH_OPTIMIZE_VERTEX_ORDER)
     {
-        if (cgltf_primitive->material)
-        {
-            Thread* albedo_thread = aurora_platform_new_thread(mesh_load_albedo);
-            Thread* normal_thread = aurora_platform_new_thread(mesh_load_normal);
-            Thread* pbr_thread = aurora_platform_new_thread(mesh_load_pbr);
+        vertex_cache_analyze(&build->cache_before, build->indices, build->index_count, build->vertex_count, VERTEX_CACHE_SIZE);
+        vertex_cache_optimize(build->indices, build->index_count, build->vertex_count, VERTEX_CACHE_SIZE);
+        build->vertex_count = vertex_fetch_optimize(build->vertices, build->indices, build->index_count, build->vertex_count);
+        vertex_cache_analyze(&build->cache_after, build->indices, build->index_count, build->vertex_count, VERTEX_CACHE_SIZE);
+    }
 
-            pri->material_index = m->material_count;
+    mesh_compute_bounds(build);
+    mesh_build_lods(build);
+    mesh_encode_vertices(build);
+}
 
-            aurora_platform_set_thread_ptr(albedo_thread, &m->materials[pri->material_index]);
-            aurora_platform_set_thread_ptr(normal_thread, &m->materials[pri->material_index]);
-            aurora_platform_set_thread_ptr(pbr_thread, &m->materials[pri->material_index]);
+void upload_primitive(Mesh* m, primitive_build* build)
+{
+    Primitive* pri = build->primitive;
 
-            sprintf(m->materials[pri->material_index].albedo_path, "%s%s", m->directory, cgltf_primitive->material->pbr_metallic_roughness.base_color_texture.texture->image->uri);
+    u64 vertices_size = build->vertex_count * sizeof(GPUVertex);
+    u64 index_size = build->index_count * sizeof(u32);
+    rhi_allocate_buffer(&pri->vertex_buffer, vertices_size, BUFFER_VERTEX);
+    rhi_upload_buffer(&pri->vertex_buffer, build->gpu_vertices, vertices_size);
 
-            if (cgltf_primitive->material->normal_texture.texture) 
-            {
-                m->materials[pri->material_index].has_normal = 1;
-                sprintf(m->materials[pri->material_index].normal_path, "%s%s", m->directory, cgltf_primitive->material->normal_texture.texture->image->uri);
-            }
-            
-            if (cgltf_primitive->material->pbr_metallic_roughness.metallic_roughness_texture.texture)
-            {
-                m->materials[pri->material_index].has_metallic = 1;
-                sprintf(m->materials[pri->material_index].mr_path, "%s%s", m->directory, cgltf_primitive->material->pbr_metallic_roughness.metallic_roughness_texture.texture->image->uri);
-            }
+    rhi_allocate_buffer(&pri->index_buffer, index_size, BUFFER_INDEX);
+    rhi_upload_buffer(&pri->index_buffer, build->indices, index_size);
 
-            if (MULTITHREADING_ENABLED)
-            {
-                aurora_platform_execute_thread(albedo_thread);
-                if (m->materials[pri->material_index].has_normal) aurora_platform_execute_thread(normal_thread);
-                if (m->materials[pri->material_index].has_metallic) aurora_platform_execute_thread(pbr_thread);
+    for (u32 i = 0; i < build->lod_count; i++)
+    {
+        MeshletData* src = &build->lods[i];
+        PrimitiveLod* lod = &pri->lods[i];
 
-                aurora_platform_join_thread(albedo_thread);
-                if (m->materials[pri->material_index].has_normal) aurora_platform_join_thread(normal_thread);
-                if (m->materials[pri->material_index].has_metallic) aurora_platform_join_thread(pbr_thread);
-            }
-            else
-            {
-                rhi_load_raw_image(&m->materials[pri->material_index].raw_color,  m->materials[pri->material_index].albedo_path);
-                if (m->materials[pri->material_index].has_normal) rhi_load_raw_image(&m->materials[pri->material_index].raw_normal, m->materials[pri->material_index].normal_path);
-                if (m->materials[pri->material_index].has_metallic) rhi_load_raw_image(&m->materials[pri->material_index].raw_pbr,    m->materials[pri->material_index].mr_path);
-            }
+        u64 meshlets_size = src->meshlet_count * sizeof(Meshlet);
+        u64 meshlet_vertices_size = src->vertex_count * sizeof(u32);
+        u64 meshlet_indices_size = src->index_size;
 
-            aurora_platform_free_thread(albedo_thread);
-            aurora_platform_free_thread(normal_thread);
-            aurora_platform_free_thread(pbr_thread);
-
-            rhi_upload_image(&m->materials[pri->material_index].albedo, &m->materials[pri->material_index].raw_color, 1);
-            rhi_free_raw_image(&m->materials[pri->material_index].raw_color);
-            m->materials[pri->material_index].albedo_bindless_index = rhi_find_available_descriptor(s_image_heap);
-            rhi_push_descriptor_heap_image(s_image_heap, &m->materials[pri->material_index].albedo, m->materials[pri->material_index].albedo_bindless_index);
-
-            m->materials[pri->material_index].albedo_sampler.filter = VK_FILTER_LINEAR;
-            m->materials[pri->material_index].albedo_sampler.address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-
-            rhi_init_sampler(&m->materials[pri->material_index].albedo_sampler, m->materials[pri->material_index].albedo.mip_levels);
-            m->materials[pri->material_index].albedo_sampler_index = rhi_find_available_descriptor(s_sampler_heap);
-            rhi_push_descriptor_heap_sampler(s_sampler_heap, &m->materials[pri->material_index].albedo_sampler, m->materials[pri->material_index].albedo_sampler_index);
-            
-            m->materials[pri->material_index].base_color_factor.X = cgltf_primitive->material->pbr_metallic_roughness.base_color_factor[0];
-            m->materials[pri->material_index].base_color_factor.Y = cgltf_primitive->material->pbr_metallic_roughness.base_color_factor[1];
-            m->materials[pri->material_index].base_color_factor.Z = cgltf_primitive->material->pbr_metallic_roughness.base_color_factor[2];
-
-            if (cgltf_primitive->material->normal_texture.texture)
-            {     
-                rhi_upload_image(&m->materials[pri->material_index].normal, &m->materials[pri->material_index].raw_normal, 0);
-                rhi_free_raw_image(&m->materials[pri->material_index].raw_normal);
-                m->materials[pri->material_index].normal_bindless_index = rhi_find_available_descriptor(s_image_heap);
-                rhi_push_descriptor_heap_image(s_image_heap, &m->materials[pri->material_index].normal, m->materials[pri->material_index].normal_bindless_index);
-            }
+        rhi_allocate_buffer(&lod->meshlet_buffer, meshlets_size, BUFFER_VERTEX);
+        rhi_upload_buffer(&lod->meshlet_buffer, src->meshlets, meshlets_size);
 
-            
-            if (cgltf_primitive->material->pbr_metallic_roughness.metallic_roughness_texture.texture)
-            {
-                rhi_upload_image(&m->materials[pri->material_index].metallic_roughness, &m->materials[pri->material_index].raw_pbr, 0);
-                rhi_free_raw_image(&m->materials[pri->material_index].raw_pbr);
-
-                m->materials[pri->material_index].metallic_roughness_index = rhi_find_available_descriptor(s_image_heap);
-                rhi_push_descriptor_heap_image(s_image_heap, &m->materials[pri->material_index].metallic_roughness, m->materials[pri->material_index].metallic_roughness_index);
-            
-                m->materials[pri->material_index].metallic_factor = cgltf_primitive->material->pbr_metallic_roughness.metallic_factor;
-                m->materials[pri->material_index].roughness_factor = cgltf_primitive->material->pbr_metallic_roughness.roughness_factor;
-            }
-            
-        
-            temp_mat temp;
-            temp.albedo_idx = m->materials[pri->material_index].albedo_bindless_index;
-            temp.sampler_idx = m->materials[pri->material_index].albedo_sampler_index;
-            temp.normal_idx = m->materials[pri->material_index].normal_bindless_index;
-            temp.mr_idx = m->materials[pri->material_index].metallic_roughness_index;
-            temp.bc_factor = m->materials[pri->material_index].base_color_factor;
-            temp.m_factor = m->materials[pri->material_index].metallic_factor;
-            temp.r_factor = m->materials[pri->material_index].roughness_factor;
-
-            rhi_allocate_buffer(&m->materials[pri->material_index].material_buffer, sizeof(temp_mat), BUFFER_UNIFORM);
-            rhi_upload_buffer(&m->materials[pri->material_index].material_buffer, &temp, sizeof(temp_mat));
-
-            rhi_init_descriptor_set(&m->materials[pri->material_index].material_set, &s_descriptor_set_layout);
-            rhi_descriptor_set_write_buffer(&m->materials[pri->material_index].material_set, &m->materials[pri->material_index].material_buffer, sizeof(temp_mat), 0);
-
-            m->material_count++;
-        }
+        rhi_allocate_buffer(&lod->meshlet_vertex_buffer, meshlet_vertices_size, BUFFER_VERTEX);
+        rhi_upload_buffer(&lod->meshlet_vertex_buffer, src->vertices, meshlet_vertices_size);
+
+        rhi_allocate_buffer(&lod->meshlet_index_buffer, meshlet_indices_size, BUFFER_VERTEX);
+        rhi_upload_buffer(&lod->meshlet_index_buffer, src->indices, meshlet_indices_size);
+
+        rhi_init_descriptor_set(&lod->geometry_descriptor_set, &s_meshlet_set_layout);
+        rhi_descriptor_set_write_storage_buffer(&lod->geometry_descriptor_set, &pri->vertex_buffer, vertices_size, 0);
+        rhi_descriptor_set_write_storage_buffer(&lod->geometry_descriptor_set, &lod->meshlet_buffer, meshlets_size, 1);
+        rhi_descriptor_set_write_storage_buffer(&lod->geometry_descriptor_set, &lod->meshlet_vertex_buffer, meshlet_vertices_size, 2);
+        rhi_descriptor_set_write_storage_buffer(&lod->geometry_descriptor_set, &lod->meshlet_index_buffer, meshlet_indices_size, 3);
+
+        lod->meshlet_count = src->meshlet_count;
+        lod->triangle_count = build->lod_index_counts[i] / 3;
+        lod->error = build->lod_errors[i];
     }
+    pri->lod_count = build->lod_count;
 
-    pri->vertex_count = vertex_count;
+    pri->vertex_count = build->vertex_count;
+    pri->index_count = build->index_count;
     pri->triangle_count = pri->index_count / 3;
     pri->vertex_size = vertices_size;
     pri->index_size = index_size;
-    pri->meshlet_count = vec.used;
+    pri->meshlet_count = pri->lods[0].meshlet_count;
 
     m->total_vertex_count += pri->vertex_count;
     m->total_index_count += pri->index_count;
     m->total_triangle_count += pri->triangle_count;
+    m->total_meshlet_count += pri->meshlet_count;
+}
+
+void release_primitive_build(primitive_build* build)
+{
+    if (build->cooked)
+        return;
 
-    free_meshlet_vector(&vec);
-    free(indices);
-    free(vertices);
+    for (u32 i = 0; i < build->lod_count; i++)
+        meshlet_data_free(&build->lods[i]);
+    free(build->indices);
+    free(build->gpu_vertices);
+    free(build->vertices);
 }
 
-void cgltf_process_node(cgltf_node* node, u32* primitive_index, Mesh* m)
+void upload_material(GLTFMaterial* material)
+{
+    material->albedo_bindless_index = mesh_texture_upload(material->albedo_texture);
+
+    material->albedo_sampler.filter = VK_FILTER_LINEAR;
+    material->albedo_sampler.address_mode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+
+    if (material->has_normal)
+        material->normal_bindless_index = mesh_texture_upload(material->normal_texture);
+
+    if (material->has_metallic)
+        material->metallic_roughness_index = mesh_texture_upload(material->metallic_roughness_texture);
+
+    // Shared by all three textures, so it has to reach the last level of the longest chain once fully resident
+    u32 mips = s_textures[material->albedo_texture - 1].mip_levels;
+    if (material->has_normal) mips = max(mips, s_textures[material->normal_texture - 1].mip_levels);
+    if (material->has_metallic) mips = max(mips, s_textures[material->metallic_roughness_texture - 1].mip_levels);
+
+    rhi_init_sampler(&material->albedo_sampler, mips);
+    material->albedo_sampler_index = rhi_get_sampler_heap_index(s_sampler_heap, &material->albedo_sampler);
+
+    temp_mat temp;
+    memset(&temp, 0, sizeof(temp));
+    temp.albedo_idx = material->albedo_bindless_index;
+    temp.sampler_idx = material->albedo_sampler_index;
+    temp.normal_idx = material->normal_bindless_index;
+    temp.mr_idx = material->metallic_roughness_index;
+    temp.bc_factor = material->base_color_factor;
+    temp.m_factor = material->metallic_factor;
+    temp.r_factor = material->roughness_factor;
+
+    rhi_allocate_buffer(&material->material_buffer, sizeof(temp_mat), BUFFER_UNIFORM);
+    rhi_upload_buffer(&material->material_buffer, &temp, sizeof(temp_mat));
+
+    rhi_init_descriptor_set(&material->material_set, &s_descriptor_set_layout);
+    rhi_descriptor_set_write_buffer(&material->material_set, &material->material_buffer, sizeof(temp_mat), 0);
+}
+
+i32 cgltf_register_material(mesh_build* build, cgltf_material* source)
+{
+    Mesh* m = build->mesh;
+    u32 source_index = (u32)(source - build->data->materials);
+
+    if (build->material_remap[source_index] != -1)
+        return build->material_remap[source_index];
+
+    assert(m->material_count < MAX_PRIMITIVES);
+
+    i32 material_index = m->material_count++;
+    GLTFMaterial* material = &m->materials[material_index];
+    build->material_remap[source_index] = material_index;
+
+    sprintf(material->albedo_path, "%s%s", m->directory, source->pbr_metallic_roughness.base_color_texture.texture->image->uri);
+
+    material->base_color_factor.X = source->pbr_metallic_roughness.base_color_factor[0];
+    material->base_color_factor.Y = source->pbr_metallic_roughness.base_color_factor[1];
+    material->base_color_factor.Z = source->pbr_metallic_roughness.base_color_factor[2];
+
+    if (source->normal_texture.texture)
+    {
+        material->has_normal = 1;
+        sprintf(material->normal_path, "%s%s", m->directory, source->normal_texture.texture->image->uri);
+    }
+
+    if (source->pbr_metallic_roughness.metallic_roughness_texture.texture)
+    {
+        material->has_metallic = 1;
+        sprintf(material->mr_path, "%s%s", m->directory, source->pbr_metallic_roughness.metallic_roughness_texture.texture->image->uri);
+
+        material->metallic_factor = source->pbr_metallic_roughness.metallic_factor;
+        material->roughness_factor = source->pbr_metallic_roughness.roughness_factor;
+    }
+
+    return material_index;
+}
+
+void cgltf_process_node(cgltf_node* node, mesh_build* build)
 {
     if (node->mesh)
     {
@@ -517,19 +1022,525 @@ void cgltf_process_node(cgltf_node* node, u32* primitive_index, Mesh* m)
 
         for (i32 p = 0; p < node->mesh->primitives_count; p++)
         {
-            cgltf_process_primitive(&node->mesh->primitives[p], primitive_index, m, pri_transform);
-            m->primitive_count++;
+            cgltf_primitive* source = &node->mesh->primitives[p];
+            if (source->type != cgltf_primitive_type_triangles)
+                continue;
+
+            assert(build->primitive_count < MAX_PRIMITIVES);
+
+            primitive_build* pb = &build->primitives[build->primitive_count++];
+            pb->source = source;
+            pb->primitive = &build->mesh->primitives[build->mesh->primitive_count++];
+            pb->primitive->constants.transform = pri_transform;
+
+            if (source->material)
+                pb->primitive->material_index = cgltf_register_material(build, source->material);
         }
     }
 
     for (i32 c = 0; c < node->children_count; c++)
-        cgltf_process_node(node->children[c], primitive_index, m);
+        cgltf_process_node(node->children[c], build);
 }
 
-void mesh_load(Mesh* out, const char* path)
+void mesh_acquire_textures(Mesh* m)
+{
+    for (i32 i = 0; i < m->material_count; i++)
+    {
+        GLTFMaterial* material = &m->materials[i];
+
+        material->albedo_texture = mesh_texture_acquire(material->albedo_path, TEXTURE_ROLE_ALBEDO);
+        if (material->has_normal) material->normal_texture = mesh_texture_acquire(material->normal_path, TEXTURE_ROLE_NORMAL);
+        if (material->has_metallic) material->metallic_roughness_texture = mesh_texture_acquire(material->mr_path, TEXTURE_ROLE_DATA);
+    }
+}
+
+// Textures first referenced by another request may still be decoding on its behalf
+void mesh_wait_textures(Mesh* m)
+{
+    for (i32 i = 0; i < m->material_count; i++)
+    {
+        mesh_texture_wait(m->materials[i].albedo_texture);
+        mesh_texture_wait(m->materials[i].normal_texture);
+        mesh_texture_wait(m->materials[i].metallic_roughness_texture);
+    }
+}
+
+void mesh_release_textures(Mesh* m)
+{
+    for (i32 i = 0; i < m->material_count; i++)
+    {
+        GLTFMaterial* material = &m->materials[i];
+
+        mesh_texture_release(material->albedo_texture);
+        mesh_texture_release(material->normal_texture);
+        mesh_texture_release(material->metallic_roughness_texture);
+        material->albedo_texture = material->normal_texture = material->metallic_roughness_texture = 0;
+    }
+}
+
+// The RHI is only touched from the loading thread
+void mesh_upload(Mesh* m, primitive_build* builds, u32 build_count)
+{
+    MeshletStats stats;
+    memset(&stats, 0, sizeof(stats));
+    VertexCacheStats cache_before, cache_after;
+    memset(&cache_before, 0, sizeof(cache_before));
+    memset(&cache_after, 0, sizeof(cache_after));
+    u64 lod_triangles[MESH_MAX_LODS] = {0};
+
+    rhi_begin_upload_batch();
+    for (u32 i = 0; i < build_count; i++)
+    {
+        upload_primitive(m, &builds[i]);
+        meshlet_accumulate_stats(&stats, &builds[i].lods[0]);
+
+        for (u32 lod = 0; lod < builds[i].lod_count; lod++)
+            lod_triangles[lod] += builds[i].lod_index_counts[lod] / 3;
+
+        cache_before.triangle_count += builds[i].cache_before.triangle_count;
+        cache_before.vertex_count += builds[i].cache_before.vertex_count;
+        cache_before.miss_count += builds[i].cache_before.miss_count;
+        cache_after.triangle_count += builds[i].cache_after.triangle_count;
+        cache_after.vertex_count += builds[i].cache_after.vertex_count;
+        cache_after.miss_count += builds[i].cache_after.miss_count;
+    }
+
+    meshlet_print_stats(&stats, "Meshlets");
+    vertex_cache_print_stats(&cache_before, &cache_after, "Vertex cache");
+
+    printf("LOD triangles:");
+    for (u32 lod = 0; lod < MESH_MAX_LODS && lod_triangles[lod]; lod++)
+        printf(" %llu", lod_triangles[lod]);
+    printf("\n");
+
+    for (i32 i = 0; i < m->material_count; i++)
+        upload_material(&m->materials[i]);
+    rhi_end_upload_batch();
+}
+
+// Cooked mesh cache: <model>.cache next to the source, mapped and uploaded without touching cgltf.
+// Vertices are stored in the GPU format. Bump MESH_CACHE_VERSION whenever GPUVertex, Meshlet or any record below changes layout.
+#define MESH_CACHE_MAGIC 0x48534d41 // AMSH
+#define MESH_CACHE_VERSION 9
+// Build toggles that change what gets cooked, a cache made with other settings is rebuilt
+#define MESH_CACHE_CONFIG ((u32)MESH_CLUSTER_LOD | (u32)MESHLET_LOCALITY_BUILDER << 1 | (u32)MESH_OPTIMIZE_VERTEX_ORDER << 2 \
+    | (u32)MESH_QUANTIZED_VERTICES << 3 | (u32)MESH_MAX_LODS << 8 | (u32)MESHLET_GROUP_SIZE << 16)
+#define MESH_CACHE_MAX_URI 256
+#define MESH_CACHE_ALIGNMENT 16
+
+typedef struct mesh_cache_header mesh_cache_header;
+struct mesh_cache_header
+{
+    u32 magic;
+    u32 version;
+    u64 file_size;
+    u64 source_hash;
+    u32 vertex_stride;
+    u32 meshlet_stride;
+    u32 primitive_stride;
+    u32 config;
+    u32 dependency_count;
+    u32 material_count;
+    u32 primitive_count;
+    u32 pad;
+    u64 material_offset;
+    u64 primitive_offset;
+};
+
+typedef struct mesh_cache_material mesh_cache_material;
+struct mesh_cache_material
+{
+    char albedo_uri[MESH_CACHE_MAX_URI];
+    char normal_uri[MESH_CACHE_MAX_URI];
+    char mr_uri[MESH_CACHE_MAX_URI];
+    b32 has_normal;
+    b32 has_metallic;
+    hmm_vec3 base_color_factor;
+    f32 metallic_factor;
+    f32 roughness_factor;
+};
+
+typedef struct mesh_cache_lod mesh_cache_lod;
+struct mesh_cache_lod
+{
+    f32 error;
+    u32 index_count;
+    u32 meshlet_count;
+    u32 meshlet_vertex_count;
+    u32 meshlet_index_size;
+    u32 pad;
+    u64 meshlet_offset;
+    u64 meshlet_vertex_offset;
+    u64 meshlet_index_offset;
+};
+
+typedef struct mesh_cache_primitive mesh_cache_primitive;
+struct mesh_cache_primitive
+{
+    PrimitiveConstants constants;
+    hmm_vec4 bounds;
+    u32 material_index;
+    u32 vertex_count;
+    u32 index_count;
+    u32 lod_count;
+    u64 vertex_offset;
+    u64 index_offset;
+    mesh_cache_lod lods[MESH_MAX_LODS];
+};
+
+u64 fnv1a_64(const u8* data, u64 size, u64 hash)
+{
+    for (u64 i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Hash of the .gltf/.glb and every external buffer it references. Returns 0 if the source isn't there.
+b32 mesh_cache_source_hash(const char* path, const char* directory, char (*dependencies)[MESH_CACHE_MAX_URI], u32 dependency_count, u64* out_hash)
+{
+    u64 hash = 0xcbf29ce484222325ull;
+
+    for (i32 i = -1; i < (i32)dependency_count; i++)
+    {
+        char dependency_path[512];
+        if (i < 0)
+            snprintf(dependency_path, sizeof(dependency_path), "%s", path);
+        else
+            snprintf(dependency_path, sizeof(dependency_path), "%s%.*s", directory, MESH_CACHE_MAX_URI, dependencies[i]);
+
+        u64 size = 0;
+        u8* data = (u8*)aurora_platform_map_file(dependency_path, &size);
+        if (!data)
+            return 0;
+
+        hash = fnv1a_64(data, size, hash);
+        aurora_platform_unmap_file(data, size);
+    }
+
+    *out_hash = hash;
+    return 1;
+}
+
+u64 mesh_cache_align(u64 offset)
+{
+    return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(u64)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+// Everything in the blob starts 16 byte aligned so the HandmadeMath SSE types can be read in place
+void mesh_cache_write_aligned(FILE* file, const void* data, u64 size, u64* cursor)
+{
+    u8 zeros[MESH_CACHE_ALIGNMENT] = {0};
+    u64 padding = mesh_cache_align(*cursor) - *cursor;
+    *cursor += fwrite(zeros, 1, padding, file);
+    *cursor += fwrite(data, 1, size, file);
+}
+
+void mesh_cache_write(mesh_build* build, const char* path, const char* cache_path)
+{
+    Mesh* m = build->mesh;
+    cgltf_data* data = build->data;
+    u64 directory_length = strlen(m->directory);
+
+    mesh_cache_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.vertex_stride = sizeof(GPUVertex);
+    header.meshlet_stride = sizeof(Meshlet);
+    header.primitive_stride = sizeof(mesh_cache_primitive);
+    header.config = MESH_CACHE_CONFIG;
+    header.material_count = m->material_count;
+    header.primitive_count = build->primitive_count;
+
+    char (*dependencies)[MESH_CACHE_MAX_URI] = calloc(max(data->buffers_count, 1), MESH_CACHE_MAX_URI);
+    for (u32 i = 0; i < data->buffers_count; i++)
+    {
+        // Embedded (data:) and GLB buffers are covered by hashing the source file itself
+        const char* uri = data->buffers[i].uri;
+        if (uri && strncmp(uri, "data:", 5) != 0)
+            strncpy(dependencies[header.dependency_count++], uri, MESH_CACHE_MAX_URI - 1);
+    }
+
+    if (!mesh_cache_source_hash(path, m->directory, dependencies, header.dependency_count, &header.source_hash))
+    {
+        free(dependencies);
+        return;
+    }
+
+    mesh_cache_material* materials = calloc(max(m->material_count, 1), sizeof(mesh_cache_material));
+    for (i32 i = 0; i < m->material_count; i++)
+    {
+        GLTFMaterial* src = &m->materials[i];
+        mesh_cache_material* dst = &materials[i];
+
+        strncpy(dst->albedo_uri, src->albedo_path + directory_length, MESH_CACHE_MAX_URI - 1);
+        if (src->has_normal) strncpy(dst->normal_uri, src->normal_path + directory_length, MESH_CACHE_MAX_URI - 1);
+        if (src->has_metallic) strncpy(dst->mr_uri, src->mr_path + directory_length, MESH_CACHE_MAX_URI - 1);
+        dst->has_normal = src->has_normal;
+        dst->has_metallic = src->has_metallic;
+        dst->base_color_factor = src->base_color_factor;
+        dst->metallic_factor = src->metallic_factor;
+        dst->roughness_factor = src->roughness_factor;
+    }
+
+    header.material_offset = mesh_cache_align(sizeof(mesh_cache_header) + header.dependency_count * MESH_CACHE_MAX_URI);
+    header.primitive_offset = mesh_cache_align(header.material_offset + header.material_count * sizeof(mesh_cache_material));
+    u64 cursor = header.primitive_offset + header.primitive_count * sizeof(mesh_cache_primitive);
+
+    mesh_cache_primitive* primitives = calloc(max(build->primitive_count, 1), sizeof(mesh_cache_primitive));
+    for (u32 i = 0; i < build->primitive_count; i++)
+    {
+        primitive_build* pb = &build->primitives[i];
+        mesh_cache_primitive* dst = &primitives[i];
+
+        dst->constants = pb->primitive->constants;
+        dst->bounds = pb->primitive->bounds;
+        dst->material_index = pb->primitive->material_index;
+        dst->vertex_count = pb->vertex_count;
+        dst->index_count = pb->index_count;
+        dst->lod_count = pb->lod_count;
+
+        cursor = mesh_cache_align(cursor);
+        dst->vertex_offset = cursor;
+        cursor += dst->vertex_count * sizeof(GPUVertex);
+
+        cursor = mesh_cache_align(cursor);
+        dst->index_offset = cursor;
+        cursor += dst->index_count * sizeof(u32);
+
+        for (u32 l = 0; l < pb->lod_count; l++)
+        {
+            mesh_cache_lod* lod = &dst->lods[l];
+            lod->error = pb->lod_errors[l];
+            lod->index_count = pb->lod_index_counts[l];
+            lod->meshlet_count = pb->lods[l].meshlet_count;
+            lod->meshlet_vertex_count = pb->lods[l].vertex_count;
+            lod->meshlet_index_size = pb->lods[l].index_size;
+
+            cursor = mesh_cache_align(cursor);
+            lod->meshlet_offset = cursor;
+            cursor += lod->meshlet_count * sizeof(Meshlet);
+
+            cursor = mesh_cache_align(cursor);
+            lod->meshlet_vertex_offset = cursor;
+            cursor += lod->meshlet_vertex_count * sizeof(u32);
+
+            cursor = mesh_cache_align(cursor);
+            lod->meshlet_index_offset = cursor;
+            cursor += lod->meshlet_index_size;
+        }
+    }
+    header.file_size = cursor;
+
+    // Loads run concurrently, so the blob is written aside and moved in place once complete. A reader never maps
+    // a half written cache and two loads of the same model don't interleave their writes.
+    char temp_path[512 + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.%p.tmp", cache_path, (void*)build);
+
+    FILE* file = fopen(temp_path, "wb");
+    if (file)
+    {
+        u64 written = 0;
+        mesh_cache_write_aligned(file, &header, sizeof(header), &written);
+        mesh_cache_write_aligned(file, dependencies, header.dependency_count * MESH_CACHE_MAX_URI, &written);
+        mesh_cache_write_aligned(file, materials, header.material_count * sizeof(mesh_cache_material), &written);
+        mesh_cache_write_aligned(file, primitives, header.primitive_count * sizeof(mesh_cache_primitive), &written);
+
+        for (u32 i = 0; i < build->primitive_count; i++)
+        {
+            primitive_build* pb = &build->primitives[i];
+
+            mesh_cache_write_aligned(file, pb->gpu_vertices, pb->vertex_count * sizeof(GPUVertex), &written);
+            mesh_cache_write_aligned(file, pb->indices, pb->index_count * sizeof(u32), &written);
+
+            for (u32 l = 0; l < pb->lod_count; l++)
+            {
+                MeshletData* lod = &pb->lods[l];
+                mesh_cache_write_aligned(file, lod->meshlets, lod->meshlet_count * sizeof(Meshlet), &written);
+                mesh_cache_write_aligned(file, lod->vertices, lod->vertex_count * sizeof(u32), &written);
+                mesh_cache_write_aligned(file, lod->indices, lod->index_size, &written);
+            }
+        }
+
+        fclose(file);
+
+        // A short write would fail the size check anyway, drop it so the next run recooks cleanly
+        if (written != header.file_size)
+        {
+            remove(temp_path);
+        }
+        else
+        {
+            remove(cache_path);
+            if (rename(temp_path, cache_path) != 0)
+                remove(temp_path);
+        }
+    }
+
+    free(primitives);
+    free(materials);
+    free(dependencies);
+}
+
+// count records of stride bytes at offset lie inside the blob
+b32 mesh_cache_region(u64 offset, u64 count, u64 stride, u64 blob_size)
+{
+    return offset <= blob_size && count <= (blob_size - offset) / stride;
+}
+
+// Every region a primitive points to is checked before anything is turned into a pointer
+b32 mesh_cache_validate_primitive(mesh_cache_primitive* primitive, u32 material_count, u64 blob_size)
 {
+    if (primitive->material_index >= material_count || primitive->lod_count > MESH_MAX_LODS
+        || !mesh_cache_region(primitive->vertex_offset, primitive->vertex_count, sizeof(GPUVertex), blob_size)
+        || !mesh_cache_region(primitive->index_offset, primitive->index_count, sizeof(u32), blob_size))
+        return 0;
+
+    for (u32 l = 0; l < primitive->lod_count; l++)
+    {
+        mesh_cache_lod* lod = &primitive->lods[l];
+        if (!mesh_cache_region(lod->meshlet_offset, lod->meshlet_count, sizeof(Meshlet), blob_size)
+            || !mesh_cache_region(lod->meshlet_vertex_offset, lod->meshlet_vertex_count, sizeof(u32), blob_size)
+            || !mesh_cache_region(lod->meshlet_index_offset, lod->meshlet_index_size, 1, blob_size))
+            return 0;
+    }
+    return 1;
+}
+
+b32 mesh_cache_load(mesh_load_job* job, const char* cache_path)
+{
+    Mesh* out = job->mesh;
+    const char* path = job->path;
+    u64 blob_size = 0;
+    u8* blob = (u8*)aurora_platform_map_file(cache_path, &blob_size);
+    if (!blob)
+        return 0;
+
+    mesh_cache_header* header = (mesh_cache_header*)blob;
+
+    b32 valid = blob_size >= sizeof(mesh_cache_header)
+        && header->magic == MESH_CACHE_MAGIC
+        && header->version == MESH_CACHE_VERSION
+        && header->file_size == blob_size
+        && header->vertex_stride == sizeof(GPUVertex)
+        && header->meshlet_stride == sizeof(Meshlet)
+        && header->primitive_stride == sizeof(mesh_cache_primitive)
+        && header->config == MESH_CACHE_CONFIG
+        && header->material_count <= MAX_PRIMITIVES
+        && header->primitive_count <= MAX_PRIMITIVES;
+
+    valid = valid
+        && mesh_cache_region(sizeof(mesh_cache_header), header->dependency_count, MESH_CACHE_MAX_URI, header->material_offset)
+        && mesh_cache_region(header->material_offset, header->material_count, sizeof(mesh_cache_material), header->primitive_offset)
+        && mesh_cache_region(header->primitive_offset, header->primitive_count, sizeof(mesh_cache_primitive), blob_size);
+
+    for (u32 i = 0; valid && i < header->primitive_count; i++)
+        valid = mesh_cache_validate_primitive((mesh_cache_primitive*)(blob + header->primitive_offset) + i, header->material_count, blob_size);
+
+    char (*dependencies)[MESH_CACHE_MAX_URI] = (char (*)[MESH_CACHE_MAX_URI])(blob + sizeof(mesh_cache_header));
+
+    // Shipping only the cooked blob is fine, the hash is only checked when the source is around
+    u64 source_hash;
+    if (valid && mesh_cache_source_hash(path, out->directory, dependencies, header->dependency_count, &source_hash))
+        valid = source_hash == header->source_hash;
+
+    if (!valid)
+    {
+        aurora_platform_unmap_file(blob, blob_size);
+        return 0;
+    }
+
+    mesh_cache_material* materials = (mesh_cache_material*)(blob + header->material_offset);
+    mesh_cache_primitive* primitives = (mesh_cache_primitive*)(blob + header->primitive_offset);
+
+    out->material_count = header->material_count;
+    for (u32 i = 0; i < header->material_count; i++)
+    {
+        GLTFMaterial* dst = &out->materials[i];
+        mesh_cache_material* src = &materials[i];
+
+        snprintf(dst->albedo_path, sizeof(dst->albedo_path), "%s%.*s", out->directory, MESH_CACHE_MAX_URI, src->albedo_uri);
+        if (src->has_normal) snprintf(dst->normal_path, sizeof(dst->normal_path), "%s%.*s", out->directory, MESH_CACHE_MAX_URI, src->normal_uri);
+        if (src->has_metallic) snprintf(dst->mr_path, sizeof(dst->mr_path), "%s%.*s", out->directory, MESH_CACHE_MAX_URI, src->mr_uri);
+        dst->has_normal = src->has_normal;
+        dst->has_metallic = src->has_metallic;
+        dst->base_color_factor = src->base_color_factor;
+        dst->metallic_factor = src->metallic_factor;
+        dst->roughness_factor = src->roughness_factor;
+    }
+
+    mesh_acquire_textures(out);
+
+    primitive_build* builds = calloc(max(header->primitive_count, 1), sizeof(primitive_build));
+    job->build.primitives = builds;
+    job->build.primitive_count = header->primitive_count;
+    job->blob = blob;
+    job->blob_size = blob_size;
+    out->primitive_count = header->primitive_count;
+    for (u32 i = 0; i < header->primitive_count; i++)
+    {
+        mesh_cache_primitive* src = &primitives[i];
+        primitive_build* pb = &builds[i];
+
+        pb->cooked = 1;
+        pb->primitive = &out->primitives[i];
+        pb->primitive->constants = src->constants;
+        pb->primitive->bounds = src->bounds;
+        pb->primitive->material_index = src->material_index;
+        pb->gpu_vertices = (GPUVertex*)(blob + src->vertex_offset);
+        pb->vertex_count = src->vertex_count;
+        pb->indices = (u32*)(blob + src->index_offset);
+        pb->index_count = src->index_count;
+        pb->lod_count = min(src->lod_count, MESH_MAX_LODS);
+
+        for (u32 l = 0; l < pb->lod_count; l++)
+        {
+            mesh_cache_lod* lod = &src->lods[l];
+            pb->lod_errors[l] = lod->error;
+            pb->lod_index_counts[l] = lod->index_count;
+            pb->lods[l].meshlets = (Meshlet*)(blob + lod->meshlet_offset);
+            pb->lods[l].meshlet_count = lod->meshlet_count;
+            pb->lods[l].vertices = (u32*)(blob + lod->meshlet_vertex_offset);
+            pb->lods[l].vertex_count = lod->meshlet_vertex_count;
+            pb->lods[l].indices = blob + lod->meshlet_index_offset;
+            pb->lods[l].index_size = lod->meshlet_index_size;
+        }
+    }
+
+    mesh_wait_textures(out);
+    return 1;
+}
+
+// Stages 1-3, runs on any thread and never touches the RHI
+void mesh_load_prepare(void* ptr)
+{
+    mesh_load_job* job = (mesh_load_job*)ptr;
+    Mesh* out = job->mesh;
+    const char* path = job->path;
+
     memset(out, 0, sizeof(Mesh));
+    job->build.mesh = out;
+
+    strncpy(out->directory, path, sizeof(out->directory) - 1);
+    char* separator = strrchr(out->directory, '/');
+    char* backslash = strrchr(out->directory, '\\');
+    if (!separator || (backslash && backslash > separator))
+        separator = backslash;
+    if (separator)
+        separator[1] = '\0';
+    else
+        out->directory[0] = '\0';
+
+    char cache_path[512];
+    snprintf(cache_path, sizeof(cache_path), "%s.cache", path);
+
+    if (mesh_cache_load(job, cache_path))
+        return;
 
+    // Stage 1: parse
     cgltf_options options;
     memset(&options, 0, sizeof(options));
     cgltf_data* data = 0;
@@ -537,44 +1548,187 @@ void mesh_load(Mesh* out, const char* path)
     cgltf_call(cgltf_parse_file(&options, path, &data));
     cgltf_call(cgltf_load_buffers(&options, data, path));
     cgltf_scene* scene = data->scene;
-    
-    const char* ch = "/";
-    char* ptr = strstr(path, ch);
-    ptr += sizeof(char);
-    strncpy(ptr, "", strlen(ptr));
-    out->directory = (char*)path;
-
-    u32 pi = 0;
+
+    mesh_build* build = &job->build;
+    build->data = data;
+    build->primitives = calloc(MAX_PRIMITIVES, sizeof(primitive_build));
+    build->material_remap = malloc(max(data->materials_count, 1) * sizeof(i32));
+    memset(build->material_remap, 0xff, max(data->materials_count, 1) * sizeof(i32));
+
     for (i32 ni = 0; ni < scene->nodes_count; ni++)
-        cgltf_process_node(scene->nodes[ni], &pi, out);
+        cgltf_process_node(scene->nodes[ni], build);
+
+    // Stage 2 + 3: per-primitive CPU work and texture decode, all in flight at once
+    JobCounter counter = {0};
+
+    mesh_acquire_textures(out);
+
+    if (MULTITHREADING_ENABLED)
+        job_submit_batch(mesh_build_primitive, build->primitives, sizeof(primitive_build), build->primitive_count, &counter);
+    else
+        for (u32 i = 0; i < build->primitive_count; i++)
+            mesh_build_primitive(&build->primitives[i]);
+
+    job_wait(&counter);
+    mesh_wait_textures(out);
 
-    cgltf_free(data);
+    mesh_cache_write(build, path, cache_path);
+}
+
+// Stage 4 on the thread owning the RHI. Without upload the decoded data is just dropped.
+void mesh_load_finish(mesh_load_job* job, b32 upload)
+{
+    mesh_build* build = &job->build;
+
+    if (upload)
+    {
+        mesh_upload(job->mesh, build->primitives, build->primitive_count);
+    }
+    else
+    {
+        mesh_release_textures(job->mesh);
+    }
+
+    for (u32 i = 0; i < build->primitive_count; i++)
+        release_primitive_build(&build->primitives[i]);
+
+    free(build->material_remap);
+    free(build->primitives);
+    if (build->data)
+        cgltf_free(build->data);
+    if (job->blob)
+        aurora_platform_unmap_file(job->blob, job->blob_size);
+
+    memset(job, 0, sizeof(mesh_load_job));
+}
+
+void mesh_load(Mesh* out, const char* path)
+{
+    mesh_load_job job;
+    memset(&job, 0, sizeof(job));
+    job.mesh = out;
+    strncpy(job.path, path, sizeof(job.path) - 1);
+
+    mesh_load_prepare(&job);
+    mesh_load_finish(&job, 1);
+}
+
+MeshLoadHandle mesh_load_async(Mesh* out, const char* path)
+{
+    for (u32 i = 0; i < MESH_MAX_ASYNC_LOADS; i++)
+    {
+        mesh_load_request* request = &s_requests[i];
+        if (request->active)
+            continue;
+
+        request->active = 1;
+        request->generation++;
+        memset(&request->counter, 0, sizeof(JobCounter));
+        request->job.mesh = out;
+        strncpy(request->job.path, path, sizeof(request->job.path) - 1);
+
+        if (MULTITHREADING_ENABLED)
+            job_submit(mesh_load_prepare, &request->job, &request->counter);
+        else
+            mesh_load_prepare(&request->job);
+
+        return (request->generation << 8) | (i + 1);
+    }
+
+    return 0;
+}
+
+b32 mesh_load_resident(MeshLoadHandle handle)
+{
+    u32 slot = handle & 0xff;
+    if (slot == 0 || slot > MESH_MAX_ASYNC_LOADS)
+        return 0;
+
+    // The slot is recycled once the mesh is published, so an older generation means resident
+    mesh_load_request* request = &s_requests[slot - 1];
+    return !request->active || request->generation != (handle >> 8);
+}
+
+u32 mesh_loader_update(Mesh** resident, u32 max_resident)
+{
+    u32 count = 0;
+
+    for (u32 i = 0; i < MESH_MAX_ASYNC_LOADS && count < max_resident; i++)
+    {
+        mesh_load_request* request = &s_requests[i];
+        if (!request->active || !job_done(&request->counter))
+            continue;
+
+        Mesh* mesh = request->job.mesh;
+        mesh_load_finish(&request->job, 1);
+        request->active = 0;
+        resident[count++] = mesh;
+    }
+
+    mesh_texture_stream();
+    return count;
 }
 
 void mesh_free(Mesh* m)
 {
     for (i32 i = 0; i < m->primitive_count; i++)
     {
-        rhi_free_buffer(&m->primitives[i].meshlet_buffer);
+        for (u32 l = 0; l < m->primitives[i].lod_count; l++)
+        {
+            PrimitiveLod* lod = &m->primitives[i].lods[l];
+            rhi_free_buffer(&lod->meshlet_index_buffer);
+            rhi_free_buffer(&lod->meshlet_vertex_buffer);
+            rhi_free_buffer(&lod->meshlet_buffer);
+            rhi_free_descriptor_set(&lod->geometry_descriptor_set);
+        }
         rhi_free_buffer(&m->primitives[i].index_buffer);
         rhi_free_buffer(&m->primitives[i].vertex_buffer);
-        rhi_free_descriptor_set(&m->primitives[i].geometry_descriptor_set);
     }
 
     for (i32 i = 0; i < m->material_count; i++)
     {
-        if (m->materials[i].albedo.image != VK_NULL_HANDLE)
-        {
-            rhi_free_image(&m->materials[i].albedo);
+        if (m->materials[i].albedo_sampler.sampler != VK_NULL_HANDLE)
             rhi_free_sampler(&m->materials[i].albedo_sampler);
-        }
-        if (m->materials[i].normal.image != VK_NULL_HANDLE)
-            rhi_free_image(&m->materials[i].normal);
-        if (m->materials[i].metallic_roughness.image != VK_NULL_HANDLE)
-            rhi_free_image(&m->materials[i].metallic_roughness);
         rhi_free_buffer(&m->materials[i].material_buffer);
         rhi_free_descriptor_set(&m->materials[i].material_set);
     }
+
+    // Images shared with other meshes stay alive until their last reference goes
+    mesh_release_textures(m);
+}
+
+void mesh_loader_free()
+{
+    // Requests still in flight are finished on the CPU and dropped, their meshes never became visible
+    for (u32 i = 0; i < MESH_MAX_ASYNC_LOADS; i++)
+    {
+        if (!s_requests[i].active)
+            continue;
+
+        job_wait(&s_requests[i].counter);
+        mesh_load_finish(&s_requests[i].job, 0);
+        s_requests[i].active = 0;
+    }
+
+    for (u32 i = 0; i < MESH_MAX_TEXTURES; i++)
+    {
+        mesh_texture* texture = &s_textures[i];
+        if (!texture->streaming)
+            continue;
+
+        job_wait(&texture->streamed);
+        rhi_free_staging(&texture->stream_staging);
+        texture->streaming = 0;
+        if (texture->refs == 0)
+        {
+            texture_free(&texture->source);
+            memset(texture, 0, sizeof(mesh_texture));
+        }
+    }
+
+    rhi_free_descriptor_set_layout(&s_meshlet_set_layout);
+    rhi_free_descriptor_set_layout(&s_descriptor_set_layout);
+    aurora_platform_free_mutex(s_texture_lock);
 }
 
 void mesh_loader_set_sampler_heap(RHI_DescriptorHeap* heap)
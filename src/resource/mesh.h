@@ -7,10 +7,33 @@
 #include <HandmadeMath.h>
 
 #define MULTITHREADING_ENABLED 1
+// 16 byte vertices on the GPU instead of 32, keep in sync with QUANTIZED_VERTICES in gbuffer.mesh
+#define MESH_QUANTIZED_VERTICES 1
+// Tipsify + first-use vertex order before meshlets are built
+#define MESH_OPTIMIZE_VERTEX_ORDER 1
+// LOD 0 is the source mesh, each level after it aims for half the triangles of the previous one
+#define MESH_MAX_LODS 6
+// Build a meshlet hierarchy in LOD 0 and let the task shader pick the cut per cluster, instead of a LOD chain
+#define MESH_CLUSTER_LOD 1
 #define MAX_PRIMITIVES 128
+// mesh_load_async requests that can be in flight at once
+#define MESH_MAX_ASYNC_LOADS 32
+// Distinct texture files alive at once across every loaded mesh
+#define MESH_MAX_TEXTURES 1024
+// Textures go up with their mip tail only (largest level at most MESH_TEXTURE_TAIL_SIZE) and larger levels
+// stream in as materials are drawn bigger on screen. Past MESH_TEXTURE_BUDGET bytes of resident levels the
+// ones covering the fewest pixels per texel are dropped first. 0 uploads every level right away.
+#define MESH_TEXTURE_STREAMING 1
+#define MESH_TEXTURE_TAIL_SIZE 64
+// Tails up to this size are read by the decode job, larger ones straight into staging memory at upload
+#define MESH_TEXTURE_TAIL_READ_BYTES (64ull << 10)
+#define MESH_TEXTURE_BUDGET (512ull << 20)
+// Streamed in level bytes per frame, the first level a frame picks always goes through
+#define MESH_TEXTURE_STREAM_BYTES_PER_FRAME (32ull << 20)
 #define MAX_MESHLET_VERTICES 64
 #define MAX_MESHLET_INDICES 372
 #define MAX_MESHLET_TRIANGLES 124
+#define MESHLET_TASK_GROUP_SIZE 32
 
 typedef struct Vertex Vertex;
 struct Vertex
@@ -20,14 +43,41 @@ struct Vertex
     hmm_vec3 normals;
 };
 
+// Position as unorm16 inside the primitive AABB, octahedral snorm16 normal, half float uv
+typedef struct PackedVertex PackedVertex;
+struct PackedVertex
+{
+    u16 position[3];
+    u16 pad;
+    i16 normal[2];
+    u16 uv[2];
+};
+
+#if MESH_QUANTIZED_VERTICES
+typedef PackedVertex GPUVertex;
+#else
+typedef Vertex GPUVertex;
+#endif
+
 #pragma pack(push, 16)
 typedef struct Meshlet Meshlet;
 struct Meshlet
 {
     hmm_vec4 sphere;
-
-    u32 vertices[MAX_MESHLET_VERTICES];
-    u8 indices[MAX_MESHLET_INDICES];
+    // Normal cone: axis in xyz, w = sin of the cone half angle, 1 when the cluster can't be backface culled
+    hmm_vec4 cone;
+
+    // Cluster LOD: bounds and error of the group this meshlet was simplified from (zero error at the finest
+    // level), and of the group that replaces it one level up (FLT_MAX error for roots). Errors are object
+    // space distances and grow monotonically towards the roots, so exactly one level passes the cut.
+    hmm_vec4 lod_bounds;
+    hmm_vec4 parent_bounds;
+    f32 lod_error;
+    f32 parent_error;
+
+    // First entry in the primitive's meshlet vertex pool, byte offset (4 aligned) into its micro-index pool
+    u32 vertex_offset;
+    u32 index_offset;
     u8 vertex_count;
     u8 triangle_count;
 };
@@ -43,19 +93,15 @@ struct GLTFMaterial
     b32 has_normal;
     b32 has_metallic;
 
-    RHI_RawImage raw_color;
-    RHI_RawImage raw_normal;
-    RHI_RawImage raw_pbr;
+    // Texture cache handles, 0 when the material doesn't reference the texture
+    u32 albedo_texture;
+    u32 normal_texture;
+    u32 metallic_roughness_texture;
 
-    RHI_Image albedo;
     i32 albedo_bindless_index;
     RHI_Sampler albedo_sampler;
     i32 albedo_sampler_index;
-
-    RHI_Image normal;
     i32 normal_bindless_index;
-
-    RHI_Image metallic_roughness;
     i32 metallic_roughness_index;
 
     hmm_vec3 base_color_factor;
@@ -66,13 +112,46 @@ struct GLTFMaterial
     RHI_DescriptorSet material_set;
 };
 
+// gbuffer per-draw uniforms (set 6, written to the frame ring), position = offset + quantized * scale
+typedef struct PrimitiveConstants PrimitiveConstants;
+struct PrimitiveConstants
+{
+    hmm_mat4 transform;
+    hmm_vec4 position_offset;
+    hmm_vec4 position_scale;
+    // Inverse transpose of the upper 3x3 of transform, laid out as a std140 mat3. Filled in per draw with
+    // lod_scale and mean_scale, so no shader invocation has to invert it.
+    hmm_vec4 normal_matrix[3];
+    // Object space error * lod_scale / distance = error in units of the allowed pixel error
+    f32 lod_scale;
+    // Average length of the transform's axes, scales meshlet bounds and errors to world space
+    f32 mean_scale;
+    f32 pad[2];
+};
+
+// Meshlets of one simplification level, all levels share the primitive's vertex buffer
+typedef struct PrimitiveLod PrimitiveLod;
+struct PrimitiveLod
+{
+    RHI_Buffer meshlet_buffer;
+    RHI_Buffer meshlet_vertex_buffer;
+    RHI_Buffer meshlet_index_buffer;
+    RHI_DescriptorSet geometry_descriptor_set;
+
+    u32 meshlet_count;
+    u32 triangle_count;
+    // Object space distance from LOD 0
+    f32 error;
+};
+
 typedef struct Primitive Primitive;
 struct Primitive
 {
     RHI_Buffer vertex_buffer;
     RHI_Buffer index_buffer;
-    RHI_Buffer meshlet_buffer;
-    RHI_DescriptorSet geometry_descriptor_set;
+
+    PrimitiveLod lods[MESH_MAX_LODS];
+    u32 lod_count;
 
     u32 vertex_size;
     u32 index_size;
@@ -83,7 +162,9 @@ struct Primitive
     u32 meshlet_count;
     u32 material_index;
 
-    hmm_mat4 transform;
+    // Object space bounding sphere, used for LOD selection
+    hmm_vec4 bounds;
+    PrimitiveConstants constants;
 };
 
 typedef struct Mesh Mesh;
@@ -100,7 +181,7 @@ struct Mesh
     u32 total_triangle_count;
     u32 total_meshlet_count;
 
-    char* directory;
+    char directory[512];
 };
 
 void mesh_loader_init(i32 dset_layout_binding);
@@ -109,7 +190,23 @@ RHI_DescriptorSetLayout* mesh_loader_get_descriptor_set_layout();
 RHI_DescriptorSetLayout* mesh_loader_get_geometry_descriptor_set_layout();
 void mesh_loader_set_texture_heap(RHI_DescriptorHeap* heap);
 void mesh_loader_set_sampler_heap(RHI_DescriptorHeap* heap);
+// Returned by mesh_load_async, 0 is never a valid handle
+typedef u32 MeshLoadHandle;
+
 void mesh_load(Mesh* out, const char* path);
+// Parses, builds and decodes on the job system and returns right away. out must stay alive until it is
+// published by mesh_loader_update. Returns 0 when MESH_MAX_ASYNC_LOADS requests are already in flight.
+MeshLoadHandle mesh_load_async(Mesh* out, const char* path);
+b32 mesh_load_resident(MeshLoadHandle handle);
+// Call at a frame boundary on the thread owning the RHI. Uploads every request whose CPU work is done and
+// writes the meshes that became resident to resident, up to max_resident per call. Also moves streamed
+// texture levels in and out from what the last frame asked for.
+u32 mesh_loader_update(Mesh** resident, u32 max_resident);
+// Something drawn with the material covers pixels across on screen this frame, call while recording
+void mesh_request_material_textures(GLTFMaterial* material, f32 pixels);
 void mesh_free(Mesh* m);
 
+// FNV-1a over size bytes, chained through hash. Also keys the cooked texture cache.
+u64 fnv1a_64(const u8* data, u64 size, u64 hash);
+
 #endif
\ No newline at end of file
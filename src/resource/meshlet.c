@@ -0,0 +1,976 @@
+#include "meshlet.h"
+#include "simplify.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+typedef struct aabb aabb;
+struct aabb
+{
+    hmm_vec3 min;
+    hmm_vec3 max;
+};
+
+// Full size meshlet the builders fill in before it gets packed into the pools
+typedef struct meshlet_scratch meshlet_scratch;
+struct meshlet_scratch
+{
+    u32 vertices[MAX_MESHLET_VERTICES];
+    u8 indices[MAX_MESHLET_INDICES];
+    u8 vertex_count;
+    u8 triangle_count;
+};
+
+typedef struct meshlet_vector meshlet_vector;
+struct meshlet_vector
+{
+    MeshletData data;
+    u32 meshlet_size;
+    u32 vertex_size;
+    u32 index_size;
+};
+
+internal void init_meshlet_vector(meshlet_vector* vec, u32 start_size)
+{
+    memset(vec, 0, sizeof(meshlet_vector));
+    vec->meshlet_size = start_size;
+    vec->vertex_size = start_size * MAX_MESHLET_VERTICES;
+    vec->index_size = start_size * MAX_MESHLET_INDICES;
+    vec->data.meshlets = calloc(vec->meshlet_size, sizeof(Meshlet));
+    vec->data.vertices = malloc(vec->vertex_size * sizeof(u32));
+    vec->data.indices = malloc(vec->index_size * sizeof(u8));
+}
+
+internal void push_meshlet(meshlet_vector* vec, meshlet_scratch* m)
+{
+    MeshletData* data = &vec->data;
+
+    // Every run of micro-indices starts 4 byte aligned so the mesh shader can read them as packed uints
+    u32 index_bytes = (m->triangle_count * 3 + 3) & ~3u;
+
+    if (data->meshlet_count >= vec->meshlet_size)
+    {
+        vec->meshlet_size *= 2;
+        data->meshlets = realloc(data->meshlets, vec->meshlet_size * sizeof(Meshlet));
+    }
+    if (data->vertex_count + MAX_MESHLET_VERTICES > vec->vertex_size)
+    {
+        vec->vertex_size *= 2;
+        data->vertices = realloc(data->vertices, vec->vertex_size * sizeof(u32));
+    }
+    if (data->index_size + MAX_MESHLET_INDICES > vec->index_size)
+    {
+        vec->index_size *= 2;
+        data->indices = realloc(data->indices, vec->index_size * sizeof(u8));
+    }
+
+    Meshlet* ml = &data->meshlets[data->meshlet_count++];
+    memset(ml, 0, sizeof(Meshlet));
+    ml->vertex_offset = data->vertex_count;
+    ml->index_offset = data->index_size;
+    ml->vertex_count = m->vertex_count;
+    ml->triangle_count = m->triangle_count;
+    ml->parent_error = FLT_MAX;
+
+    memcpy(data->vertices + data->vertex_count, m->vertices, m->vertex_count * sizeof(u32));
+    memset(data->indices + data->index_size, 0, index_bytes);
+    memcpy(data->indices + data->index_size, m->indices, m->triangle_count * 3);
+
+    data->vertex_count += m->vertex_count;
+    data->index_size += index_bytes;
+}
+
+// Vertex -> triangles list, CSR style
+typedef struct triangle_adjacency triangle_adjacency;
+struct triangle_adjacency
+{
+    u32* counts;
+    u32* offsets;
+    u32* triangles;
+};
+
+// Triangle centroids hashed into cells of roughly one meshlet radius, used to find the nearest
+// unused triangle once a meshlet has run out of connected neighbours
+typedef struct triangle_grid triangle_grid;
+struct triangle_grid
+{
+    u32* heads;
+    u32* next;
+    u32 mask;
+    f32 inv_cell_size;
+};
+
+typedef struct meshlet_builder meshlet_builder;
+struct meshlet_builder
+{
+    const u32* indices;
+    u32 triangle_count;
+
+    triangle_adjacency adjacency;
+    triangle_grid grid;
+    hmm_vec3* centroids;
+    u8* emitted;
+    f32 expected_radius;
+
+    // Local index of each vertex in the current meshlet, 0xff if not in it
+    u8* meshlet_vertices;
+    meshlet_scratch current;
+    hmm_vec3 centroid_sum;
+};
+
+internal void build_adjacency(triangle_adjacency* adjacency, const u32* indices, u32 index_count, u32 vertex_count)
+{
+    adjacency->counts = calloc(vertex_count, sizeof(u32));
+    adjacency->offsets = malloc(vertex_count * sizeof(u32));
+    adjacency->triangles = malloc(index_count * sizeof(u32));
+
+    for (u32 i = 0; i < index_count; i++)
+        adjacency->counts[indices[i]]++;
+
+    u32 offset = 0;
+    for (u32 i = 0; i < vertex_count; i++)
+    {
+        adjacency->offsets[i] = offset;
+        offset += adjacency->counts[i];
+    }
+
+    for (u32 i = 0; i < index_count; i++)
+    {
+        u32 v = indices[i];
+        adjacency->triangles[adjacency->offsets[v]++] = i / 3;
+    }
+
+    // Rewind the offsets after using them as write cursors
+    for (u32 i = 0; i < vertex_count; i++)
+        adjacency->offsets[i] -= adjacency->counts[i];
+}
+
+internal u32 grid_hash(i32 x, i32 y, i32 z, u32 mask)
+{
+    return ((u32)x * 73856093u ^ (u32)y * 19349663u ^ (u32)z * 83492791u) & mask;
+}
+
+internal i32 grid_coord(f32 v, f32 inv_cell_size)
+{
+    return (i32)floorf(v * inv_cell_size);
+}
+
+internal void build_grid(triangle_grid* grid, const hmm_vec3* centroids, u32 triangle_count, f32 cell_size)
+{
+    u32 bucket_count = 1;
+    while (bucket_count < triangle_count)
+        bucket_count <<= 1;
+
+    grid->mask = bucket_count - 1;
+    grid->inv_cell_size = 1.0f / cell_size;
+    grid->heads = malloc(bucket_count * sizeof(u32));
+    grid->next = malloc(triangle_count * sizeof(u32));
+    memset(grid->heads, 0xff, bucket_count * sizeof(u32));
+
+    // Walk backwards so each bucket lists its triangles in index order
+    for (u32 t = triangle_count; t-- > 0;)
+    {
+        u32 bucket = grid_hash(grid_coord(centroids[t].X, grid->inv_cell_size), grid_coord(centroids[t].Y, grid->inv_cell_size), grid_coord(centroids[t].Z, grid->inv_cell_size), grid->mask);
+        grid->next[t] = grid->heads[bucket];
+        grid->heads[bucket] = t;
+    }
+}
+
+internal u32 triangle_extra_vertices(meshlet_builder* builder, u32 triangle)
+{
+    u32 a = builder->indices[triangle * 3 + 0];
+    u32 b = builder->indices[triangle * 3 + 1];
+    u32 c = builder->indices[triangle * 3 + 2];
+
+    return (builder->meshlet_vertices[a] == 0xff)
+         + (builder->meshlet_vertices[b] == 0xff && b != a)
+         + (builder->meshlet_vertices[c] == 0xff && c != a && c != b);
+}
+
+internal b32 triangle_fits(meshlet_builder* builder, u32 extra)
+{
+    return builder->current.vertex_count + extra <= MAX_MESHLET_VERTICES && builder->current.triangle_count < MAX_MESHLET_TRIANGLES;
+}
+
+// Reusing vertices keeps the meshlet dense, staying close to its centre keeps the sphere tight
+internal f32 triangle_cost(meshlet_builder* builder, u32 triangle, u32 extra, hmm_vec3 center)
+{
+    f32 distance = HMM_DistanceVec3(builder->centroids[triangle], center) / builder->expected_radius;
+    return (f32)extra + MESHLET_SPATIAL_WEIGHT * distance;
+}
+
+internal hmm_vec3 meshlet_center(meshlet_builder* builder)
+{
+    return HMM_DivideVec3f(builder->centroid_sum, (f32)builder->current.triangle_count);
+}
+
+internal i64 find_connected_triangle(meshlet_builder* builder)
+{
+    meshlet_scratch* ml = &builder->current;
+    hmm_vec3 center = meshlet_center(builder);
+
+    i64 best = -1;
+    f32 best_cost = FLT_MAX;
+
+    for (u32 i = 0; i < ml->vertex_count; i++)
+    {
+        u32 v = ml->vertices[i];
+        const u32* neighbours = &builder->adjacency.triangles[builder->adjacency.offsets[v]];
+
+        for (u32 j = 0; j < builder->adjacency.counts[v]; j++)
+        {
+            u32 t = neighbours[j];
+            if (builder->emitted[t])
+                continue;
+
+            u32 extra = triangle_extra_vertices(builder, t);
+            if (!triangle_fits(builder, extra))
+                continue;
+
+            f32 cost = triangle_cost(builder, t, extra, center);
+            if (cost < best_cost)
+            {
+                best = t;
+                best_cost = cost;
+            }
+        }
+    }
+
+    return best;
+}
+
+internal i64 find_nearby_triangle(meshlet_builder* builder)
+{
+    hmm_vec3 center = meshlet_center(builder);
+    triangle_grid* grid = &builder->grid;
+
+    i32 cx = grid_coord(center.X, grid->inv_cell_size);
+    i32 cy = grid_coord(center.Y, grid->inv_cell_size);
+    i32 cz = grid_coord(center.Z, grid->inv_cell_size);
+
+    i64 best = -1;
+    f32 best_cost = FLT_MAX;
+
+    for (i32 z = cz - 1; z <= cz + 1; z++)
+    for (i32 y = cy - 1; y <= cy + 1; y++)
+    for (i32 x = cx - 1; x <= cx + 1; x++)
+    {
+        for (u32 t = grid->heads[grid_hash(x, y, z, grid->mask)]; t != 0xffffffff; t = grid->next[t])
+        {
+            if (builder->emitted[t])
+                continue;
+
+            // Hash collisions can bring in far away cells, anything outside the meshlet radius is a new meshlet
+            if (HMM_DistanceVec3(builder->centroids[t], center) > builder->expected_radius)
+                continue;
+
+            u32 extra = triangle_extra_vertices(builder, t);
+            if (!triangle_fits(builder, extra))
+                continue;
+
+            f32 cost = triangle_cost(builder, t, extra, center);
+            if (cost < best_cost)
+            {
+                best = t;
+                best_cost = cost;
+            }
+        }
+    }
+
+    return best;
+}
+
+internal void add_triangle(meshlet_builder* builder, u32 triangle)
+{
+    meshlet_scratch* ml = &builder->current;
+
+    for (u32 k = 0; k < 3; k++)
+    {
+        u32 v = builder->indices[triangle * 3 + k];
+
+        if (builder->meshlet_vertices[v] == 0xff)
+        {
+            builder->meshlet_vertices[v] = ml->vertex_count;
+            ml->vertices[ml->vertex_count++] = v;
+        }
+
+        ml->indices[ml->triangle_count * 3 + k] = builder->meshlet_vertices[v];
+    }
+
+    ml->triangle_count++;
+    builder->emitted[triangle] = 1;
+    builder->centroid_sum = HMM_AddVec3(builder->centroid_sum, builder->centroids[triangle]);
+}
+
+internal void flush_meshlet(meshlet_builder* builder, meshlet_vector* vec)
+{
+    meshlet_scratch* ml = &builder->current;
+
+    if (ml->triangle_count)
+        push_meshlet(vec, ml);
+
+    for (u32 i = 0; i < ml->vertex_count; i++)
+        builder->meshlet_vertices[ml->vertices[i]] = 0xff;
+
+    memset(ml, 0, sizeof(meshlet_scratch));
+    builder->centroid_sum = HMM_Vec3(0.0f, 0.0f, 0.0f);
+}
+
+internal u32 meshlet_build_locality(meshlet_vector* vec, const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count)
+{
+    meshlet_builder builder;
+    memset(&builder, 0, sizeof(builder));
+    builder.indices = indices;
+    builder.triangle_count = index_count / 3;
+
+    if (builder.triangle_count == 0)
+        return 0;
+
+    builder.centroids = malloc(builder.triangle_count * sizeof(hmm_vec3));
+    builder.emitted = calloc(builder.triangle_count, sizeof(u8));
+    builder.meshlet_vertices = malloc(vertex_count * sizeof(u8));
+    memset(builder.meshlet_vertices, 0xff, vertex_count * sizeof(u8));
+
+    f64 area_sum = 0.0;
+    for (u32 t = 0; t < builder.triangle_count; t++)
+    {
+        hmm_vec3 a = vertices[indices[t * 3 + 0]].position;
+        hmm_vec3 b = vertices[indices[t * 3 + 1]].position;
+        hmm_vec3 c = vertices[indices[t * 3 + 2]].position;
+
+        builder.centroids[t] = HMM_DivideVec3f(HMM_AddVec3(HMM_AddVec3(a, b), c), 3.0f);
+        area_sum += 0.5f * HMM_LengthVec3(HMM_Cross(HMM_SubtractVec3(b, a), HMM_SubtractVec3(c, a)));
+    }
+
+    // Radius of a disc holding a full meshlet of average sized triangles, the unit for the spatial cost
+    f32 average_area = (f32)(area_sum / builder.triangle_count);
+    builder.expected_radius = sqrtf(average_area * MAX_MESHLET_TRIANGLES / HMM_PI32);
+    if (!(builder.expected_radius > FLT_EPSILON))
+        builder.expected_radius = 1.0f;
+
+    build_adjacency(&builder.adjacency, indices, builder.triangle_count * 3, vertex_count);
+    build_grid(&builder.grid, builder.centroids, builder.triangle_count, builder.expected_radius);
+
+    u32 cursor = 0;
+    u32 remaining = builder.triangle_count;
+
+    while (remaining > 0)
+    {
+        i64 next = -1;
+
+        if (builder.current.triangle_count > 0)
+        {
+            next = find_connected_triangle(&builder);
+            if (next < 0)
+                next = find_nearby_triangle(&builder);
+
+            if (next < 0)
+            {
+                flush_meshlet(&builder, vec);
+                continue;
+            }
+        }
+        else
+        {
+            while (builder.emitted[cursor])
+                cursor++;
+            next = cursor;
+        }
+
+        add_triangle(&builder, (u32)next);
+        remaining--;
+    }
+
+    flush_meshlet(&builder, vec);
+
+    free(builder.grid.next);
+    free(builder.grid.heads);
+    free(builder.adjacency.triangles);
+    free(builder.adjacency.offsets);
+    free(builder.adjacency.counts);
+    free(builder.meshlet_vertices);
+    free(builder.emitted);
+    free(builder.centroids);
+
+    return vec->data.meshlet_count;
+}
+
+internal u32 meshlet_build_scan(meshlet_vector* vec, u32 vertex_count, const u32* indices, u32 index_count)
+{
+    u8* meshlet_vertices = (u8*)malloc(sizeof(u8) * vertex_count);
+    memset(meshlet_vertices, 0xff, sizeof(u8) * vertex_count);
+
+    meshlet_scratch ml;
+    memset(&ml, 0, sizeof(ml));
+
+    for (u32 i = 0; i + 2 < index_count; i += 3)
+    {
+        u32 a = indices[i + 0];
+        u32 b = indices[i + 1];
+        u32 c = indices[i + 2];
+
+        u32 used_extra = (meshlet_vertices[a] == 0xff) + (meshlet_vertices[b] == 0xff) + (meshlet_vertices[c] == 0xff);
+
+        if (ml.vertex_count + used_extra > MAX_MESHLET_VERTICES || ml.triangle_count >= MAX_MESHLET_TRIANGLES)
+        {
+            push_meshlet(vec, &ml);
+
+            for (u32 j = 0; j < ml.vertex_count; ++j)
+                meshlet_vertices[ml.vertices[j]] = 0xff;
+
+            memset(&ml, 0, sizeof(ml));
+        }
+
+        if (meshlet_vertices[a] == 0xff)
+        {
+            meshlet_vertices[a] = ml.vertex_count;
+            ml.vertices[ml.vertex_count++] = a;
+        }
+
+        if (meshlet_vertices[b] == 0xff)
+        {
+            meshlet_vertices[b] = ml.vertex_count;
+            ml.vertices[ml.vertex_count++] = b;
+        }
+
+        if (meshlet_vertices[c] == 0xff)
+        {
+            meshlet_vertices[c] = ml.vertex_count;
+            ml.vertices[ml.vertex_count++] = c;
+        }
+
+        ml.indices[ml.triangle_count * 3 + 0] = meshlet_vertices[a];
+        ml.indices[ml.triangle_count * 3 + 1] = meshlet_vertices[b];
+        ml.indices[ml.triangle_count * 3 + 2] = meshlet_vertices[c];
+        ml.triangle_count++;
+    }
+
+    if (ml.triangle_count)
+        push_meshlet(vec, &ml);
+
+    free(meshlet_vertices);
+    return vec->data.meshlet_count;
+}
+
+void meshlet_build(MeshletData* out, const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count)
+{
+    meshlet_vector vec;
+    init_meshlet_vector(&vec, 256);
+
+    if (MESHLET_LOCALITY_BUILDER)
+        meshlet_build_locality(&vec, vertices, vertex_count, indices, index_count);
+    else
+        meshlet_build_scan(&vec, vertex_count, indices, index_count);
+
+    *out = vec.data;
+}
+
+void meshlet_data_free(MeshletData* data)
+{
+    free(data->indices);
+    free(data->vertices);
+    free(data->meshlets);
+    memset(data, 0, sizeof(MeshletData));
+}
+
+internal void meshlet_vector_append(meshlet_vector* vec, const MeshletData* src)
+{
+    MeshletData* data = &vec->data;
+
+    while (data->meshlet_count + src->meshlet_count > vec->meshlet_size)
+        vec->meshlet_size *= 2;
+    while (data->vertex_count + src->vertex_count > vec->vertex_size)
+        vec->vertex_size *= 2;
+    while (data->index_size + src->index_size > vec->index_size)
+        vec->index_size *= 2;
+
+    data->meshlets = realloc(data->meshlets, vec->meshlet_size * sizeof(Meshlet));
+    data->vertices = realloc(data->vertices, vec->vertex_size * sizeof(u32));
+    data->indices = realloc(data->indices, vec->index_size * sizeof(u8));
+
+    for (u32 i = 0; i < src->meshlet_count; i++)
+    {
+        Meshlet* ml = &data->meshlets[data->meshlet_count + i];
+        *ml = src->meshlets[i];
+        ml->vertex_offset += data->vertex_count;
+        ml->index_offset += data->index_size;
+    }
+
+    memcpy(data->vertices + data->vertex_count, src->vertices, src->vertex_count * sizeof(u32));
+    memcpy(data->indices + data->index_size, src->indices, src->index_size);
+
+    data->meshlet_count += src->meshlet_count;
+    data->vertex_count += src->vertex_count;
+    data->index_size += src->index_size;
+}
+
+internal hmm_vec4 merge_spheres(hmm_vec4 a, hmm_vec4 b)
+{
+    f32 distance = HMM_DistanceVec3(a.XYZ, b.XYZ);
+
+    if (distance + b.W <= a.W)
+        return a;
+    if (distance + a.W <= b.W)
+        return b;
+
+    f32 radius = (a.W + distance + b.W) * 0.5f;
+    hmm_vec3 direction = HMM_DivideVec3f(HMM_SubtractVec3(b.XYZ, a.XYZ), distance);
+    hmm_vec3 center = HMM_AddVec3(a.XYZ, HMM_MultiplyVec3f(direction, radius - a.W));
+
+    return HMM_Vec4(center.X, center.Y, center.Z, radius);
+}
+
+internal u32 morton_part(u32 v)
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+internal int compare_u64(const void* a, const void* b)
+{
+    u64 ea = *(const u64*)a;
+    u64 eb = *(const u64*)b;
+    return ea < eb ? -1 : ea > eb;
+}
+
+// Meshlets of one level in Morton order of their centres, so consecutive runs make spatially tight groups
+internal void sort_level(u32* level, u32 count, const Meshlet* meshlets)
+{
+    hmm_vec3 bmin = HMM_Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    hmm_vec3 bmax = HMM_Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    for (u32 i = 0; i < count; i++)
+    {
+        hmm_vec3 c = meshlets[level[i]].sphere.XYZ;
+        bmin = HMM_Vec3(min(bmin.X, c.X), min(bmin.Y, c.Y), min(bmin.Z, c.Z));
+        bmax = HMM_Vec3(max(bmax.X, c.X), max(bmax.Y, c.Y), max(bmax.Z, c.Z));
+    }
+
+    f32 extent = max(max(bmax.X - bmin.X, bmax.Y - bmin.Y), max(bmax.Z - bmin.Z, FLT_EPSILON));
+    u64* keys = malloc(count * sizeof(u64));
+
+    for (u32 i = 0; i < count; i++)
+    {
+        hmm_vec3 c = HMM_DivideVec3f(HMM_SubtractVec3(meshlets[level[i]].sphere.XYZ, bmin), extent);
+        u32 code = morton_part((u32)(c.X * 1023.0f)) | (morton_part((u32)(c.Y * 1023.0f)) << 1) | (morton_part((u32)(c.Z * 1023.0f)) << 2);
+        keys[i] = ((u64)code << 32) | level[i];
+    }
+
+    qsort(keys, count, sizeof(u64), compare_u64);
+
+    for (u32 i = 0; i < count; i++)
+        level[i] = (u32)keys[i];
+
+    free(keys);
+}
+
+typedef struct position_key position_key;
+struct position_key
+{
+    f32 position[3];
+    u32 index;
+};
+
+internal int compare_position_key(const void* a, const void* b)
+{
+    const position_key* ka = (const position_key*)a;
+    const position_key* kb = (const position_key*)b;
+    int order = memcmp(ka->position, kb->position, sizeof(ka->position));
+    return order ? order : (ka->index > kb->index) - (ka->index < kb->index);
+}
+
+// Maps every vertex to the first vertex sharing its position, so meshlets on both sides of a UV or normal seam
+// still count as neighbours
+internal void weld_positions(u32* remap, const Vertex* vertices, u32 vertex_count)
+{
+    position_key* keys = malloc(max(vertex_count, 1) * sizeof(position_key));
+    for (u32 i = 0; i < vertex_count; i++)
+    {
+        memcpy(keys[i].position, &vertices[i].position, sizeof(keys[i].position));
+        keys[i].index = i;
+    }
+    qsort(keys, vertex_count, sizeof(position_key), compare_position_key);
+
+    for (u32 i = 0; i < vertex_count; i++)
+    {
+        b32 same = i > 0 && memcmp(keys[i].position, keys[i - 1].position, sizeof(keys[i].position)) == 0;
+        remap[keys[i].index] = same ? remap[keys[i - 1].index] : keys[i].index;
+    }
+
+    free(keys);
+}
+
+// Greedy groups of up to MESHLET_GROUP_SIZE meshlets: seeds in Morton order, then the meshlet sharing the most
+// vertices with the group so far. Fewer shared boundaries means less locked geometry when simplifying.
+// Meshlets without any neighbour left (islands, leftovers) take the next ones in Morton order instead.
+// level is reordered so each group is a contiguous run, group_offsets gets group_count + 1 entries.
+internal u32 group_level(u32* level, u32 level_count, u32* group_offsets, const MeshletData* data, const u32* remap, u32 vertex_count)
+{
+    sort_level(level, level_count, data->meshlets);
+
+    u32* offsets = calloc(vertex_count + 1, sizeof(u32));
+    for (u32 s = 0; s < level_count; s++)
+    {
+        const Meshlet* ml = &data->meshlets[level[s]];
+        for (u32 i = 0; i < ml->vertex_count; i++)
+            offsets[remap[data->vertices[ml->vertex_offset + i]] + 1]++;
+    }
+    for (u32 v = 0; v < vertex_count; v++)
+        offsets[v + 1] += offsets[v];
+
+    u32* slots = malloc(max(offsets[vertex_count], 1) * sizeof(u32));
+    u32* cursor = malloc(max(vertex_count, 1) * sizeof(u32));
+    memcpy(cursor, offsets, vertex_count * sizeof(u32));
+    for (u32 s = 0; s < level_count; s++)
+    {
+        const Meshlet* ml = &data->meshlets[level[s]];
+        for (u32 i = 0; i < ml->vertex_count; i++)
+            slots[cursor[remap[data->vertices[ml->vertex_offset + i]]]++] = s;
+    }
+
+    u8* assigned = calloc(level_count, sizeof(u8));
+    u32* score = calloc(level_count, sizeof(u32));
+    u32* scored = malloc(max(offsets[vertex_count], 1) * sizeof(u32));
+    u32* grouped = malloc(level_count * sizeof(u32));
+    u32 grouped_count = 0;
+    u32 group_count = 0;
+
+    for (u32 seed = 0; seed < level_count; seed++)
+    {
+        if (assigned[seed])
+            continue;
+
+        u32 group_begin = grouped_count;
+        group_offsets[group_count++] = group_begin;
+        grouped[grouped_count++] = seed;
+        assigned[seed] = 1;
+
+        while (grouped_count - group_begin < MESHLET_GROUP_SIZE)
+        {
+            u32 scored_count = 0;
+
+            for (u32 m = group_begin; m < grouped_count; m++)
+            {
+                const Meshlet* ml = &data->meshlets[level[grouped[m]]];
+                for (u32 i = 0; i < ml->vertex_count; i++)
+                {
+                    u32 v = remap[data->vertices[ml->vertex_offset + i]];
+                    for (u32 j = offsets[v]; j < offsets[v + 1]; j++)
+                    {
+                        u32 s = slots[j];
+                        if (assigned[s])
+                            continue;
+                        if (score[s]++ == 0)
+                            scored[scored_count++] = s;
+                    }
+                }
+            }
+
+            u32 best = 0xffffffff;
+            u32 best_score = 0;
+            for (u32 i = 0; i < scored_count; i++)
+            {
+                if (score[scored[i]] > best_score)
+                {
+                    best = scored[i];
+                    best_score = score[scored[i]];
+                }
+                score[scored[i]] = 0;
+            }
+
+            for (u32 s = seed + 1; best == 0xffffffff && s < level_count; s++)
+            {
+                if (!assigned[s])
+                    best = s;
+            }
+
+            if (best == 0xffffffff)
+                break;
+
+            grouped[grouped_count++] = best;
+            assigned[best] = 1;
+        }
+    }
+    group_offsets[group_count] = grouped_count;
+
+    for (u32 i = 0; i < level_count; i++)
+        grouped[i] = level[grouped[i]];
+    memcpy(level, grouped, level_count * sizeof(u32));
+
+    free(grouped);
+    free(scored);
+    free(score);
+    free(assigned);
+    free(cursor);
+    free(slots);
+    free(offsets);
+
+    return group_count;
+}
+
+void meshlet_build_hierarchy(MeshletData* out, const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count, b32 double_sided)
+{
+    meshlet_build(out, vertices, vertex_count, indices, index_count);
+    meshlet_compute_bounds(out, vertices, double_sided);
+
+    for (u32 i = 0; i < out->meshlet_count; i++)
+        out->meshlets[i].lod_bounds = out->meshlets[i].sphere;
+
+    meshlet_vector vec;
+    vec.data = *out;
+    vec.meshlet_size = max(out->meshlet_count, 1);
+    vec.vertex_size = max(out->vertex_count, 1);
+    vec.index_size = max(out->index_size, 1);
+
+    // Groups are simplified in their own compact vertex space, only their open boundary is locked
+    u32 group_index_capacity = MESHLET_GROUP_SIZE * MAX_MESHLET_INDICES;
+    u32* global_to_local = malloc(max(vertex_count, 1) * sizeof(u32));
+    memset(global_to_local, 0xff, max(vertex_count, 1) * sizeof(u32));
+    u32* local_to_global = malloc(MESHLET_GROUP_SIZE * MAX_MESHLET_VERTICES * sizeof(u32));
+    Vertex* local_vertices = malloc(MESHLET_GROUP_SIZE * MAX_MESHLET_VERTICES * sizeof(Vertex));
+    u32* group_indices = malloc(group_index_capacity * sizeof(u32));
+    u32* simplified = malloc(group_index_capacity * sizeof(u32));
+    // Meshlets still waiting for a parent. Groups that fail to simplify carry their meshlets over to the
+    // next level, where they get grouped with different neighbours.
+    u32 level_count = vec.data.meshlet_count;
+    u32* level = malloc(max(level_count, 1) * sizeof(u32));
+    u32* next_level = 0;
+    u32* group_offsets = 0;
+    u32* remap = malloc(max(vertex_count, 1) * sizeof(u32));
+    weld_positions(remap, vertices, vertex_count);
+    for (u32 i = 0; i < level_count; i++)
+        level[i] = i;
+
+    while (level_count > 1)
+    {
+        u32* order = level;
+        u32 next_count = 0;
+        next_level = realloc(next_level, level_count * sizeof(u32));
+        group_offsets = realloc(group_offsets, (level_count + 1) * sizeof(u32));
+        u32 group_count = group_level(order, level_count, group_offsets, &vec.data, remap, vertex_count);
+
+        b32 simplified_any = 0;
+
+        for (u32 gi = 0; gi < group_count; gi++)
+        {
+            u32 g = group_offsets[gi];
+            u32 member_count = group_offsets[gi + 1] - g;
+            u32 local_vertex_count = 0;
+            u32 group_index_count = 0;
+            hmm_vec4 bounds = vec.data.meshlets[order[g]].lod_bounds;
+            f32 child_error = 0.0f;
+
+            for (u32 m = 0; m < member_count; m++)
+            {
+                const Meshlet* ml = &vec.data.meshlets[order[g + m]];
+                bounds = merge_spheres(bounds, ml->lod_bounds);
+                child_error = max(child_error, ml->lod_error);
+
+                for (u32 k = 0; k < ml->triangle_count * 3u; k++)
+                {
+                    u32 v = vec.data.vertices[ml->vertex_offset + vec.data.indices[ml->index_offset + k]];
+                    if (global_to_local[v] == 0xffffffff)
+                    {
+                        global_to_local[v] = local_vertex_count;
+                        local_to_global[local_vertex_count] = v;
+                        local_vertices[local_vertex_count++] = vertices[v];
+                    }
+                    group_indices[group_index_count++] = global_to_local[v];
+                }
+            }
+
+            for (u32 i = 0; i < local_vertex_count; i++)
+                global_to_local[local_to_global[i]] = 0xffffffff;
+
+            f32 error = 0.0f;
+            u32 count = simplify_mesh(simplified, group_indices, group_index_count, local_vertices, local_vertex_count, group_index_count / 6 * 3, FLT_MAX, &error);
+
+            if (count == 0 || count > group_index_count * 17 / 20)
+            {
+                for (u32 m = 0; m < member_count; m++)
+                    next_level[next_count++] = order[g + m];
+                continue;
+            }
+
+            f32 group_error = child_error + error;
+
+            for (u32 m = 0; m < member_count; m++)
+            {
+                Meshlet* ml = &vec.data.meshlets[order[g + m]];
+                ml->parent_bounds = bounds;
+                ml->parent_error = group_error;
+            }
+
+            MeshletData group;
+            meshlet_build(&group, local_vertices, local_vertex_count, simplified, count);
+            for (u32 i = 0; i < group.vertex_count; i++)
+                group.vertices[i] = local_to_global[group.vertices[i]];
+            meshlet_compute_bounds(&group, vertices, double_sided);
+
+            for (u32 i = 0; i < group.meshlet_count; i++)
+            {
+                group.meshlets[i].lod_bounds = bounds;
+                group.meshlets[i].lod_error = group_error;
+            }
+
+            next_level = realloc(next_level, (next_count + group.meshlet_count + level_count) * sizeof(u32));
+            for (u32 i = 0; i < group.meshlet_count; i++)
+                next_level[next_count++] = vec.data.meshlet_count + i;
+
+            meshlet_vector_append(&vec, &group);
+            meshlet_data_free(&group);
+            simplified_any = 1;
+        }
+
+        if (!simplified_any)
+            break;
+
+        u32* swap = level;
+        level = next_level;
+        next_level = swap;
+        level_count = next_count;
+    }
+
+    free(remap);
+    free(group_offsets);
+    free(next_level);
+    free(level);
+    free(simplified);
+    free(group_indices);
+    free(local_vertices);
+    free(local_to_global);
+    free(global_to_local);
+
+    *out = vec.data;
+}
+
+internal hmm_vec4 meshlet_compute_cone(const Meshlet* ml, const u32* ml_vertices, const u8* ml_indices, const Vertex* vertices)
+{
+    hmm_vec4 cone = HMM_Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+    hmm_vec3 normals[MAX_MESHLET_TRIANGLES];
+    u32 normal_count = 0;
+    hmm_vec3 normal_sum = HMM_Vec3(0.0f, 0.0f, 0.0f);
+
+    for (u32 t = 0; t < ml->triangle_count; t++)
+    {
+        hmm_vec3 a = vertices[ml_vertices[ml_indices[t * 3 + 0]]].position;
+        hmm_vec3 b = vertices[ml_vertices[ml_indices[t * 3 + 1]]].position;
+        hmm_vec3 c = vertices[ml_vertices[ml_indices[t * 3 + 2]]].position;
+
+        hmm_vec3 n = HMM_Cross(HMM_SubtractVec3(b, a), HMM_SubtractVec3(c, a));
+        f32 length = HMM_LengthVec3(n);
+        if (length <= FLT_EPSILON)
+            continue;
+
+        normals[normal_count] = HMM_DivideVec3f(n, length);
+        normal_sum = HMM_AddVec3(normal_sum, normals[normal_count]);
+        normal_count++;
+    }
+
+    f32 axis_length = HMM_LengthVec3(normal_sum);
+    if (normal_count == 0 || axis_length <= FLT_EPSILON)
+        return cone;
+
+    hmm_vec3 axis = HMM_DivideVec3f(normal_sum, axis_length);
+
+    f32 min_dot = 1.0f;
+    for (u32 i = 0; i < normal_count; i++)
+        min_dot = min(min_dot, HMM_DotVec3(normals[i], axis));
+
+    // Past ~84 degrees the cone is so wide it would almost never cull
+    if (min_dot <= 0.1f)
+        return cone;
+
+    cone.XYZ = axis;
+    cone.W = sqrtf(1.0f - min_dot * min_dot);
+    return cone;
+}
+
+void meshlet_compute_bounds(MeshletData* data, const Vertex* vertices, b32 double_sided)
+{
+    for (u32 i = 0; i < data->meshlet_count; i++)
+    {
+        Meshlet* ml = &data->meshlets[i];
+        const u32* ml_vertices = data->vertices + ml->vertex_offset;
+        const u8* ml_indices = data->indices + ml->index_offset;
+
+        aabb bbox;
+        bbox.min = HMM_Vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+        bbox.max = HMM_Vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+        for (u32 j = 0; j < ml->vertex_count; ++j)
+        {
+            const Vertex* va = &vertices[ml_vertices[j]];
+
+            bbox.min.X = min(bbox.min.X, va->position.X);
+            bbox.min.Y = min(bbox.min.Y, va->position.Y);
+            bbox.min.Z = min(bbox.min.Z, va->position.Z);
+
+            bbox.max.X = max(bbox.max.X, va->position.X);
+            bbox.max.Y = max(bbox.max.Y, va->position.Y);
+            bbox.max.Z = max(bbox.max.Z, va->position.Z);
+        }
+
+        hmm_vec3 bbox_extent = HMM_MultiplyVec3f(HMM_SubtractVec3(bbox.max, bbox.min), 0.5f);
+        hmm_vec3 bbox_center = HMM_AddVec3(bbox.min, bbox_extent);
+
+        ml->sphere.XYZ = bbox_center;
+        ml->sphere.W = 0.0f;
+
+        for (u32 j = 0; j < ml->vertex_count; ++j)
+        {
+            const Vertex* va = &vertices[ml_vertices[j]];
+
+            ml->sphere.W = max(ml->sphere.W, HMM_DistanceVec3(ml->sphere.XYZ, va->position));
+        }
+
+        ml->cone = double_sided ? HMM_Vec4(0.0f, 0.0f, 0.0f, 1.0f) : meshlet_compute_cone(ml, ml_vertices, ml_indices, vertices);
+    }
+}
+
+b32 meshlet_cone_culled(hmm_vec4 sphere, hmm_vec4 cone, hmm_vec3 camera_position)
+{
+    if (cone.W >= 1.0f)
+        return 0;
+
+    hmm_vec3 to_center = HMM_SubtractVec3(sphere.XYZ, camera_position);
+    return HMM_DotVec3(to_center, cone.XYZ) >= cone.W * HMM_LengthVec3(to_center) + sphere.W;
+}
+
+void meshlet_accumulate_stats(MeshletStats* stats, const MeshletData* data)
+{
+    stats->meshlet_count += data->meshlet_count;
+    stats->memory_size += data->meshlet_count * sizeof(Meshlet) + data->vertex_count * sizeof(u32) + data->index_size;
+
+    for (u32 i = 0; i < data->meshlet_count; i++)
+    {
+        const Meshlet* ml = &data->meshlets[i];
+
+        stats->vertex_count += ml->vertex_count;
+        stats->triangle_count += ml->triangle_count;
+        stats->radius_sum += ml->sphere.W;
+        stats->cone_count += ml->cone.W < 1.0f;
+    }
+}
+
+void meshlet_print_stats(const MeshletStats* stats, const char* name)
+{
+    if (stats->meshlet_count == 0)
+        return;
+
+    f64 vertex_fill = (f64)stats->vertex_count / ((f64)stats->meshlet_count * MAX_MESHLET_VERTICES);
+    f64 triangle_fill = (f64)stats->triangle_count / ((f64)stats->meshlet_count * MAX_MESHLET_TRIANGLES);
+
+    printf("%s: %u meshlets, vertex fill %.1f%%, triangle fill %.1f%%, average radius %f, %.1f%% with normal cones, %.1f KB\n",
+           name, stats->meshlet_count, vertex_fill * 100.0, triangle_fill * 100.0, stats->radius_sum / stats->meshlet_count,
+           100.0 * stats->cone_count / stats->meshlet_count, stats->memory_size / 1024.0);
+}
@@ -0,0 +1,53 @@
+#ifndef MESHLET_H_INCLUDED
+#define MESHLET_H_INCLUDED
+
+#include "mesh.h"
+
+// 0 falls back to packing triangles in index buffer order, handy to compare culling stats
+#define MESHLET_LOCALITY_BUILDER 1
+// How much one unit of distance (in expected meshlet radii) costs compared to one extra vertex
+#define MESHLET_SPATIAL_WEIGHT 1.0f
+// Meshlets simplified together into the next level of the cluster hierarchy
+#define MESHLET_GROUP_SIZE 4
+
+// Meshlet headers and the pools they point into, one set per primitive
+typedef struct MeshletData MeshletData;
+struct MeshletData
+{
+    Meshlet* meshlets;
+    u32 meshlet_count;
+
+    // Primitive vertex index of every meshlet vertex
+    u32* vertices;
+    u32 vertex_count;
+
+    // Meshlet local triangle indices, in bytes
+    u8* indices;
+    u32 index_size;
+};
+
+typedef struct MeshletStats MeshletStats;
+struct MeshletStats
+{
+    u32 meshlet_count;
+    u64 vertex_count;
+    u64 triangle_count;
+    f64 radius_sum;
+    u32 cone_count;
+    u64 memory_size;
+};
+
+// out must be released with meshlet_data_free
+void meshlet_build(MeshletData* out, const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count);
+void meshlet_data_free(MeshletData* data);
+// Level 0 meshlets plus every simplified level above them in one set, with lod/parent errors filled in
+void meshlet_build_hierarchy(MeshletData* out, const Vertex* vertices, u32 vertex_count, const u32* indices, u32 index_count, b32 double_sided);
+// Bounding sphere and normal cone, cones are left disabled for double sided geometry
+void meshlet_compute_bounds(MeshletData* data, const Vertex* vertices, b32 double_sided);
+// CPU reference of the task shader backface test, everything in the same space. Returns 1 if no triangle can face the camera.
+b32  meshlet_cone_culled(hmm_vec4 sphere, hmm_vec4 cone, hmm_vec3 camera_position);
+
+void meshlet_accumulate_stats(MeshletStats* stats, const MeshletData* data);
+void meshlet_print_stats(const MeshletStats* stats, const char* name);
+
+#endif
@@ -0,0 +1,408 @@
+#include "simplify.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+// Symmetric plane quadric, error(v) = v^T A v + 2 b.v + c
+typedef struct quadric quadric;
+struct quadric
+{
+    f64 a00, a11, a22;
+    f64 a01, a02, a12;
+    f64 b0, b1, b2;
+    f64 c;
+    f64 weight;
+};
+
+typedef struct collapse collapse;
+struct collapse
+{
+    u32 from;
+    u32 to;
+    f32 error;
+};
+
+internal void quadric_add_plane(quadric* q, hmm_vec3 n, f32 d, f32 weight)
+{
+    q->a00 += weight * n.X * n.X;
+    q->a11 += weight * n.Y * n.Y;
+    q->a22 += weight * n.Z * n.Z;
+    q->a01 += weight * n.X * n.Y;
+    q->a02 += weight * n.X * n.Z;
+    q->a12 += weight * n.Y * n.Z;
+    q->b0 += weight * n.X * d;
+    q->b1 += weight * n.Y * d;
+    q->b2 += weight * n.Z * d;
+    q->c += weight * d * d;
+    q->weight += weight;
+}
+
+internal void quadric_add(quadric* q, const quadric* other)
+{
+    q->a00 += other->a00;
+    q->a11 += other->a11;
+    q->a22 += other->a22;
+    q->a01 += other->a01;
+    q->a02 += other->a02;
+    q->a12 += other->a12;
+    q->b0 += other->b0;
+    q->b1 += other->b1;
+    q->b2 += other->b2;
+    q->c += other->c;
+    q->weight += other->weight;
+}
+
+// Area weighted RMS distance from v to the planes accumulated in q and r
+internal f32 quadric_error(const quadric* q, const quadric* r, hmm_vec3 v)
+{
+    quadric sum = *q;
+    quadric_add(&sum, r);
+
+    f64 x = v.X, y = v.Y, z = v.Z;
+    f64 rx = sum.a00 * x + sum.a01 * y + sum.a02 * z;
+    f64 ry = sum.a01 * x + sum.a11 * y + sum.a12 * z;
+    f64 rz = sum.a02 * x + sum.a12 * y + sum.a22 * z;
+    f64 error = rx * x + ry * y + rz * z + 2.0 * (sum.b0 * x + sum.b1 * y + sum.b2 * z) + sum.c;
+
+    return sum.weight > 0.0 ? (f32)sqrt(fabs(error) / sum.weight) : 0.0f;
+}
+
+internal u32 hash_position(hmm_vec3 p)
+{
+    u32 bits[3];
+    memcpy(bits, &p, sizeof(bits));
+    return bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+}
+
+// Every vertex -> the first vertex sharing its position, so wedges split by uv or normal collapse together
+internal void build_position_remap(u32* canonical, const Vertex* vertices, u32 vertex_count)
+{
+    u32 bucket_count = 1;
+    while (bucket_count < vertex_count * 2)
+        bucket_count <<= 1;
+
+    u32* table = malloc(bucket_count * sizeof(u32));
+    memset(table, 0xff, bucket_count * sizeof(u32));
+
+    for (u32 v = 0; v < vertex_count; v++)
+    {
+        hmm_vec3 p = vertices[v].position;
+        u32 bucket = hash_position(p) & (bucket_count - 1);
+
+        while (table[bucket] != 0xffffffff)
+        {
+            hmm_vec3 q = vertices[table[bucket]].position;
+            if (p.X == q.X && p.Y == q.Y && p.Z == q.Z)
+                break;
+            bucket = (bucket + 1) & (bucket_count - 1);
+        }
+
+        if (table[bucket] == 0xffffffff)
+            table[bucket] = v;
+        canonical[v] = table[bucket];
+    }
+
+    free(table);
+}
+
+internal int compare_edges(const void* a, const void* b)
+{
+    u64 ea = *(const u64*)a;
+    u64 eb = *(const u64*)b;
+    return ea < eb ? -1 : ea > eb;
+}
+
+internal int compare_collapses(const void* a, const void* b)
+{
+    f32 ea = ((const collapse*)a)->error;
+    f32 eb = ((const collapse*)b)->error;
+    return ea < eb ? -1 : ea > eb;
+}
+
+// Open and non-manifold edges keep both their vertices
+internal void lock_borders(u8* locked, const u32* canonical, const u32* indices, u32 index_count)
+{
+    u64* edges = malloc(index_count * sizeof(u64));
+
+    for (u32 i = 0; i < index_count; i++)
+    {
+        u32 a = canonical[indices[i]];
+        u32 b = canonical[indices[i - i % 3 + (i + 1) % 3]];
+        edges[i] = a < b ? ((u64)a << 32) | b : ((u64)b << 32) | a;
+    }
+
+    qsort(edges, index_count, sizeof(u64), compare_edges);
+
+    for (u32 i = 0; i < index_count;)
+    {
+        u32 run = 1;
+        while (i + run < index_count && edges[i + run] == edges[i])
+            run++;
+
+        if (run != 2)
+        {
+            locked[edges[i] >> 32] = 1;
+            locked[edges[i] & 0xffffffff] = 1;
+        }
+
+        i += run;
+    }
+
+    free(edges);
+}
+
+internal b32 collapse_flips(u32 from, u32 to, const u32* canonical, const u32* indices, const u32* offsets, const u32* triangles, const Vertex* vertices)
+{
+    hmm_vec3 target = vertices[to].position;
+
+    for (u32 j = offsets[from]; j < offsets[from + 1]; j++)
+    {
+        const u32* tri = &indices[triangles[j] * 3];
+        u32 c[3] = { canonical[tri[0]], canonical[tri[1]], canonical[tri[2]] };
+
+        // Triangles on the collapsed edge disappear
+        if (c[0] == to || c[1] == to || c[2] == to)
+            continue;
+
+        hmm_vec3 p[3], q[3];
+        for (u32 k = 0; k < 3; k++)
+        {
+            p[k] = vertices[c[k]].position;
+            q[k] = c[k] == from ? target : p[k];
+        }
+
+        hmm_vec3 old_normal = HMM_Cross(HMM_SubtractVec3(p[1], p[0]), HMM_SubtractVec3(p[2], p[0]));
+        hmm_vec3 new_normal = HMM_Cross(HMM_SubtractVec3(q[1], q[0]), HMM_SubtractVec3(q[2], q[0]));
+
+        if (HMM_DotVec3(old_normal, new_normal) <= 0.0f)
+            return 1;
+    }
+
+    return 0;
+}
+
+// Every wedge of from moves to the wedge of to it shares a triangle with, which keeps uv charts apart when sliding
+// along a seam. Fails if a wedge still in use has no such triangle, that collapse would tear its chart.
+internal b32 collapse_find_targets(u32 from, u32 to, const u32* canonical, const u32* wedge_next, const u32* indices,
+                                   const u32* offsets, const u32* triangles, u32* targets)
+{
+    u32 wedge = from;
+    u32 count = 0;
+
+    do
+    {
+        b32 used = 0;
+        u32 target = 0xffffffff;
+
+        for (u32 j = offsets[from]; j < offsets[from + 1] && target == 0xffffffff; j++)
+        {
+            const u32* tri = &indices[triangles[j] * 3];
+            if (tri[0] != wedge && tri[1] != wedge && tri[2] != wedge)
+                continue;
+
+            used = 1;
+            for (u32 k = 0; k < 3; k++)
+            {
+                if (canonical[tri[k]] == to)
+                    target = tri[k];
+            }
+        }
+
+        if (used && target == 0xffffffff)
+            return 0;
+
+        targets[count++] = used ? target : wedge;
+        wedge = wedge_next[wedge];
+    } while (wedge != from);
+
+    return 1;
+}
+
+u32 simplify_mesh(u32* out_indices, const u32* indices, u32 index_count, const Vertex* vertices, u32 vertex_count,
+                  u32 target_index_count, f32 max_error, f32* out_error)
+{
+    *out_error = 0.0f;
+    memcpy(out_indices, indices, index_count * sizeof(u32));
+
+    if (index_count <= target_index_count || vertex_count == 0)
+        return index_count;
+
+    u32* canonical = malloc(vertex_count * sizeof(u32));
+    u32* wedge_count = calloc(vertex_count, sizeof(u32));
+    u32* wedge_next = malloc(vertex_count * sizeof(u32));
+    u8* locked = calloc(vertex_count, sizeof(u8));
+    quadric* quadrics = calloc(vertex_count, sizeof(quadric));
+
+    build_position_remap(canonical, vertices, vertex_count);
+
+    // Wedges sharing a position form a ring starting at the canonical vertex
+    for (u32 v = 0; v < vertex_count; v++)
+    {
+        u32 c = canonical[v];
+        wedge_count[c]++;
+        wedge_next[v] = v;
+        if (c != v)
+        {
+            wedge_next[v] = wedge_next[c];
+            wedge_next[c] = v;
+        }
+    }
+
+    // A seam can be slid along, but not where three or more charts meet
+    for (u32 v = 0; v < vertex_count; v++)
+        locked[v] = wedge_count[v] > 2;
+
+    lock_borders(locked, canonical, out_indices, index_count);
+
+    for (u32 i = 0; i + 2 < index_count; i += 3)
+    {
+        hmm_vec3 a = vertices[out_indices[i + 0]].position;
+        hmm_vec3 b = vertices[out_indices[i + 1]].position;
+        hmm_vec3 c = vertices[out_indices[i + 2]].position;
+
+        hmm_vec3 n = HMM_Cross(HMM_SubtractVec3(b, a), HMM_SubtractVec3(c, a));
+        f32 length = HMM_LengthVec3(n);
+        if (length <= FLT_EPSILON)
+            continue;
+
+        n = HMM_DivideVec3f(n, length);
+        f32 d = -HMM_DotVec3(n, a);
+
+        for (u32 k = 0; k < 3; k++)
+            quadric_add_plane(&quadrics[canonical[out_indices[i + k]]], n, d, length * 0.5f);
+    }
+
+    collapse* collapses = malloc(index_count * 2 * sizeof(collapse));
+    u32* remap = malloc(vertex_count * sizeof(u32));
+    u8* touched = malloc(vertex_count * sizeof(u8));
+    u32* offsets = malloc((vertex_count + 1) * sizeof(u32));
+    u32* triangles = malloc(index_count * sizeof(u32));
+
+    u32 count = index_count;
+
+    while (count > target_index_count)
+    {
+        u32 collapse_count = 0;
+
+        for (u32 i = 0; i < count; i++)
+        {
+            u32 u = out_indices[i];
+            u32 w = out_indices[i - i % 3 + (i + 1) % 3];
+            u32 cu = canonical[u];
+            u32 cw = canonical[w];
+            if (cu == cw)
+                continue;
+
+            if (!locked[cu])
+            {
+                collapse c = { u, w, quadric_error(&quadrics[cu], &quadrics[cw], vertices[cw].position) };
+                collapses[collapse_count++] = c;
+            }
+            if (!locked[cw])
+            {
+                collapse c = { w, u, quadric_error(&quadrics[cw], &quadrics[cu], vertices[cu].position) };
+                collapses[collapse_count++] = c;
+            }
+        }
+
+        if (collapse_count == 0)
+            break;
+
+        qsort(collapses, collapse_count, sizeof(collapse), compare_collapses);
+
+        // Canonical vertex -> triangles for this pass
+        memset(offsets, 0, (vertex_count + 1) * sizeof(u32));
+        for (u32 i = 0; i < count; i++)
+            offsets[canonical[out_indices[i]] + 1]++;
+        for (u32 v = 0; v < vertex_count; v++)
+            offsets[v + 1] += offsets[v];
+        for (u32 i = 0; i < count; i++)
+            triangles[offsets[canonical[out_indices[i]]]++] = i / 3;
+        for (u32 v = vertex_count; v > 0; v--)
+            offsets[v] = offsets[v - 1];
+        offsets[0] = 0;
+
+        for (u32 v = 0; v < vertex_count; v++)
+            remap[v] = v;
+        memset(touched, 0, vertex_count * sizeof(u8));
+
+        u32 triangle_goal = (count - target_index_count) / 3;
+        u32 triangles_removed = 0;
+        u32 collapsed = 0;
+
+        for (u32 i = 0; i < collapse_count && triangles_removed < triangle_goal; i++)
+        {
+            collapse* c = &collapses[i];
+            if (c->error > max_error)
+                break;
+
+            u32 cu = canonical[c->from];
+            u32 cw = canonical[c->to];
+            if (touched[cu] || touched[cw])
+                continue;
+
+            if (collapse_flips(cu, cw, canonical, out_indices, offsets, triangles, vertices))
+                continue;
+
+            u32 targets[2];
+            if (!collapse_find_targets(cu, cw, canonical, wedge_next, out_indices, offsets, triangles, targets))
+                continue;
+
+            // Neighbours stay put for the rest of the pass so the flip test above stays valid
+            for (u32 j = offsets[cu]; j < offsets[cu + 1]; j++)
+            {
+                const u32* tri = &out_indices[triangles[j] * 3];
+                b32 on_edge = 0;
+
+                for (u32 k = 0; k < 3; k++)
+                {
+                    touched[canonical[tri[k]]] = 1;
+                    on_edge |= canonical[tri[k]] == cw;
+                }
+
+                triangles_removed += on_edge;
+            }
+
+            u32 wedge = cu;
+            for (u32 k = 0; k < wedge_count[cu]; k++, wedge = wedge_next[wedge])
+                remap[wedge] = targets[k];
+            quadric_add(&quadrics[cw], &quadrics[cu]);
+            *out_error = max(*out_error, c->error);
+            collapsed++;
+        }
+
+        if (collapsed == 0)
+            break;
+
+        u32 write = 0;
+        for (u32 i = 0; i < count; i += 3)
+        {
+            u32 a = remap[out_indices[i + 0]];
+            u32 b = remap[out_indices[i + 1]];
+            u32 c = remap[out_indices[i + 2]];
+
+            if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[a] == canonical[c])
+                continue;
+
+            out_indices[write++] = a;
+            out_indices[write++] = b;
+            out_indices[write++] = c;
+        }
+        count = write;
+    }
+
+    free(triangles);
+    free(offsets);
+    free(touched);
+    free(remap);
+    free(collapses);
+    free(quadrics);
+    free(locked);
+    free(wedge_next);
+    free(wedge_count);
+    free(canonical);
+
+    return count;
+}
@@ -0,0 +1,14 @@
+#ifndef SIMPLIFY_H_INCLUDED
+#define SIMPLIFY_H_INCLUDED
+
+#include "mesh.h"
+
+// Quadric edge collapse onto existing vertices, so the vertex buffer is shared by every LOD.
+// Open borders are locked. UV seams can slide along themselves but never tear a chart apart, and corners where
+// three or more charts meet are locked. Stops at target_index_count, or when the cheapest collapse left would
+// cost more than max_error (object space distance).
+// Returns the new index count, *out_error receives the largest error introduced.
+u32 simplify_mesh(u32* out_indices, const u32* indices, u32 index_count, const Vertex* vertices, u32 vertex_count,
+                  u32 target_index_count, f32 max_error, f32* out_error);
+
+#endif
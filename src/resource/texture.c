@@ -0,0 +1,714 @@
+#include "texture.h"
+#include "texture_compress.h"
+#include "texture_mips.h"
+
+#include <core/platform_layer.h>
+#include <core/job_system.h>
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+// Cooked textures are plain DDS files (DX10 header), dwReserved1 carries what tells a stale one apart
+#define TEXTURE_CACHE_MAGIC 0x58455441 // ATEX
+#define TEXTURE_CACHE_VERSION 2
+// Block rows compressed per job
+#define TEXTURE_COMPRESS_JOB_ROWS 16
+// Destination rows downsampled per job
+#define TEXTURE_MIPS_JOB_ROWS 64
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDS_FOURCC(a, b, c, d) ((u32)(a) | ((u32)(b) << 8) | ((u32)(c) << 16) | ((u32)(d) << 24))
+#define DDS_FOURCC_DX10 DDS_FOURCC('D', 'X', '1', '0')
+#define DDS_LEGACY_HEADER_SIZE 128
+#define DDSD_CAPS 0x1
+#define DDSD_HEIGHT 0x2
+#define DDSD_WIDTH 0x4
+#define DDSD_PIXELFORMAT 0x1000
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSD_LINEARSIZE 0x80000
+#define DDPF_FOURCC 0x4
+#define DDPF_RGB 0x40
+#define DDSCAPS_COMPLEX 0x8
+#define DDSCAPS_TEXTURE 0x1000
+#define DDSCAPS_MIPMAP 0x400000
+#define DDSCAPS2_CUBEMAP 0x200
+#define DDSCAPS2_VOLUME 0x200000
+#define DDS_DIMENSION_TEXTURE2D 3
+#define DDS_RESOURCE_MISC_TEXTURECUBE 0x4
+
+#define DXGI_FORMAT_R8G8B8A8_UNORM 28
+#define DXGI_FORMAT_R8G8B8A8_UNORM_SRGB 29
+#define DXGI_FORMAT_BC1_UNORM 71
+#define DXGI_FORMAT_BC1_UNORM_SRGB 72
+#define DXGI_FORMAT_BC2_UNORM 74
+#define DXGI_FORMAT_BC2_UNORM_SRGB 75
+#define DXGI_FORMAT_BC3_UNORM 77
+#define DXGI_FORMAT_BC3_UNORM_SRGB 78
+#define DXGI_FORMAT_BC4_UNORM 80
+#define DXGI_FORMAT_BC5_UNORM 83
+#define DXGI_FORMAT_B8G8R8A8_UNORM 87
+#define DXGI_FORMAT_B8G8R8A8_UNORM_SRGB 91
+#define DXGI_FORMAT_BC6H_UF16 95
+#define DXGI_FORMAT_BC6H_SF16 96
+#define DXGI_FORMAT_BC7_UNORM 98
+#define DXGI_FORMAT_BC7_UNORM_SRGB 99
+
+#define KTX2_SUPERCOMPRESSION_NONE 0
+
+typedef struct dds_pixel_format dds_pixel_format;
+struct dds_pixel_format
+{
+    u32 size;
+    u32 flags;
+    u32 fourcc;
+    u32 rgb_bit_count;
+    u32 r_mask, g_mask, b_mask, a_mask;
+};
+
+typedef struct dds_header dds_header;
+struct dds_header
+{
+    u32 magic;
+    u32 size;
+    u32 flags;
+    u32 height;
+    u32 width;
+    u32 pitch_or_linear_size;
+    u32 depth;
+    u32 mip_map_count;
+    u32 reserved1[11];
+    dds_pixel_format pixel_format;
+    u32 caps, caps2, caps3, caps4;
+    u32 reserved2;
+
+    // DX10 extension
+    u32 dxgi_format;
+    u32 resource_dimension;
+    u32 misc_flag;
+    u32 array_size;
+    u32 misc_flags2;
+};
+
+typedef struct ktx2_header ktx2_header;
+struct ktx2_header
+{
+    u8 identifier[12];
+    u32 vk_format;
+    u32 type_size;
+    u32 pixel_width;
+    u32 pixel_height;
+    u32 pixel_depth;
+    u32 layer_count;
+    u32 face_count;
+    u32 level_count;
+    u32 supercompression_scheme;
+
+    u32 dfd_byte_offset;
+    u32 dfd_byte_length;
+    u32 kvd_byte_offset;
+    u32 kvd_byte_length;
+    u64 sgd_byte_offset;
+    u64 sgd_byte_length;
+};
+
+typedef struct ktx2_level ktx2_level;
+struct ktx2_level
+{
+    u64 byte_offset;
+    u64 byte_length;
+    u64 uncompressed_byte_length;
+};
+
+internal const u8 s_ktx2_identifier[12] = { 0xab, 'K', 'T', 'X', ' ', '2', '0', 0xbb, '\r', '\n', 0x1a, '\n' };
+
+typedef struct texture_compress_job texture_compress_job;
+struct texture_compress_job
+{
+    void* dst;
+    const u8* rgba;
+    u32 width;
+    u32 height;
+    VkFormat format;
+    u32 first_row;
+    u32 row_count;
+};
+
+typedef struct texture_downsample_job texture_downsample_job;
+struct texture_downsample_job
+{
+    u8* dst;
+    const u8* src;
+    u32 width;
+    u32 height;
+    u32 role;
+    u32 first_row;
+    u32 row_count;
+};
+
+internal u32 texture_dxgi_format(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: return DXGI_FORMAT_BC1_UNORM;
+        case VK_FORMAT_BC4_UNORM_BLOCK: return DXGI_FORMAT_BC4_UNORM;
+        case VK_FORMAT_BC5_UNORM_BLOCK: return DXGI_FORMAT_BC5_UNORM;
+        case VK_FORMAT_BC7_UNORM_BLOCK: return DXGI_FORMAT_BC7_UNORM;
+        default: return DXGI_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+// Every material texture is sampled as UNORM, sRGB variants map to it so authored files look like cooked ones.
+// Signed BC4/BC5 would break the normal decode in gbuffer.frag and aren't accepted.
+internal VkFormat texture_vk_format(u32 dxgi_format)
+{
+    switch (dxgi_format)
+    {
+        case DXGI_FORMAT_BC1_UNORM: case DXGI_FORMAT_BC1_UNORM_SRGB: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case DXGI_FORMAT_BC2_UNORM: case DXGI_FORMAT_BC2_UNORM_SRGB: return VK_FORMAT_BC2_UNORM_BLOCK;
+        case DXGI_FORMAT_BC3_UNORM: case DXGI_FORMAT_BC3_UNORM_SRGB: return VK_FORMAT_BC3_UNORM_BLOCK;
+        case DXGI_FORMAT_BC4_UNORM: return VK_FORMAT_BC4_UNORM_BLOCK;
+        case DXGI_FORMAT_BC5_UNORM: return VK_FORMAT_BC5_UNORM_BLOCK;
+        case DXGI_FORMAT_BC6H_UF16: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+        case DXGI_FORMAT_BC6H_SF16: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+        case DXGI_FORMAT_BC7_UNORM: case DXGI_FORMAT_BC7_UNORM_SRGB: return VK_FORMAT_BC7_UNORM_BLOCK;
+        case DXGI_FORMAT_R8G8B8A8_UNORM: case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: return VK_FORMAT_R8G8B8A8_UNORM;
+        case DXGI_FORMAT_B8G8R8A8_UNORM: case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB: return VK_FORMAT_B8G8R8A8_UNORM;
+        default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+// Same rules for the VkFormat a KTX2 file names
+internal VkFormat texture_supported_format(u32 format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK: case VK_FORMAT_BC1_RGB_SRGB_BLOCK: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: case VK_FORMAT_BC1_RGBA_SRGB_BLOCK: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case VK_FORMAT_BC2_UNORM_BLOCK: case VK_FORMAT_BC2_SRGB_BLOCK: return VK_FORMAT_BC2_UNORM_BLOCK;
+        case VK_FORMAT_BC3_UNORM_BLOCK: case VK_FORMAT_BC3_SRGB_BLOCK: return VK_FORMAT_BC3_UNORM_BLOCK;
+        case VK_FORMAT_BC4_UNORM_BLOCK: return VK_FORMAT_BC4_UNORM_BLOCK;
+        case VK_FORMAT_BC5_UNORM_BLOCK: return VK_FORMAT_BC5_UNORM_BLOCK;
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+        case VK_FORMAT_BC6H_SFLOAT_BLOCK: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+        case VK_FORMAT_BC7_UNORM_BLOCK: case VK_FORMAT_BC7_SRGB_BLOCK: return VK_FORMAT_BC7_UNORM_BLOCK;
+        case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB: return VK_FORMAT_R8G8B8A8_UNORM;
+        case VK_FORMAT_B8G8R8A8_UNORM: case VK_FORMAT_B8G8R8A8_SRGB: return VK_FORMAT_B8G8R8A8_UNORM;
+        default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+internal VkFormat texture_dds_format(const dds_header* header)
+{
+    const dds_pixel_format* pf = &header->pixel_format;
+
+    if (pf->flags & DDPF_FOURCC)
+    {
+        switch (pf->fourcc)
+        {
+            case DDS_FOURCC_DX10: return texture_vk_format(header->dxgi_format);
+            case DDS_FOURCC('D', 'X', 'T', '1'): return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+            case DDS_FOURCC('D', 'X', 'T', '3'): return VK_FORMAT_BC2_UNORM_BLOCK;
+            case DDS_FOURCC('D', 'X', 'T', '5'): return VK_FORMAT_BC3_UNORM_BLOCK;
+            case DDS_FOURCC('A', 'T', 'I', '1'): case DDS_FOURCC('B', 'C', '4', 'U'): return VK_FORMAT_BC4_UNORM_BLOCK;
+            case DDS_FOURCC('A', 'T', 'I', '2'): case DDS_FOURCC('B', 'C', '5', 'U'): return VK_FORMAT_BC5_UNORM_BLOCK;
+            default: return VK_FORMAT_UNDEFINED;
+        }
+    }
+
+    if ((pf->flags & DDPF_RGB) && pf->rgb_bit_count == 32)
+    {
+        if (pf->r_mask == 0x000000ff && pf->g_mask == 0x0000ff00 && pf->b_mask == 0x00ff0000)
+            return VK_FORMAT_R8G8B8A8_UNORM;
+        if (pf->r_mask == 0x00ff0000 && pf->g_mask == 0x0000ff00 && pf->b_mask == 0x000000ff)
+            return VK_FORMAT_B8G8R8A8_UNORM;
+    }
+
+    return VK_FORMAT_UNDEFINED;
+}
+
+u64 texture_level_size(VkFormat format, u32 width, u32 height)
+{
+    u32 block_bytes = texture_block_bytes(format);
+    if (block_bytes)
+        return (u64)((width + 3) / 4) * ((height + 3) / 4) * block_bytes;
+    return (u64)width * height * 4;
+}
+
+// Fills in mip_offsets and returns the size of the whole chain
+internal u64 texture_layout_levels(RHI_RawImage* image)
+{
+    u64 offset = 0;
+    for (u32 i = 0; i < image->mip_levels; i++)
+    {
+        image->mip_offsets[i] = offset;
+        offset += texture_level_size(image->format, max(image->width >> i, 1), max(image->height >> i, 1));
+    }
+    return offset;
+}
+
+internal b32 texture_source_hash(const char* path, u64* out_hash)
+{
+    u64 size = 0;
+    u8* data = (u8*)aurora_platform_map_file(path, &size);
+    if (!data)
+        return 0;
+
+    *out_hash = fnv1a_64(data, size, 0xcbf29ce484222325ull);
+    aurora_platform_unmap_file(data, size);
+    return 1;
+}
+
+// Parsers fill in the layout and where each level sits in the file, the level data itself is left alone.
+// DDS levels are stored largest first and back to back, the same layout RHI_RawImage uses.
+internal b32 texture_parse_dds(RHI_RawImage* out, u64* file_offsets, const u8* data, u64 size)
+{
+    if (size < DDS_LEGACY_HEADER_SIZE)
+        return 0;
+
+    dds_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, data, min(size, sizeof(header)));
+
+    if (header.magic != DDS_MAGIC || header.size != 124)
+        return 0;
+
+    b32 dx10 = (header.pixel_format.flags & DDPF_FOURCC) && header.pixel_format.fourcc == DDS_FOURCC_DX10;
+    u64 data_offset = dx10 ? sizeof(dds_header) : DDS_LEGACY_HEADER_SIZE;
+    if (size < data_offset)
+        return 0;
+
+    if (header.caps2 & (DDSCAPS2_CUBEMAP | DDSCAPS2_VOLUME))
+        return 0;
+    if (dx10 && (header.resource_dimension != DDS_DIMENSION_TEXTURE2D || header.array_size > 1 || (header.misc_flag & DDS_RESOURCE_MISC_TEXTURECUBE)))
+        return 0;
+
+    u32 levels = (header.flags & DDSD_MIPMAPCOUNT) ? max(header.mip_map_count, 1) : 1;
+    VkFormat format = texture_dds_format(&header);
+    if (format == VK_FORMAT_UNDEFINED || levels > RHI_MAX_MIP_LEVELS || header.width == 0 || header.height == 0)
+        return 0;
+
+    memset(out, 0, sizeof(RHI_RawImage));
+    out->width = header.width;
+    out->height = header.height;
+    out->format = format;
+    out->mip_levels = levels;
+    out->data_size = texture_layout_levels(out);
+    if (data_offset + out->data_size > size)
+        return 0;
+
+    for (u32 i = 0; i < levels; i++)
+        file_offsets[i] = data_offset + out->mip_offsets[i];
+    return 1;
+}
+
+// KTX2 levels are stored smallest first at the offsets in the level index, they get repacked largest first
+internal b32 texture_parse_ktx2(RHI_RawImage* out, u64* file_offsets, const u8* data, u64 size)
+{
+    if (size < sizeof(ktx2_header) || memcmp(data, s_ktx2_identifier, sizeof(s_ktx2_identifier)) != 0)
+        return 0;
+
+    ktx2_header header;
+    memcpy(&header, data, sizeof(header));
+
+    // level_count 0 asks the loader to generate mips, the file still has the base level
+    u32 levels = max(header.level_count, 1);
+    VkFormat format = texture_supported_format(header.vk_format);
+    if (format == VK_FORMAT_UNDEFINED || header.supercompression_scheme != KTX2_SUPERCOMPRESSION_NONE
+        || header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1
+        || header.pixel_width == 0 || header.pixel_height == 0 || levels > RHI_MAX_MIP_LEVELS
+        || sizeof(ktx2_header) + levels * sizeof(ktx2_level) > size)
+        return 0;
+
+    memset(out, 0, sizeof(RHI_RawImage));
+    out->width = header.pixel_width;
+    out->height = header.pixel_height;
+    out->format = format;
+    out->mip_levels = levels;
+    out->data_size = texture_layout_levels(out);
+
+    const ktx2_level* level_index = (const ktx2_level*)(data + sizeof(ktx2_header));
+    for (u32 i = 0; i < levels; i++)
+    {
+        u64 expected = texture_level_size(format, max(out->width >> i, 1), max(out->height >> i, 1));
+        if (level_index[i].byte_length != expected || level_index[i].byte_offset + expected > size)
+            return 0;
+        file_offsets[i] = level_index[i].byte_offset;
+    }
+    return 1;
+}
+
+// Only the header pages of the mapping are touched
+internal b32 texture_open_container(TextureSource* out, const char* path)
+{
+    u64 size = 0;
+    u8* data = (u8*)aurora_platform_map_file(path, &size);
+    if (!data)
+        return 0;
+
+    b32 loaded = texture_parse_ktx2(&out->raw, out->file_offsets, data, size) || texture_parse_dds(&out->raw, out->file_offsets, data, size);
+    aurora_platform_unmap_file(data, size);
+
+    if (loaded)
+        snprintf(out->file, sizeof(out->file), "%s", path);
+    return loaded;
+}
+
+b32 texture_read_levels(TextureSource* source, u32 first_level, u32 level_count, void* dst)
+{
+    RHI_RawImage* raw = &source->raw;
+    u64 first_offset = raw->mip_offsets[first_level];
+    u64 end = first_level + level_count < raw->mip_levels ? raw->mip_offsets[first_level + level_count] : raw->data_size;
+
+    if (raw->data)
+    {
+        memcpy(dst, (u8*)raw->data + first_offset, end - first_offset);
+        return 1;
+    }
+
+    FILE* file = fopen(source->file, "rb");
+    if (!file)
+        return 0;
+
+    // DDS levels are one contiguous run, KTX2 ones are read one by one
+    b32 read = 1;
+    for (u32 i = first_level; i < first_level + level_count && read;)
+    {
+        u32 run = i + 1;
+        while (run < first_level + level_count && source->file_offsets[run] == source->file_offsets[i] + raw->mip_offsets[run] - raw->mip_offsets[i])
+            run++;
+
+        u64 size = (run < raw->mip_levels ? raw->mip_offsets[run] : raw->data_size) - raw->mip_offsets[i];
+        read = fseek(file, (long)source->file_offsets[i], SEEK_SET) == 0
+            && fread((u8*)dst + raw->mip_offsets[i] - first_offset, 1, size, file) == size;
+        i = run;
+    }
+
+    fclose(file);
+    return read;
+}
+
+void texture_free(TextureSource* source)
+{
+    free(source->raw.data);
+    source->raw.data = NULL;
+}
+
+b32 texture_load_container(RHI_RawImage* out, const char* path)
+{
+    TextureSource source;
+    memset(&source, 0, sizeof(source));
+    if (!texture_open_container(&source, path))
+        return 0;
+
+    *out = source.raw;
+    out->data = malloc(out->data_size);
+    if (!texture_read_levels(&source, 0, out->mip_levels, out->data))
+    {
+        rhi_free_raw_image(out);
+        return 0;
+    }
+    return 1;
+}
+
+internal b32 texture_cache_read(TextureSource* out, const char* cache_path, u32 role, u64 source_hash)
+{
+    u64 size = 0;
+    u8* data = (u8*)aurora_platform_map_file(cache_path, &size);
+    if (!data)
+        return 0;
+
+    dds_header header;
+    b32 valid = size >= sizeof(header);
+    if (valid)
+    {
+        memcpy(&header, data, sizeof(header));
+        valid = header.reserved1[0] == TEXTURE_CACHE_MAGIC
+            && header.reserved1[1] == TEXTURE_CACHE_VERSION
+            && header.reserved1[2] == role
+            && header.reserved1[3] == (u32)source_hash
+            && header.reserved1[4] == (u32)(source_hash >> 32)
+            && texture_parse_dds(&out->raw, out->file_offsets, data, size);
+    }
+
+    aurora_platform_unmap_file(data, size);
+    if (valid)
+        snprintf(out->file, sizeof(out->file), "%s", cache_path);
+    return valid;
+}
+
+internal b32 texture_has_extension(const char* path, u64 length, const char* extension)
+{
+    u64 extension_length = strlen(extension);
+    if (length < extension_length)
+        return 0;
+
+    for (u64 i = 0; i < extension_length; i++)
+        if (tolower((u8)path[length - extension_length + i]) != extension[i])
+            return 0;
+    return 1;
+}
+
+internal b32 texture_load_authored(TextureSource* out, const char* path)
+{
+    u64 length = strlen(path);
+    if (texture_has_extension(path, length, ".ktx2") || texture_has_extension(path, length, ".dds"))
+        return texture_open_container(out, path);
+
+    const char* separator = max(strrchr(path, '/'), strrchr(path, '\\'));
+    const char* extension = strrchr(path, '.');
+    u64 stem = extension && extension > separator ? (u64)(extension - path) : length;
+
+    const char* containers[] = { ".ktx2", ".dds" };
+    for (u32 i = 0; i < 2; i++)
+    {
+        char sibling[512];
+        snprintf(sibling, sizeof(sibling), "%.*s%s", (int)stem, path, containers[i]);
+        if (texture_open_container(out, sibling))
+            return 1;
+    }
+    return 0;
+}
+
+internal b32 texture_cache_write(const RHI_RawImage* image, const char* cache_path, u32 role, u64 source_hash)
+{
+    dds_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = DDS_MAGIC;
+    header.size = 124;
+    header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+    header.height = image->height;
+    header.width = image->width;
+    header.pitch_or_linear_size = (u32)texture_level_size(image->format, image->width, image->height);
+    header.mip_map_count = image->mip_levels;
+    header.reserved1[0] = TEXTURE_CACHE_MAGIC;
+    header.reserved1[1] = TEXTURE_CACHE_VERSION;
+    header.reserved1[2] = role;
+    header.reserved1[3] = (u32)source_hash;
+    header.reserved1[4] = (u32)(source_hash >> 32);
+    header.pixel_format.size = sizeof(dds_pixel_format);
+    header.pixel_format.flags = DDPF_FOURCC;
+    header.pixel_format.fourcc = DDS_FOURCC_DX10;
+    header.caps = DDSCAPS_TEXTURE | DDSCAPS_MIPMAP | DDSCAPS_COMPLEX;
+    header.dxgi_format = texture_dxgi_format(image->format);
+    header.resource_dimension = DDS_DIMENSION_TEXTURE2D;
+    header.array_size = 1;
+
+    // Written aside and moved in place once complete, like the mesh cache. Cooked levels are read back from
+    // this file later, so a reader must never see a half written one.
+    char temp_path[512 + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.%p.tmp", cache_path, (void*)image);
+
+    FILE* file = fopen(temp_path, "wb");
+    if (!file)
+        return 0;
+
+    b32 written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(image->data, 1, image->data_size, file) == image->data_size;
+    fclose(file);
+
+    if (written)
+    {
+        remove(cache_path);
+        written = rename(temp_path, cache_path) == 0;
+    }
+    if (!written)
+        remove(temp_path);
+    return written;
+}
+
+internal void texture_downsample_entry(void* data)
+{
+    texture_downsample_job* job = (texture_downsample_job*)data;
+    texture_downsample_rows(job->dst, job->src, job->width, job->height, job->role, job->first_row, job->row_count);
+}
+
+internal void texture_downsample_level(u8* dst, const u8* src, u32 width, u32 height, u32 role)
+{
+    u32 rows = max(height >> 1, 1);
+    u32 job_count = (rows + TEXTURE_MIPS_JOB_ROWS - 1) / TEXTURE_MIPS_JOB_ROWS;
+
+    if (!MULTITHREADING_ENABLED || job_count == 1)
+    {
+        texture_downsample(dst, src, width, height, role);
+        return;
+    }
+
+    texture_downsample_job* jobs = malloc(job_count * sizeof(texture_downsample_job));
+    for (u32 i = 0; i < job_count; i++)
+    {
+        jobs[i].dst = dst;
+        jobs[i].src = src;
+        jobs[i].width = width;
+        jobs[i].height = height;
+        jobs[i].role = role;
+        jobs[i].first_row = i * TEXTURE_MIPS_JOB_ROWS;
+        jobs[i].row_count = min(TEXTURE_MIPS_JOB_ROWS, rows - jobs[i].first_row);
+    }
+
+    JobCounter counter = {0};
+    job_submit_batch(texture_downsample_entry, jobs, sizeof(texture_downsample_job), job_count, &counter);
+    job_wait(&counter);
+    free(jobs);
+}
+
+// Grows a decoded RGBA8 image to its full chain, each level filtered from the one above
+internal void texture_build_mips(RHI_RawImage* image, u32 role)
+{
+    image->mip_levels = texture_mip_count(image->width, image->height);
+    image->data_size = texture_layout_levels(image);
+    image->data = realloc(image->data, image->data_size);
+
+    u8* levels = (u8*)image->data;
+    for (u32 i = 1; i < image->mip_levels; i++)
+    {
+        u32 width = max(image->width >> (i - 1), 1);
+        u32 height = max(image->height >> (i - 1), 1);
+        texture_downsample_level(levels + image->mip_offsets[i], levels + image->mip_offsets[i - 1], width, height, role);
+    }
+}
+
+internal void texture_compress_entry(void* data)
+{
+    texture_compress_job* job = (texture_compress_job*)data;
+    texture_compress_rows(job->dst, job->rgba, job->width, job->height, job->format, job->first_row, job->row_count);
+}
+
+internal void texture_compress_level(void* dst, const u8* rgba, u32 width, u32 height, VkFormat format)
+{
+    u32 block_rows = (height + 3) / 4;
+    u32 job_count = (block_rows + TEXTURE_COMPRESS_JOB_ROWS - 1) / TEXTURE_COMPRESS_JOB_ROWS;
+
+    if (!MULTITHREADING_ENABLED || job_count == 1)
+    {
+        texture_compress(dst, rgba, width, height, format);
+        return;
+    }
+
+    texture_compress_job* jobs = malloc(job_count * sizeof(texture_compress_job));
+    for (u32 i = 0; i < job_count; i++)
+    {
+        jobs[i].dst = dst;
+        jobs[i].rgba = rgba;
+        jobs[i].width = width;
+        jobs[i].height = height;
+        jobs[i].format = format;
+        jobs[i].first_row = i * TEXTURE_COMPRESS_JOB_ROWS;
+        jobs[i].row_count = min(TEXTURE_COMPRESS_JOB_ROWS, block_rows - jobs[i].first_row);
+    }
+
+    JobCounter counter = {0};
+    job_submit_batch(texture_compress_entry, jobs, sizeof(texture_compress_job), job_count, &counter);
+    job_wait(&counter);
+    free(jobs);
+}
+
+internal VkFormat texture_cooked_format(const RHI_RawImage* source, u32 role)
+{
+    if (role == TEXTURE_ROLE_NORMAL)
+        return VK_FORMAT_BC5_UNORM_BLOCK;
+    if (role == TEXTURE_ROLE_DATA)
+        return VK_FORMAT_BC7_UNORM_BLOCK;
+
+    const u8* pixels = (const u8*)source->data;
+    for (u64 i = 3; i < source->data_size; i += 4)
+        if (pixels[i] != 255)
+            return VK_FORMAT_BC7_UNORM_BLOCK;
+    return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+}
+
+// Decode, build the mip chain and compress every level. source is consumed.
+internal void texture_cook(RHI_RawImage* out, RHI_RawImage* source, u32 role)
+{
+    f32 start = aurora_platform_get_time();
+
+    memset(out, 0, sizeof(RHI_RawImage));
+    out->width = source->width;
+    out->height = source->height;
+    out->format = texture_cooked_format(source, role);
+
+    u32 levels = texture_mip_count(out->width, out->height);
+    out->mip_levels = levels;
+    out->data_size = texture_layout_levels(out);
+    out->data = malloc(out->data_size);
+
+    u8* level = (u8*)source->data;
+    u8* next = malloc((u64)max(out->width >> 1, 1) * max(out->height >> 1, 1) * 4);
+    u8* scratch = next;
+
+    for (u32 i = 0; i < levels; i++)
+    {
+        u32 width = max(out->width >> i, 1);
+        u32 height = max(out->height >> i, 1);
+        texture_compress_level((u8*)out->data + out->mip_offsets[i], level, width, height, out->format);
+
+        if (i + 1 < levels)
+        {
+            // Ping-pong between the source image and one half sized scratch level
+            texture_downsample_level(next, level, width, height, role);
+            u8* previous = level;
+            level = next;
+            next = previous;
+        }
+    }
+
+    free(scratch);
+    rhi_free_raw_image(source);
+
+    // RGBA8 with a full chain is about 4/3 of the top level
+    f64 uncompressed = (f64)out->width * out->height * 4 * 4 / 3;
+    printf("Cooked texture %ux%u, %u mips, %.1fMB -> %.1fMB in %.3fs\n", out->width, out->height, levels,
+           uncompressed / (1024.0 * 1024.0), out->data_size / (1024.0 * 1024.0), aurora_platform_get_time() - start);
+}
+
+void texture_load(TextureSource* out, const char* path, u32 role)
+{
+    memset(out, 0, sizeof(TextureSource));
+
+    if (texture_load_authored(out, path))
+    {
+        // A single uncompressed level still gets its chain, block compressed files are taken as they are
+        if (out->raw.mip_levels == 1 && !texture_block_bytes(out->raw.format))
+        {
+            RHI_RawImage* raw = &out->raw;
+            raw->data = malloc(raw->data_size);
+            if (texture_read_levels(out, 0, 1, raw->data))
+                texture_build_mips(raw, role);
+            else
+                memset(out, 0, sizeof(TextureSource));
+        }
+        return;
+    }
+
+    // One cache per role, the same image cooks to a different format as a normal map than as albedo
+    const char* role_names[] = { "albedo", "normal", "data" };
+    char cache_path[512];
+    snprintf(cache_path, sizeof(cache_path), "%s.%s.cache", path, role_names[role]);
+
+    u64 source_hash = 0;
+    if (TEXTURE_COOK && texture_source_hash(path, &source_hash) && texture_cache_read(out, cache_path, role, source_hash))
+        return;
+
+    RHI_RawImage source;
+    memset(&source, 0, sizeof(source));
+    rhi_load_raw_image(&source, path);
+    if (!TEXTURE_COOK || !source.data)
+    {
+        out->raw = source;
+        if (out->raw.data)
+            texture_build_mips(&out->raw, role);
+        return;
+    }
+
+    // Once the cache is on disk it is the source like any other cooked texture, the chain is kept only when
+    // it couldn't be written
+    texture_cook(&out->raw, &source, role);
+    if (texture_cache_write(&out->raw, cache_path, role, source_hash))
+    {
+        for (u32 i = 0; i < out->raw.mip_levels; i++)
+            out->file_offsets[i] = sizeof(dds_header) + out->raw.mip_offsets[i];
+        snprintf(out->file, sizeof(out->file), "%s", cache_path);
+        texture_free(out);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef TEXTURE_H_INCLUDED
+#define TEXTURE_H_INCLUDED
+
+#include "mesh.h"
+
+// Cook material textures to block compressed DDS files with a full mip chain (<image>.<role>.cache next to the source).
+// 0 uploads the decoded RGBA8 image with a mip chain filtered on the CPU instead.
+#define TEXTURE_COOK 1
+
+// Decides the cooked format: albedo BC1, or BC7 when it has alpha, normals BC5 (X/Y), metallic-roughness BC7
+enum TextureRole
+{
+    TEXTURE_ROLE_ALBEDO,
+    TEXTURE_ROLE_NORMAL,
+    TEXTURE_ROLE_DATA
+};
+
+// A loaded texture. Containers and cooked textures stay in their file (raw.data NULL, raw describes the levels
+// and file_offsets says where each one starts), only decoded images keep their chain in raw.data.
+typedef struct TextureSource TextureSource;
+struct TextureSource
+{
+    RHI_RawImage raw;
+    char file[512];
+    u64 file_offsets[RHI_MAX_MIP_LEVELS];
+};
+
+u64  texture_level_size(VkFormat format, u32 width, u32 height);
+// KTX2 or DDS file with its mip chain as stored, 2D textures in BCn or 8 bit RGBA/BGRA only
+b32  texture_load_container(RHI_RawImage* out, const char* path);
+// In order: path itself if it is a .ktx2/.dds, a container authored next to it with the same name, the cooked
+// copy when it is up to date, cooking it (and writing the cache), the plain decode.
+// Safe on any thread, release out with texture_free.
+void texture_load(TextureSource* out, const char* path, u32 role);
+// Levels [first_level, first_level + level_count) packed largest first into dst, read from the file straight
+// into it when the source is file backed. dst is usually mapped staging memory (rhi_stage_image).
+b32  texture_read_levels(TextureSource* source, u32 first_level, u32 level_count, void* dst);
+void texture_free(TextureSource* source);
+
+#endif
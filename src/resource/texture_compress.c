@@ -0,0 +1,594 @@
+#include "texture_compress.h"
+
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#if TEXTURE_COMPRESS_SIMD && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#define TEXTURE_COMPRESS_SSE2 1
+#include <emmintrin.h>
+#else
+#define TEXTURE_COMPRESS_SSE2 0
+#endif
+
+// 4x4 pixels, channel major so four pixels of one channel are a single SSE load
+typedef struct texture_block texture_block;
+struct texture_block
+{
+    f32 c[4][16];
+};
+
+internal const u8 s_bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+internal b32 s_simd = TEXTURE_COMPRESS_SSE2;
+
+internal void block_load(texture_block* block, const u8* rgba, u32 width, u32 height, u32 x, u32 y)
+{
+    for (u32 j = 0; j < 4; j++)
+    {
+        u32 sy = min(y + j, height - 1);
+        for (u32 i = 0; i < 4; i++)
+        {
+            u32 sx = min(x + i, width - 1);
+            const u8* p = rgba + ((u64)sy * width + sx) * 4;
+            for (u32 c = 0; c < 4; c++)
+                block->c[c][j * 4 + i] = p[c];
+        }
+    }
+}
+
+// Four interleaved partial sums added pairwise, the order the SSE2 path adds in, so both give the same bits
+internal f32 block_sum16(const f32 v[16])
+{
+    f32 lane[4];
+    for (u32 l = 0; l < 4; l++)
+        lane[l] = (v[l] + v[4 + l]) + (v[8 + l] + v[12 + l]);
+    return (lane[0] + lane[2]) + (lane[1] + lane[3]);
+}
+
+// Mean and the upper triangle of the covariance matrix: rr rg rb ra gg gb ga bb ba aa
+internal void block_covariance_scalar(const texture_block* b, f32 mean[4], f32 cov[10])
+{
+    f32 d[4][16];
+    for (u32 c = 0; c < 4; c++)
+    {
+        mean[c] = block_sum16(b->c[c]) / 16.0f;
+        for (u32 i = 0; i < 16; i++)
+            d[c][i] = b->c[c][i] - mean[c];
+    }
+
+    u32 k = 0;
+    for (u32 r = 0; r < 4; r++)
+    {
+        for (u32 c = r; c < 4; c++)
+        {
+            f32 products[16];
+            for (u32 i = 0; i < 16; i++)
+                products[i] = d[r][i] * d[c][i];
+            cov[k++] = block_sum16(products);
+        }
+    }
+}
+
+// Each of the 16 pixels goes to the nearest of levels evenly spaced points between e0 and e1,
+// found by projecting onto the segment. 0 is e0, levels - 1 is e1.
+internal void block_select_scalar(const texture_block* b, const f32 e0[4], const f32 e1[4], u32 levels, u8 indices[16])
+{
+    f32 d[4];
+    f32 length2 = 0.0f;
+    for (u32 c = 0; c < 4; c++)
+    {
+        d[c] = e1[c] - e0[c];
+        length2 += d[c] * d[c];
+    }
+    f32 scale = length2 > 0.0f ? (f32)(levels - 1) / length2 : 0.0f;
+    f32 top = (f32)(levels - 1);
+
+    for (u32 i = 0; i < 16; i++)
+    {
+        f32 t = 0.0f;
+        for (u32 c = 0; c < 4; c++)
+            t += (b->c[c][i] - e0[c]) * d[c];
+
+        t = t * scale + 0.5f;
+        t = min(max(t, 0.0f), top);
+        indices[i] = (u8)(i32)t;
+    }
+}
+
+#if TEXTURE_COMPRESS_SSE2
+internal f32 sse2_horizontal_sum(__m128 v)
+{
+    __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+    return _mm_cvtss_f32(s);
+}
+
+internal void block_covariance_sse2(const texture_block* b, f32 mean[4], f32 cov[10])
+{
+    __m128 d[4][4];
+    for (u32 c = 0; c < 4; c++)
+    {
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(&b->c[c][0]), _mm_loadu_ps(&b->c[c][4])),
+                                _mm_add_ps(_mm_loadu_ps(&b->c[c][8]), _mm_loadu_ps(&b->c[c][12])));
+        mean[c] = sse2_horizontal_sum(sum) / 16.0f;
+
+        __m128 m = _mm_set1_ps(mean[c]);
+        for (u32 g = 0; g < 4; g++)
+            d[c][g] = _mm_sub_ps(_mm_loadu_ps(&b->c[c][g * 4]), m);
+    }
+
+    u32 k = 0;
+    for (u32 r = 0; r < 4; r++)
+    {
+        for (u32 c = r; c < 4; c++)
+        {
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(d[r][0], d[c][0]), _mm_mul_ps(d[r][1], d[c][1])),
+                                    _mm_add_ps(_mm_mul_ps(d[r][2], d[c][2]), _mm_mul_ps(d[r][3], d[c][3])));
+            cov[k++] = sse2_horizontal_sum(sum);
+        }
+    }
+}
+
+internal void block_select_sse2(const texture_block* b, const f32 e0[4], const f32 e1[4], u32 levels, u8 indices[16])
+{
+    f32 d[4];
+    f32 length2 = 0.0f;
+    for (u32 c = 0; c < 4; c++)
+    {
+        d[c] = e1[c] - e0[c];
+        length2 += d[c] * d[c];
+    }
+    f32 scale = length2 > 0.0f ? (f32)(levels - 1) / length2 : 0.0f;
+
+    __m128 half = _mm_set1_ps(0.5f);
+    __m128 zero = _mm_setzero_ps();
+    __m128 top = _mm_set1_ps((f32)(levels - 1));
+    __m128 scale4 = _mm_set1_ps(scale);
+
+    for (u32 g = 0; g < 4; g++)
+    {
+        __m128 t = zero;
+        for (u32 c = 0; c < 4; c++)
+        {
+            __m128 p = _mm_sub_ps(_mm_loadu_ps(&b->c[c][g * 4]), _mm_set1_ps(e0[c]));
+            t = _mm_add_ps(t, _mm_mul_ps(p, _mm_set1_ps(d[c])));
+        }
+
+        t = _mm_add_ps(_mm_mul_ps(t, scale4), half);
+        t = _mm_min_ps(_mm_max_ps(t, zero), top);
+
+        __m128i k = _mm_cvttps_epi32(t);
+        k = _mm_packs_epi32(k, k);
+        k = _mm_packus_epi16(k, k);
+        i32 packed = _mm_cvtsi128_si32(k);
+        memcpy(&indices[g * 4], &packed, 4);
+    }
+}
+
+#endif
+
+internal void block_covariance(const texture_block* b, f32 mean[4], f32 cov[10])
+{
+#if TEXTURE_COMPRESS_SSE2
+    if (s_simd)
+    {
+        block_covariance_sse2(b, mean, cov);
+        return;
+    }
+#endif
+    block_covariance_scalar(b, mean, cov);
+}
+
+internal void block_select(const texture_block* b, const f32 e0[4], const f32 e1[4], u32 levels, u8 indices[16])
+{
+#if TEXTURE_COMPRESS_SSE2
+    if (s_simd)
+    {
+        block_select_sse2(b, e0, e1, levels, indices);
+        return;
+    }
+#endif
+    block_select_scalar(b, e0, e1, levels, indices);
+}
+
+// Power iteration on the covariance, zero for a flat block
+internal void block_principal_axis(const f32 cov[10], f32 axis[4])
+{
+    f32 m[4][4] =
+    {
+        { cov[0], cov[1], cov[2], cov[3] },
+        { cov[1], cov[4], cov[5], cov[6] },
+        { cov[2], cov[5], cov[7], cov[8] },
+        { cov[3], cov[6], cov[8], cov[9] },
+    };
+
+    // The row of the widest channel can't be orthogonal to the principal axis
+    u32 row = 0;
+    for (u32 i = 1; i < 4; i++)
+        if (m[i][i] > m[row][row])
+            row = i;
+
+    f32 v[4] = { m[row][0], m[row][1], m[row][2], m[row][3] };
+    for (u32 iteration = 0; iteration < 8; iteration++)
+    {
+        f32 w[4];
+        f32 largest = 0.0f;
+        for (u32 r = 0; r < 4; r++)
+        {
+            w[r] = m[r][0] * v[0] + m[r][1] * v[1] + m[r][2] * v[2] + m[r][3] * v[3];
+            largest = max(largest, fabsf(w[r]));
+        }
+        if (largest < 1e-6f)
+            break;
+        for (u32 r = 0; r < 4; r++)
+            v[r] = w[r] / largest;
+    }
+
+    f32 length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2] + v[3] * v[3]);
+    for (u32 c = 0; c < 4; c++)
+        axis[c] = length > 1e-6f ? v[c] / length : 0.0f;
+}
+
+// Endpoints at the extremes of the block projected onto its principal axis
+internal void block_fit_endpoints(const texture_block* b, f32 e0[4], f32 e1[4])
+{
+    f32 mean[4], cov[10], axis[4];
+    block_covariance(b, mean, cov);
+    block_principal_axis(cov, axis);
+
+    f32 t_min = FLT_MAX, t_max = -FLT_MAX;
+    for (u32 i = 0; i < 16; i++)
+    {
+        f32 t = 0.0f;
+        for (u32 c = 0; c < 4; c++)
+            t += (b->c[c][i] - mean[c]) * axis[c];
+        t_min = min(t_min, t);
+        t_max = max(t_max, t);
+    }
+
+    for (u32 c = 0; c < 4; c++)
+    {
+        e0[c] = min(max(mean[c] + axis[c] * t_min, 0.0f), 255.0f);
+        e1[c] = min(max(mean[c] + axis[c] * t_max, 0.0f), 255.0f);
+    }
+}
+
+// Least squares endpoints for fixed indices, weights[k] is how far index k sits from e0 towards e1.
+// Returns 0 and leaves the endpoints alone when every pixel uses the same weight.
+internal b32 block_refit(const texture_block* b, const u8 indices[16], const f32* weights, f32 e0[4], f32 e1[4])
+{
+    f32 aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    f32 x[4] = {0}, y[4] = {0};
+
+    for (u32 i = 0; i < 16; i++)
+    {
+        f32 w = weights[indices[i]];
+        f32 iw = 1.0f - w;
+        aa += iw * iw;
+        ab += iw * w;
+        bb += w * w;
+        for (u32 c = 0; c < 4; c++)
+        {
+            x[c] += iw * b->c[c][i];
+            y[c] += w * b->c[c][i];
+        }
+    }
+
+    f32 det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f)
+        return 0;
+
+    for (u32 c = 0; c < 4; c++)
+    {
+        e0[c] = min(max((bb * x[c] - ab * y[c]) / det, 0.0f), 255.0f);
+        e1[c] = min(max((aa * y[c] - ab * x[c]) / det, 0.0f), 255.0f);
+    }
+    return 1;
+}
+
+internal f32 block_error(const texture_block* b, const f32 (*palette)[4], const u8 indices[16])
+{
+    f32 error = 0.0f;
+    for (u32 i = 0; i < 16; i++)
+    {
+        for (u32 c = 0; c < 4; c++)
+        {
+            f32 d = b->c[c][i] - palette[indices[i]][c];
+            error += d * d;
+        }
+    }
+    return error;
+}
+
+internal u16 bc1_pack_565(const f32 c[4])
+{
+    u32 r = (u32)(c[0] * 31.0f / 255.0f + 0.5f);
+    u32 g = (u32)(c[1] * 63.0f / 255.0f + 0.5f);
+    u32 b = (u32)(c[2] * 31.0f / 255.0f + 0.5f);
+    return (u16)((r << 11) | (g << 5) | b);
+}
+
+internal void bc1_unpack_565(u16 v, f32 c[4])
+{
+    u32 r = v >> 11, g = (v >> 5) & 63, b = v & 31;
+    c[0] = (f32)((r << 3) | (r >> 2));
+    c[1] = (f32)((g << 2) | (g >> 4));
+    c[2] = (f32)((b << 3) | (b >> 2));
+    c[3] = 0.0f;
+}
+
+// Quantizes both endpoints, then picks indices against what the hardware will actually decode
+internal f32 bc1_evaluate(const texture_block* b, const f32 e0[4], const f32 e1[4], u16 colors[2], u8 positions[16])
+{
+    colors[0] = bc1_pack_565(e0);
+    colors[1] = bc1_pack_565(e1);
+
+    f32 palette[4][4];
+    bc1_unpack_565(colors[0], palette[0]);
+    bc1_unpack_565(colors[1], palette[3]);
+    for (u32 c = 0; c < 4; c++)
+    {
+        palette[1][c] = (2.0f * palette[0][c] + palette[3][c]) / 3.0f;
+        palette[2][c] = (palette[0][c] + 2.0f * palette[3][c]) / 3.0f;
+    }
+
+    block_select(b, palette[0], palette[3], 4, positions);
+    return block_error(b, (const f32 (*)[4])palette, positions);
+}
+
+internal void bc1_encode_block(u8* dst, const texture_block* src)
+{
+    // Alpha doesn't take part, the 4 colour mode always decodes it as opaque
+    texture_block b = *src;
+    memset(b.c[3], 0, sizeof(b.c[3]));
+
+    f32 e0[4], e1[4];
+    block_fit_endpoints(&b, e0, e1);
+
+    u16 colors[2];
+    u8 positions[16];
+    f32 error = bc1_evaluate(&b, e0, e1, colors, positions);
+
+    const f32 weights[4] = { 0.0f, 1.0f / 3.0f, 2.0f / 3.0f, 1.0f };
+    if (block_refit(&b, positions, weights, e0, e1))
+    {
+        u16 refit_colors[2];
+        u8 refit_positions[16];
+        if (bc1_evaluate(&b, e0, e1, refit_colors, refit_positions) < error)
+        {
+            memcpy(colors, refit_colors, sizeof(colors));
+            memcpy(positions, refit_positions, sizeof(positions));
+        }
+    }
+
+    // Positions run from e0 to e1, the index encoding is 0 = c0, 1 = c1, 2 = 2/3 c0 + 1/3 c1, 3 = 1/3 c0 + 2/3 c1.
+    // c0 > c1 selects the 4 colour mode, equal colours decode the same either way.
+    const u8 remap[4] = { 0, 2, 3, 1 };
+    b32 swap = colors[0] < colors[1];
+    u32 bits = 0;
+    if (colors[0] != colors[1])
+    {
+        for (u32 i = 0; i < 16; i++)
+        {
+            u32 position = swap ? 3 - positions[i] : positions[i];
+            bits |= (u32)remap[position] << (i * 2);
+        }
+    }
+
+    u16 c0 = swap ? colors[1] : colors[0];
+    u16 c1 = swap ? colors[0] : colors[1];
+    dst[0] = (u8)c0;
+    dst[1] = (u8)(c0 >> 8);
+    dst[2] = (u8)c1;
+    dst[3] = (u8)(c1 >> 8);
+    for (u32 i = 0; i < 4; i++)
+        dst[4 + i] = (u8)(bits >> (i * 8));
+}
+
+// 8 value mode only: endpoint 0 is the maximum, indices 2-7 interpolate from it towards endpoint 1
+internal void bc4_encode_block(u8* dst, const texture_block* src, u32 channel)
+{
+    texture_block b;
+    memset(&b, 0, sizeof(b));
+    memcpy(b.c[0], src->c[channel], sizeof(b.c[0]));
+
+    f32 lo = 255.0f, hi = 0.0f;
+    for (u32 i = 0; i < 16; i++)
+    {
+        lo = min(lo, b.c[0][i]);
+        hi = max(hi, b.c[0][i]);
+    }
+
+    u8 e0 = (u8)(hi + 0.5f);
+    u8 e1 = (u8)(lo + 0.5f);
+    dst[0] = e0;
+    dst[1] = e1;
+
+    u64 bits = 0;
+    if (e0 > e1)
+    {
+        f32 from[4] = { (f32)e1, 0.0f, 0.0f, 0.0f };
+        f32 to[4] = { (f32)e0, 0.0f, 0.0f, 0.0f };
+        u8 positions[16];
+        block_select(&b, from, to, 8, positions);
+
+        for (u32 i = 0; i < 16; i++)
+        {
+            u32 position = positions[i];
+            u32 index = position == 7 ? 0 : position == 0 ? 1 : 8 - position;
+            bits |= (u64)index << (i * 3);
+        }
+    }
+
+    for (u32 i = 0; i < 6; i++)
+        dst[2 + i] = (u8)(bits >> (i * 8));
+}
+
+internal void bc7_quantize_endpoint(const f32 e[4], u8 q[4], u32* p_bit)
+{
+    f32 best_error = FLT_MAX;
+    for (u32 p = 0; p < 2; p++)
+    {
+        u8 candidate[4];
+        f32 error = 0.0f;
+        for (u32 c = 0; c < 4; c++)
+        {
+            i32 v = (i32)((e[c] - (f32)p) * 0.5f + 0.5f);
+            v = min(max(v, 0), 127);
+            candidate[c] = (u8)v;
+
+            f32 d = (f32)((v << 1) | p) - e[c];
+            error += d * d;
+        }
+
+        if (error < best_error)
+        {
+            best_error = error;
+            memcpy(q, candidate, 4);
+            *p_bit = p;
+        }
+    }
+}
+
+internal f32 bc7_evaluate(const texture_block* b, const f32 e0[4], const f32 e1[4], u8 q[2][4], u32 p[2], u8 indices[16])
+{
+    bc7_quantize_endpoint(e0, q[0], &p[0]);
+    bc7_quantize_endpoint(e1, q[1], &p[1]);
+
+    f32 palette[16][4];
+    for (u32 c = 0; c < 4; c++)
+    {
+        u32 a = (q[0][c] << 1) | p[0];
+        u32 z = (q[1][c] << 1) | p[1];
+        for (u32 k = 0; k < 16; k++)
+            palette[k][c] = (f32)(((64 - s_bc7_weights[k]) * a + s_bc7_weights[k] * z + 32) >> 6);
+    }
+
+    // The weights are close enough to even that projecting lands on the nearest one or its neighbour
+    block_select(b, palette[0], palette[15], 16, indices);
+    return block_error(b, (const f32 (*)[4])palette, indices);
+}
+
+internal void bits_put(u8* dst, u32* position, u32 value, u32 count)
+{
+    for (u32 i = 0; i < count; i++, (*position)++)
+        if ((value >> i) & 1)
+            dst[*position >> 3] |= (u8)(1 << (*position & 7));
+}
+
+// Mode 6: one subset, RGBA 7.7.7.7 endpoints with a p-bit each, 4 bit indices
+internal void bc7_encode_block(u8* dst, const texture_block* b)
+{
+    f32 e0[4], e1[4];
+    block_fit_endpoints(b, e0, e1);
+
+    u8 q[2][4];
+    u32 p[2];
+    u8 indices[16];
+    f32 error = bc7_evaluate(b, e0, e1, q, p, indices);
+
+    f32 weights[16];
+    for (u32 k = 0; k < 16; k++)
+        weights[k] = s_bc7_weights[k] / 64.0f;
+
+    if (block_refit(b, indices, weights, e0, e1))
+    {
+        u8 refit_q[2][4];
+        u32 refit_p[2];
+        u8 refit_indices[16];
+        if (bc7_evaluate(b, e0, e1, refit_q, refit_p, refit_indices) < error)
+        {
+            memcpy(q, refit_q, sizeof(q));
+            memcpy(p, refit_p, sizeof(p));
+            memcpy(indices, refit_indices, sizeof(indices));
+        }
+    }
+
+    // The first index is stored with its top bit implied zero
+    u32 first = 0, second = 1;
+    if (indices[0] & 8)
+    {
+        first = 1;
+        second = 0;
+        for (u32 i = 0; i < 16; i++)
+            indices[i] = 15 - indices[i];
+    }
+
+    memset(dst, 0, 16);
+    u32 position = 0;
+    bits_put(dst, &position, 1 << 6, 7);
+    for (u32 c = 0; c < 4; c++)
+    {
+        bits_put(dst, &position, q[first][c], 7);
+        bits_put(dst, &position, q[second][c], 7);
+    }
+    bits_put(dst, &position, p[first], 1);
+    bits_put(dst, &position, p[second], 1);
+    bits_put(dst, &position, indices[0], 3);
+    for (u32 i = 1; i < 16; i++)
+        bits_put(dst, &position, indices[i], 4);
+}
+
+b32 texture_compress_simd_supported()
+{
+    return TEXTURE_COMPRESS_SSE2;
+}
+
+void texture_compress_set_simd(b32 enabled)
+{
+    s_simd = enabled && TEXTURE_COMPRESS_SSE2;
+}
+
+u32 texture_block_bytes(VkFormat format)
+{
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+        case VK_FORMAT_BC4_UNORM_BLOCK:
+            return 8;
+        case VK_FORMAT_BC2_UNORM_BLOCK:
+        case VK_FORMAT_BC3_UNORM_BLOCK:
+        case VK_FORMAT_BC5_UNORM_BLOCK:
+        case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+        case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+        case VK_FORMAT_BC7_UNORM_BLOCK:
+            return 16;
+        default:
+            return 0;
+    }
+}
+
+void texture_compress_rows(void* dst, const u8* rgba, u32 width, u32 height, VkFormat format, u32 first_row, u32 row_count)
+{
+    u32 block_bytes = texture_block_bytes(format);
+    u32 blocks_x = (width + 3) / 4;
+
+    for (u32 by = first_row; by < first_row + row_count; by++)
+    {
+        for (u32 bx = 0; bx < blocks_x; bx++)
+        {
+            texture_block block;
+            block_load(&block, rgba, width, height, bx * 4, by * 4);
+
+            u8* out = (u8*)dst + ((u64)by * blocks_x + bx) * block_bytes;
+            switch (format)
+            {
+                case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: bc1_encode_block(out, &block); break;
+                case VK_FORMAT_BC4_UNORM_BLOCK: bc4_encode_block(out, &block, 0); break;
+                case VK_FORMAT_BC5_UNORM_BLOCK:
+                    bc4_encode_block(out, &block, 0);
+                    bc4_encode_block(out + 8, &block, 1);
+                    break;
+                case VK_FORMAT_BC7_UNORM_BLOCK: bc7_encode_block(out, &block); break;
+                default: break;
+            }
+        }
+    }
+}
+
+void texture_compress(void* dst, const u8* rgba, u32 width, u32 height, VkFormat format)
+{
+    texture_compress_rows(dst, rgba, width, height, format, 0, (height + 3) / 4);
+}
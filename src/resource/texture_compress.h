@@ -0,0 +1,23 @@
+#ifndef TEXTURE_COMPRESS_H_INCLUDED
+#define TEXTURE_COMPRESS_H_INCLUDED
+
+#include <core/common.h>
+#include <gfx/rhi.h>
+
+// SSE2 covariance and index selection, 0 keeps the scalar reference only. Both produce the same blocks,
+// tests/texture_compress_test.c compares them.
+#define TEXTURE_COMPRESS_SIMD 1
+
+b32  texture_compress_simd_supported();
+// 0 switches to the scalar reference, for comparing the two. Not safe while compression jobs run.
+void texture_compress_set_simd(b32 enabled);
+
+// 8 for BC1/BC4, 16 for the other BC formats, 0 for uncompressed ones
+u32  texture_block_bytes(VkFormat format);
+// BC1 (opaque, 4 colour mode), BC4/BC5 from the red (and green) channel, BC7 mode 6 for everything else.
+// rgba is tightly packed RGBA8, partial blocks at the right and bottom edges repeat the last row/column.
+void texture_compress(void* dst, const u8* rgba, u32 width, u32 height, VkFormat format);
+// Block rows [first_row, first_row + row_count) only, so one level can be split across jobs
+void texture_compress_rows(void* dst, const u8* rgba, u32 width, u32 height, VkFormat format, u32 first_row, u32 row_count);
+
+#endif
@@ -0,0 +1,379 @@
+#include "texture_mips.h"
+
+#include <string.h>
+#include <math.h>
+
+#if TEXTURE_MIPS_SIMD && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64))
+#define TEXTURE_MIPS_SSE2 1
+#include <emmintrin.h>
+#else
+#define TEXTURE_MIPS_SSE2 0
+#endif
+
+// Compiled whatever the build targets and only taken when the CPU has it, see texture_mips_init. MSVC
+// emits the intrinsics as they are, gcc and clang need the functions marked.
+#if TEXTURE_MIPS_SSE2 && (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define TEXTURE_MIPS_AVX2 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define MIPS_AVX2 __attribute__((target("avx2")))
+#else
+#include <intrin.h>
+#define MIPS_AVX2
+#endif
+#else
+#define TEXTURE_MIPS_AVX2 0
+#endif
+
+// Linear light is quantized to this many steps before the table lookup back to sRGB, fine enough that
+// the darkest step stays under one 8 bit code
+#define TEXTURE_MIPS_SRGB_STEPS 4096
+
+internal f32 s_srgb_to_linear[256];
+internal u8 s_linear_to_srgb[TEXTURE_MIPS_SRGB_STEPS];
+
+internal u32 s_supported_path;
+internal u32 s_path;
+
+#if TEXTURE_MIPS_AVX2
+internal b32 mips_cpu_has_avx2()
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    i32 info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+
+    // AVX and OSXSAVE, then the OS has to save the YMM registers too
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        return 0;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#endif
+}
+#endif
+
+void texture_mips_init()
+{
+    s_supported_path = TEXTURE_MIPS_PATH_SCALAR;
+#if TEXTURE_MIPS_SSE2
+    s_supported_path = TEXTURE_MIPS_PATH_SSE2;
+#endif
+#if TEXTURE_MIPS_AVX2
+    if (mips_cpu_has_avx2())
+        s_supported_path = TEXTURE_MIPS_PATH_AVX2;
+#endif
+    s_path = s_supported_path;
+
+    for (u32 i = 0; i < 256; i++)
+    {
+        f32 c = i / 255.0f;
+        s_srgb_to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    for (u32 i = 0; i < TEXTURE_MIPS_SRGB_STEPS; i++)
+    {
+        f32 l = i / (f32)(TEXTURE_MIPS_SRGB_STEPS - 1);
+        f32 c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+        s_linear_to_srgb[i] = (u8)(c * 255.0f + 0.5f);
+    }
+}
+
+u32 texture_mips_supported_path()
+{
+    return s_supported_path;
+}
+
+void texture_mips_set_path(u32 path)
+{
+    s_path = min(path, s_supported_path);
+}
+
+u32 texture_mip_count(u32 width, u32 height)
+{
+    u32 levels = 1;
+    while (levels < RHI_MAX_MIP_LEVELS && (width >> levels || height >> levels))
+        levels++;
+    return levels;
+}
+
+// Albedo colour to linear light, normals to [-1, 1], everything else to [0, 1]
+internal void mips_decode_scalar(const u8* p, u32 role, f32 v[4])
+{
+    for (u32 c = 0; c < 4; c++)
+        v[c] = role == TEXTURE_ROLE_ALBEDO && c < 3 ? s_srgb_to_linear[p[c]] : p[c] * (1.0f / 255.0f);
+
+    if (role == TEXTURE_ROLE_NORMAL)
+        for (u32 c = 0; c < 4; c++)
+            v[c] = v[c] * 2.0f - 1.0f;
+}
+
+internal void mips_encode_scalar(f32 v[4], u32 role, u8* p)
+{
+    if (role == TEXTURE_ROLE_NORMAL)
+    {
+        // Same summation order as the SIMD paths, so they agree byte for byte unless the compiler reorders
+        // float math (-ffast-math, -fp:fast). tests/texture_mips_test.c checks it under the release flags.
+        f32 length = sqrtf((v[0] * v[0] + v[2] * v[2]) + v[1] * v[1]);
+        if (length > 1e-6f)
+        {
+            v[0] /= length;
+            v[1] /= length;
+            v[2] /= length;
+        }
+        else
+        {
+            v[0] = 0.0f;
+            v[1] = 0.0f;
+            v[2] = 1.0f;
+        }
+
+        for (u32 c = 0; c < 4; c++)
+            v[c] = v[c] * 0.5f + 0.5f;
+    }
+
+    for (u32 c = 0; c < 4; c++)
+    {
+        f32 u = min(max(v[c], 0.0f), 1.0f);
+        if (role == TEXTURE_ROLE_ALBEDO && c < 3)
+            p[c] = s_linear_to_srgb[(i32)(u * (TEXTURE_MIPS_SRGB_STEPS - 1) + 0.5f)];
+        else
+            p[c] = (u8)(i32)(u * 255.0f + 0.5f);
+    }
+}
+
+// Destination pixels [x, dst_width) of one row, clamping at the right edge
+internal void mips_row_scalar(u8* dst, const u8* row0, const u8* row1, u32 width, u32 dst_width, u32 role, u32 x)
+{
+    for (; x < dst_width; x++)
+    {
+        u32 x0 = min(x * 2, width - 1) * 4;
+        u32 x1 = min(x * 2 + 1, width - 1) * 4;
+        u8* out = dst + x * 4;
+
+        if (role == TEXTURE_ROLE_DATA)
+        {
+            for (u32 c = 0; c < 4; c++)
+                out[c] = (u8)((row0[x0 + c] + row1[x0 + c] + row0[x1 + c] + row1[x1 + c] + 2) >> 2);
+            continue;
+        }
+
+        f32 a[4], b[4], c[4], d[4], v[4];
+        mips_decode_scalar(row0 + x0, role, a);
+        mips_decode_scalar(row1 + x0, role, b);
+        mips_decode_scalar(row0 + x1, role, c);
+        mips_decode_scalar(row1 + x1, role, d);
+        for (u32 k = 0; k < 4; k++)
+            v[k] = ((a[k] + b[k]) + (c[k] + d[k])) * 0.25f;
+        mips_encode_scalar(v, role, out);
+    }
+}
+
+#if TEXTURE_MIPS_SSE2
+// One RGBA pixel per register
+internal __m128 mips_decode_sse2(const u8* p, u32 role)
+{
+    if (role == TEXTURE_ROLE_ALBEDO)
+        return _mm_setr_ps(s_srgb_to_linear[p[0]], s_srgb_to_linear[p[1]], s_srgb_to_linear[p[2]], p[3] * (1.0f / 255.0f));
+
+    i32 packed;
+    memcpy(&packed, p, 4);
+    __m128i zero = _mm_setzero_si128();
+    __m128i k = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero), zero);
+    __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(k), _mm_set1_ps(1.0f / 255.0f));
+    return _mm_sub_ps(_mm_mul_ps(v, _mm_set1_ps(2.0f)), _mm_set1_ps(1.0f));
+}
+
+internal void mips_encode_sse2(__m128 v, u32 role, u8* p)
+{
+    __m128 half = _mm_set1_ps(0.5f);
+
+    if (role == TEXTURE_ROLE_NORMAL)
+    {
+        __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+        __m128 sq = _mm_and_ps(_mm_mul_ps(v, v), xyz);
+        __m128 s = _mm_add_ps(sq, _mm_movehl_ps(sq, sq));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 0x55));
+        f32 length = _mm_cvtss_f32(_mm_sqrt_ss(s));
+
+        __m128 n = length > 1e-6f ? _mm_div_ps(v, _mm_set1_ps(length)) : _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f);
+        v = _mm_or_ps(_mm_and_ps(n, xyz), _mm_andnot_ps(xyz, v));
+        v = _mm_add_ps(_mm_mul_ps(v, half), half);
+    }
+
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+
+    if (role == TEXTURE_ROLE_ALBEDO)
+    {
+        f32 steps = (f32)(TEXTURE_MIPS_SRGB_STEPS - 1);
+        i32 k[4];
+        _mm_storeu_si128((__m128i*)k, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_setr_ps(steps, steps, steps, 255.0f)), half)));
+        p[0] = s_linear_to_srgb[k[0]];
+        p[1] = s_linear_to_srgb[k[1]];
+        p[2] = s_linear_to_srgb[k[2]];
+        p[3] = (u8)k[3];
+        return;
+    }
+
+    __m128i k = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), half));
+    k = _mm_packs_epi32(k, k);
+    k = _mm_packus_epi16(k, k);
+    i32 packed = _mm_cvtsi128_si32(k);
+    memcpy(p, &packed, 4);
+}
+
+// Returns the first destination pixel left for the scalar tail
+internal u32 mips_row_sse2(u8* dst, const u8* row0, const u8* row1, u32 width, u32 dst_width, u32 role, u32 x)
+{
+    if (role == TEXTURE_ROLE_DATA)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i two = _mm_set1_epi16(2);
+
+        // Two destination pixels from four source pixels of each row
+        for (; x + 2 <= dst_width && (x + 2) * 2 <= width; x += 2)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+            __m128i b = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+            sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+            _mm_storel_epi64((__m128i*)(dst + x * 4), _mm_packus_epi16(sum, sum));
+        }
+        return x;
+    }
+
+    for (; x < dst_width && x * 2 + 1 < width; x++)
+    {
+        __m128 s0 = _mm_add_ps(mips_decode_sse2(row0 + x * 8, role), mips_decode_sse2(row1 + x * 8, role));
+        __m128 s1 = _mm_add_ps(mips_decode_sse2(row0 + x * 8 + 4, role), mips_decode_sse2(row1 + x * 8 + 4, role));
+        mips_encode_sse2(_mm_mul_ps(_mm_add_ps(s0, s1), _mm_set1_ps(0.25f)), role, dst + x * 4);
+    }
+    return x;
+}
+#endif
+
+#if TEXTURE_MIPS_AVX2
+// Two RGBA pixels per register, one in each 128 bit lane
+MIPS_AVX2 internal __m256 mips_decode_avx2(const u8* p, u32 role)
+{
+    __m256i k = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p));
+    __m256 v = _mm256_mul_ps(_mm256_cvtepi32_ps(k), _mm256_set1_ps(1.0f / 255.0f));
+
+    if (role == TEXTURE_ROLE_ALBEDO)
+        return _mm256_blend_ps(_mm256_i32gather_ps(s_srgb_to_linear, k, 4), v, 0x88);
+    return _mm256_sub_ps(_mm256_mul_ps(v, _mm256_set1_ps(2.0f)), _mm256_set1_ps(1.0f));
+}
+
+MIPS_AVX2 internal void mips_encode_avx2(__m256 v, u32 role, u8* p)
+{
+    __m256 half = _mm256_set1_ps(0.5f);
+
+    if (role == TEXTURE_ROLE_NORMAL)
+    {
+        __m256 xyz = _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1, -1, 0, -1, -1, -1, 0));
+        __m256 sq = _mm256_and_ps(_mm256_mul_ps(v, v), xyz);
+        __m256 s = _mm256_add_ps(sq, _mm256_permute_ps(sq, _MM_SHUFFLE(3, 2, 3, 2)));
+        s = _mm256_add_ps(s, _mm256_permute_ps(s, _MM_SHUFFLE(1, 1, 1, 1)));
+        __m256 length = _mm256_sqrt_ps(_mm256_permute_ps(s, 0));
+
+        __m256 valid = _mm256_cmp_ps(length, _mm256_set1_ps(1e-6f), _CMP_GT_OQ);
+        __m256 fallback = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+        __m256 n = _mm256_blendv_ps(fallback, _mm256_div_ps(v, length), valid);
+        v = _mm256_or_ps(_mm256_and_ps(n, xyz), _mm256_andnot_ps(xyz, v));
+        v = _mm256_add_ps(_mm256_mul_ps(v, half), half);
+    }
+
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+
+    if (role == TEXTURE_ROLE_ALBEDO)
+    {
+        f32 steps = (f32)(TEXTURE_MIPS_SRGB_STEPS - 1);
+        __m256 scale = _mm256_setr_ps(steps, steps, steps, 255.0f, steps, steps, steps, 255.0f);
+        i32 k[8];
+        _mm256_storeu_si256((__m256i*)k, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, scale), half)));
+        for (u32 i = 0; i < 8; i += 4)
+        {
+            p[i + 0] = s_linear_to_srgb[k[i + 0]];
+            p[i + 1] = s_linear_to_srgb[k[i + 1]];
+            p[i + 2] = s_linear_to_srgb[k[i + 2]];
+            p[i + 3] = (u8)k[i + 3];
+        }
+        return;
+    }
+
+    __m256i k = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps(255.0f)), half));
+    k = _mm256_packs_epi32(k, k);
+    k = _mm256_packus_epi16(k, k);
+    i32 packed[2] = { _mm256_cvtsi256_si32(k), _mm256_extract_epi32(k, 4) };
+    memcpy(p, packed, 8);
+}
+
+MIPS_AVX2 internal u32 mips_row_avx2(u8* dst, const u8* row0, const u8* row1, u32 width, u32 dst_width, u32 role, u32 x)
+{
+    if (role == TEXTURE_ROLE_DATA)
+    {
+        __m256i zero = _mm256_setzero_si256();
+        __m256i two = _mm256_set1_epi16(2);
+
+        // Unpacks stay within 128 bit lanes, so this is the SSE2 path twice over and one cross lane fix up
+        for (; x + 4 <= dst_width && (x + 4) * 2 <= width; x += 4)
+        {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(row0 + x * 8));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(row1 + x * 8));
+            __m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(a, zero), _mm256_unpacklo_epi8(b, zero));
+            __m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(a, zero), _mm256_unpackhi_epi8(b, zero));
+            __m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+            sum = _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128((__m128i*)(dst + x * 4), _mm256_castsi256_si128(packed));
+        }
+        return x;
+    }
+
+    for (; x + 2 <= dst_width && (x + 2) * 2 <= width; x += 2)
+    {
+        // Column sums of source pixels 2x..2x+3, regrouped so each lane holds one destination pixel's pair
+        __m256 s0 = _mm256_add_ps(mips_decode_avx2(row0 + x * 8, role), mips_decode_avx2(row1 + x * 8, role));
+        __m256 s1 = _mm256_add_ps(mips_decode_avx2(row0 + x * 8 + 8, role), mips_decode_avx2(row1 + x * 8 + 8, role));
+        __m256 even = _mm256_permute2f128_ps(s0, s1, 0x20);
+        __m256 odd = _mm256_permute2f128_ps(s0, s1, 0x31);
+        mips_encode_avx2(_mm256_mul_ps(_mm256_add_ps(even, odd), _mm256_set1_ps(0.25f)), role, dst + x * 4);
+    }
+    return x;
+}
+#endif
+
+void texture_downsample_rows(u8* dst, const u8* src, u32 width, u32 height, u32 role, u32 first_row, u32 row_count)
+{
+    u32 dst_width = max(width >> 1, 1);
+
+    for (u32 y = first_row; y < first_row + row_count; y++)
+    {
+        const u8* row0 = src + (u64)min(y * 2, height - 1) * width * 4;
+        const u8* row1 = src + (u64)min(y * 2 + 1, height - 1) * width * 4;
+        u8* out = dst + (u64)y * dst_width * 4;
+
+        u32 x = 0;
+#if TEXTURE_MIPS_AVX2
+        if (s_path >= TEXTURE_MIPS_PATH_AVX2)
+            x = mips_row_avx2(out, row0, row1, width, dst_width, role, x);
+#endif
+#if TEXTURE_MIPS_SSE2
+        if (s_path >= TEXTURE_MIPS_PATH_SSE2)
+            x = mips_row_sse2(out, row0, row1, width, dst_width, role, x);
+#endif
+        mips_row_scalar(out, row0, row1, width, dst_width, role, x);
+    }
+}
+
+void texture_downsample(u8* dst, const u8* src, u32 width, u32 height, u32 role)
+{
+    texture_downsample_rows(dst, src, width, height, role, 0, max(height >> 1, 1));
+}
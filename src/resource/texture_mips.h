@@ -0,0 +1,29 @@
+#ifndef TEXTURE_MIPS_H_INCLUDED
+#define TEXTURE_MIPS_H_INCLUDED
+
+#include "texture.h"
+
+// SSE2 row filters, AVX2 ones when the CPU has it, 0 keeps the scalar reference only
+#define TEXTURE_MIPS_SIMD 1
+
+enum TextureMipsPath
+{
+    TEXTURE_MIPS_PATH_SCALAR,
+    TEXTURE_MIPS_PATH_SSE2,
+    TEXTURE_MIPS_PATH_AVX2
+};
+
+// Builds the sRGB lookup tables and picks the fastest path the CPU runs, call once before any downsampling
+void texture_mips_init();
+u32  texture_mips_supported_path();
+// Caps the path used from now on, for comparing them. Not safe while downsampling jobs run.
+void texture_mips_set_path(u32 path);
+// Levels down to 1x1, capped at RHI_MAX_MIP_LEVELS
+u32  texture_mip_count(u32 width, u32 height);
+// Next RGBA8 level of a width x height one with a 2x2 box. Albedo is averaged in linear light and re-encoded
+// to sRGB, normals are renormalized, anything else is averaged as is. Odd edges reuse the last row/column.
+void texture_downsample(u8* dst, const u8* src, u32 width, u32 height, u32 role);
+// Destination rows [first_row, first_row + row_count) only, so one level can be split across jobs
+void texture_downsample_rows(u8* dst, const u8* src, u32 width, u32 height, u32 role, u32 first_row, u32 row_count);
+
+#endif
@@ -0,0 +1,211 @@
+#include "vertex_cache.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef struct tipsify_state tipsify_state;
+struct tipsify_state
+{
+    // Vertex -> triangles, CSR style
+    u32* offsets;
+    u32* triangles;
+    // Triangles not emitted yet for each vertex
+    u32* live;
+    u32* cache_time;
+
+    u32* dead_end;
+    u32 dead_end_count;
+    u32 vertex_count;
+    u32 input_cursor;
+};
+
+internal i64 tipsify_skip_dead_end(tipsify_state* state)
+{
+    while (state->dead_end_count > 0)
+    {
+        u32 v = state->dead_end[--state->dead_end_count];
+        if (state->live[v] > 0)
+            return v;
+    }
+
+    while (state->input_cursor < state->vertex_count)
+    {
+        u32 v = state->input_cursor++;
+        if (state->live[v] > 0)
+            return v;
+    }
+
+    return -1;
+}
+
+internal i64 tipsify_next_vertex(tipsify_state* state, const u32* candidates, u32 candidate_count, u32 time, u32 cache_size)
+{
+    i64 best = -1;
+    i64 best_priority = -1;
+
+    for (u32 i = 0; i < candidate_count; i++)
+    {
+        u32 v = candidates[i];
+        if (state->live[v] == 0)
+            continue;
+
+        // Prefer the oldest vertex that is still going to be in the cache after its whole fan is emitted
+        i64 priority = 0;
+        if (time - state->cache_time[v] + 2 * state->live[v] <= cache_size)
+            priority = time - state->cache_time[v];
+
+        if (priority > best_priority)
+        {
+            best = v;
+            best_priority = priority;
+        }
+    }
+
+    if (best < 0)
+        best = tipsify_skip_dead_end(state);
+
+    return best;
+}
+
+void vertex_cache_optimize(u32* indices, u32 index_count, u32 vertex_count, u32 cache_size)
+{
+    u32 triangle_count = index_count / 3;
+    if (triangle_count == 0 || vertex_count == 0)
+        return;
+
+    tipsify_state state;
+    memset(&state, 0, sizeof(state));
+    state.vertex_count = vertex_count;
+    state.offsets = malloc(vertex_count * sizeof(u32));
+    state.triangles = malloc(triangle_count * 3 * sizeof(u32));
+    state.live = calloc(vertex_count, sizeof(u32));
+    state.cache_time = calloc(vertex_count, sizeof(u32));
+    state.dead_end = malloc(triangle_count * 3 * sizeof(u32));
+
+    for (u32 i = 0; i < triangle_count * 3; i++)
+        state.live[indices[i]]++;
+
+    u32 offset = 0;
+    for (u32 v = 0; v < vertex_count; v++)
+    {
+        state.offsets[v] = offset;
+        offset += state.live[v];
+    }
+
+    for (u32 i = 0; i < triangle_count * 3; i++)
+        state.triangles[state.offsets[indices[i]]++] = i / 3;
+
+    for (u32 v = 0; v < vertex_count; v++)
+        state.offsets[v] -= state.live[v];
+
+    u8* emitted = calloc(triangle_count, sizeof(u8));
+    u32* candidates = malloc(triangle_count * 3 * sizeof(u32));
+    u32* output = malloc(triangle_count * 3 * sizeof(u32));
+    u32 output_count = 0;
+
+    u32 time = cache_size + 1;
+    i64 fan = tipsify_skip_dead_end(&state);
+
+    while (fan >= 0)
+    {
+        u32 candidate_count = 0;
+        u32 begin = state.offsets[fan];
+        u32 end = begin + (fan + 1 < vertex_count ? state.offsets[fan + 1] - begin : triangle_count * 3 - begin);
+
+        for (u32 j = begin; j < end; j++)
+        {
+            u32 t = state.triangles[j];
+            if (emitted[t])
+                continue;
+
+            for (u32 k = 0; k < 3; k++)
+            {
+                u32 v = indices[t * 3 + k];
+
+                output[output_count++] = v;
+                state.dead_end[state.dead_end_count++] = v;
+                candidates[candidate_count++] = v;
+                state.live[v]--;
+
+                if (time - state.cache_time[v] > cache_size)
+                    state.cache_time[v] = time++;
+            }
+
+            emitted[t] = 1;
+        }
+
+        fan = tipsify_next_vertex(&state, candidates, candidate_count, time, cache_size);
+    }
+
+    assert(output_count == triangle_count * 3);
+    memcpy(indices, output, output_count * sizeof(u32));
+
+    free(output);
+    free(candidates);
+    free(emitted);
+    free(state.dead_end);
+    free(state.cache_time);
+    free(state.live);
+    free(state.triangles);
+    free(state.offsets);
+}
+
+u32 vertex_fetch_optimize(Vertex* vertices, u32* indices, u32 index_count, u32 vertex_count)
+{
+    u32* remap = malloc(vertex_count * sizeof(u32));
+    memset(remap, 0xff, vertex_count * sizeof(u32));
+    Vertex* reordered = malloc(vertex_count * sizeof(Vertex));
+
+    u32 next = 0;
+    for (u32 i = 0; i < index_count; i++)
+    {
+        u32 v = indices[i];
+        if (remap[v] == 0xffffffff)
+        {
+            remap[v] = next;
+            reordered[next++] = vertices[v];
+        }
+        indices[i] = remap[v];
+    }
+
+    memcpy(vertices, reordered, next * sizeof(Vertex));
+
+    free(reordered);
+    free(remap);
+    return next;
+}
+
+void vertex_cache_analyze(VertexCacheStats* stats, const u32* indices, u32 index_count, u32 vertex_count, u32 cache_size)
+{
+    // A vertex is in the FIFO if it went in during the last cache_size misses
+    u32* inserted = calloc(vertex_count, sizeof(u32));
+    u32 misses = 0;
+
+    for (u32 i = 0; i < index_count; i++)
+    {
+        u32 v = indices[i];
+
+        if (inserted[v] == 0)
+            stats->vertex_count++;
+
+        if (inserted[v] == 0 || misses - inserted[v] >= cache_size)
+            inserted[v] = ++misses;
+    }
+
+    stats->triangle_count += index_count / 3;
+    stats->miss_count += misses;
+
+    free(inserted);
+}
+
+void vertex_cache_print_stats(const VertexCacheStats* before, const VertexCacheStats* after, const char* name)
+{
+    if (before->triangle_count == 0 || before->vertex_count == 0)
+        return;
+
+    printf("%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", name,
+           (f64)before->miss_count / before->triangle_count, (f64)after->miss_count / after->triangle_count,
+           (f64)before->miss_count / before->vertex_count, (f64)after->miss_count / after->vertex_count);
+}
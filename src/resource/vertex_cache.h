@@ -0,0 +1,26 @@
+#ifndef VERTEX_CACHE_H_INCLUDED
+#define VERTEX_CACHE_H_INCLUDED
+
+#include "mesh.h"
+
+// FIFO size used for both the optimizer and the ACMR/ATVR numbers
+#define VERTEX_CACHE_SIZE 16
+
+typedef struct VertexCacheStats VertexCacheStats;
+struct VertexCacheStats
+{
+    u64 triangle_count;
+    u64 vertex_count;
+    u64 miss_count;
+};
+
+// Reorders triangles for post-transform cache reuse (Tipsify), in place
+void vertex_cache_optimize(u32* indices, u32 index_count, u32 vertex_count, u32 cache_size);
+// Reorders vertices by first use and drops unreferenced ones, returns the new vertex count
+u32  vertex_fetch_optimize(Vertex* vertices, u32* indices, u32 index_count, u32 vertex_count);
+
+// Simulates a FIFO cache and accumulates into stats, ACMR = misses / triangles, ATVR = misses / referenced vertices
+void vertex_cache_analyze(VertexCacheStats* stats, const u32* indices, u32 index_count, u32 vertex_count, u32 cache_size);
+void vertex_cache_print_stats(const VertexCacheStats* before, const VertexCacheStats* after, const char* name);
+
+#endif
@@ -0,0 +1,112 @@
+// CPU checks of the meshlet backface cone test, no GPU needed. Exits with the number of failed checks.
+#include <resource/meshlet.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define GRID_SIZE 16
+
+internal u32 s_failures;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+internal void check(b32 passed, const char* expression, u32 line)
+{
+    if (!passed)
+    {
+        printf("meshlet_test.c:%u: failed %s\n", line, expression);
+        s_failures++;
+    }
+}
+
+// Unit sphere at the origin, facing +Z, triangles within 60 degrees of the axis
+internal void test_known_cones()
+{
+    hmm_vec4 sphere = HMM_Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    hmm_vec4 cone = HMM_Vec4(0.0f, 0.0f, 1.0f, 0.5f);
+
+    // In front, from the side and from behind
+    CHECK(!meshlet_cone_culled(sphere, cone, HMM_Vec3(0.0f, 0.0f, 10.0f)));
+    CHECK(!meshlet_cone_culled(sphere, cone, HMM_Vec3(10.0f, 0.0f, 0.0f)));
+    CHECK(meshlet_cone_culled(sphere, cone, HMM_Vec3(0.0f, 0.0f, -10.0f)));
+
+    // Grazing: 100 units away it culls once cos(angle to -axis) >= 0.5 + 1 / 100
+    f32 distance = 100.0f;
+    f32 inside = 58.0f * 3.14159265f / 180.0f;
+    f32 outside = 60.0f * 3.14159265f / 180.0f;
+    CHECK(meshlet_cone_culled(sphere, cone, HMM_Vec3(-sinf(inside) * distance, 0.0f, -cosf(inside) * distance)));
+    CHECK(!meshlet_cone_culled(sphere, cone, HMM_Vec3(-sinf(outside) * distance, 0.0f, -cosf(outside) * distance)));
+
+    // Inside the bounds nothing is culled, whatever the direction
+    CHECK(!meshlet_cone_culled(sphere, cone, HMM_Vec3(0.0f, 0.0f, -0.5f)));
+}
+
+internal void test_no_cone()
+{
+    hmm_vec4 sphere = HMM_Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    hmm_vec4 cone = HMM_Vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+    CHECK(!meshlet_cone_culled(sphere, cone, HMM_Vec3(0.0f, 0.0f, -10.0f)));
+    CHECK(!meshlet_cone_culled(sphere, HMM_Vec4(0.0f, 0.0f, 0.0f, 1.0f), HMM_Vec3(0.0f, 0.0f, -10.0f)));
+}
+
+// Counter clockwise seen from +Z, so every meshlet should get a zero width cone around +Z
+internal void test_flat_patch()
+{
+    u32 vertex_count = (GRID_SIZE + 1) * (GRID_SIZE + 1);
+    u32 index_count = GRID_SIZE * GRID_SIZE * 6;
+    Vertex* vertices = calloc(vertex_count, sizeof(Vertex));
+    u32* indices = malloc(index_count * sizeof(u32));
+
+    for (u32 y = 0; y <= GRID_SIZE; y++)
+        for (u32 x = 0; x <= GRID_SIZE; x++)
+            vertices[y * (GRID_SIZE + 1) + x].position = HMM_Vec3((f32)x / GRID_SIZE, (f32)y / GRID_SIZE, 0.0f);
+
+    u32* index = indices;
+    for (u32 y = 0; y < GRID_SIZE; y++)
+    {
+        for (u32 x = 0; x < GRID_SIZE; x++)
+        {
+            u32 v = y * (GRID_SIZE + 1) + x;
+            *index++ = v; *index++ = v + 1; *index++ = v + GRID_SIZE + 2;
+            *index++ = v; *index++ = v + GRID_SIZE + 2; *index++ = v + GRID_SIZE + 1;
+        }
+    }
+
+    MeshletData data;
+    meshlet_build(&data, vertices, vertex_count, indices, index_count);
+    meshlet_compute_bounds(&data, vertices, 0);
+    CHECK(data.meshlet_count > 1);
+
+    for (u32 i = 0; i < data.meshlet_count; i++)
+    {
+        Meshlet* ml = &data.meshlets[i];
+        CHECK(ml->cone.W < 1e-3f);
+        CHECK(fabsf(ml->cone.Z - 1.0f) < 1e-4f);
+
+        hmm_vec3 above = HMM_AddVec3(ml->sphere.XYZ, HMM_Vec3(0.3f, -0.2f, 5.0f));
+        hmm_vec3 below = HMM_AddVec3(ml->sphere.XYZ, HMM_Vec3(0.3f, -0.2f, -5.0f));
+        CHECK(!meshlet_cone_culled(ml->sphere, ml->cone, above));
+        CHECK(meshlet_cone_culled(ml->sphere, ml->cone, below));
+    }
+
+    // Double sided geometry never gets a cone
+    meshlet_compute_bounds(&data, vertices, 1);
+    for (u32 i = 0; i < data.meshlet_count; i++)
+        CHECK(data.meshlets[i].cone.W >= 1.0f);
+
+    meshlet_data_free(&data);
+    free(indices);
+    free(vertices);
+}
+
+int main()
+{
+    test_known_cones();
+    test_no_cone();
+    test_flat_patch();
+
+    printf("meshlet_test: %s (%u failed)\n", s_failures ? "FAILED" : "passed", s_failures);
+    return (int)s_failures;
+}
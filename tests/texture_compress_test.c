@@ -0,0 +1,278 @@
+// CPU checks of the BC encoders: the SSE2 and scalar paths must produce the same blocks, and every format has to
+// decode back within a bound of the source. Exits with the number of failed checks.
+#include <resource/texture_compress.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+internal u32 s_failures;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+internal void check(b32 passed, const char* expression, u32 line)
+{
+    if (!passed)
+    {
+        printf("texture_compress_test.c:%u: failed %s\n", line, expression);
+        s_failures++;
+    }
+}
+
+internal const VkFormat s_formats[] = { VK_FORMAT_BC1_RGBA_UNORM_BLOCK, VK_FORMAT_BC4_UNORM_BLOCK, VK_FORMAT_BC5_UNORM_BLOCK, VK_FORMAT_BC7_UNORM_BLOCK };
+
+internal u32 bits_get(const u8* src, u32* position, u32 count)
+{
+    u32 value = 0;
+    for (u32 i = 0; i < count; i++, (*position)++)
+        value |= (u32)((src[*position >> 3] >> (*position & 7)) & 1) << i;
+    return value;
+}
+
+internal void bc1_decode(const u8* src, u8 out[16][4])
+{
+    u16 c[2] = { (u16)(src[0] | (src[1] << 8)), (u16)(src[2] | (src[3] << 8)) };
+    u32 palette[4][4];
+    for (u32 e = 0; e < 2; e++)
+    {
+        u32 r = c[e] >> 11, g = (c[e] >> 5) & 63, b = c[e] & 31;
+        palette[e][0] = (r << 3) | (r >> 2);
+        palette[e][1] = (g << 2) | (g >> 4);
+        palette[e][2] = (b << 3) | (b >> 2);
+        palette[e][3] = 255;
+    }
+    for (u32 k = 0; k < 4; k++)
+    {
+        if (c[0] > c[1])
+        {
+            palette[2][k] = (2 * palette[0][k] + palette[1][k] + 1) / 3;
+            palette[3][k] = (palette[0][k] + 2 * palette[1][k] + 1) / 3;
+        }
+        else
+        {
+            // 3 colour mode, index 3 is transparent black
+            palette[2][k] = (palette[0][k] + palette[1][k]) / 2;
+            palette[3][k] = 0;
+        }
+    }
+
+    u32 bits = src[4] | (src[5] << 8) | (src[6] << 16) | ((u32)src[7] << 24);
+    for (u32 i = 0; i < 16; i++)
+        for (u32 k = 0; k < 4; k++)
+            out[i][k] = (u8)palette[(bits >> (i * 2)) & 3][k];
+}
+
+internal void bc4_decode(const u8* src, u8 out[16][4], u32 channel)
+{
+    u32 palette[8] = { src[0], src[1] };
+    for (u32 k = 2; k < 8; k++)
+    {
+        if (src[0] > src[1])
+            palette[k] = ((8 - k) * src[0] + (k - 1) * src[1] + 3) / 7;
+        else
+            palette[k] = k == 6 ? 0 : k == 7 ? 255 : ((6 - k) * src[0] + (k - 1) * src[1] + 2) / 5;
+    }
+
+    u32 position = 16;
+    for (u32 i = 0; i < 16; i++)
+        out[i][channel] = (u8)palette[bits_get(src, &position, 3)];
+}
+
+// Mode 6 only, anything else fails the mode check
+internal b32 bc7_decode(const u8* src, u8 out[16][4])
+{
+    u32 position = 0;
+    if (bits_get(src, &position, 7) != 1 << 6)
+        return 0;
+
+    u32 q[2][4], p[2];
+    for (u32 c = 0; c < 4; c++)
+    {
+        q[0][c] = bits_get(src, &position, 7);
+        q[1][c] = bits_get(src, &position, 7);
+    }
+    p[0] = bits_get(src, &position, 1);
+    p[1] = bits_get(src, &position, 1);
+
+    const u32 weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+    for (u32 i = 0; i < 16; i++)
+    {
+        u32 index = bits_get(src, &position, i == 0 ? 3 : 4);
+        for (u32 c = 0; c < 4; c++)
+        {
+            u32 a = (q[0][c] << 1) | p[0];
+            u32 b = (q[1][c] << 1) | p[1];
+            out[i][c] = (u8)(((64 - weights[index]) * a + weights[index] * b + 32) >> 6);
+        }
+    }
+    return 1;
+}
+
+// Largest difference over the channels the format keeps, -1 when the block can't be decoded
+internal i32 block_max_error(const u8 pixels[16][4], const u8* encoded, VkFormat format)
+{
+    u8 decoded[16][4];
+    memset(decoded, 0, sizeof(decoded));
+    u32 channels = 3;
+    switch (format)
+    {
+        case VK_FORMAT_BC1_RGBA_UNORM_BLOCK: bc1_decode(encoded, decoded); break;
+        case VK_FORMAT_BC4_UNORM_BLOCK: bc4_decode(encoded, decoded, 0); channels = 1; break;
+        case VK_FORMAT_BC5_UNORM_BLOCK: bc4_decode(encoded, decoded, 0); bc4_decode(encoded + 8, decoded, 1); channels = 2; break;
+        case VK_FORMAT_BC7_UNORM_BLOCK: if (!bc7_decode(encoded, decoded)) return -1; channels = 4; break;
+        default: return -1;
+    }
+
+    i32 error = 0;
+    for (u32 i = 0; i < 16; i++)
+        for (u32 c = 0; c < channels; c++)
+            error = max(error, abs((i32)decoded[i][c] - (i32)pixels[i][c]));
+    return error;
+}
+
+internal void fill_gradient(u8 pixels[16][4], const u8 from[4], const u8 to[4])
+{
+    for (u32 i = 0; i < 16; i++)
+        for (u32 c = 0; c < 4; c++)
+            pixels[i][c] = (u8)((from[c] * (15 - i) + to[c] * i + 7) / 15);
+}
+
+internal void fill_noise(u8 pixels[16][4], u32 seed)
+{
+    u32 state = seed * 747796405u + 2891336453u;
+    for (u32 i = 0; i < 16; i++)
+    {
+        for (u32 c = 0; c < 4; c++)
+        {
+            state = state * 1664525u + 1013904223u;
+            pixels[i][c] = (u8)(state >> 24);
+        }
+    }
+}
+
+internal void test_paths_match()
+{
+    if (!texture_compress_simd_supported())
+    {
+        printf("texture_compress_test: no SSE2 path, skipping the comparison\n");
+        return;
+    }
+
+    u8 pixels[64][16][4];
+    for (u32 b = 0; b < 48; b++)
+        fill_noise(pixels[b], b);
+    for (u32 b = 48; b < 64; b++)
+    {
+        u8 from[4] = { (u8)(b * 13), (u8)(255 - b * 7), (u8)(b * 29), (u8)(b * 3) };
+        u8 to[4] = { (u8)(255 - b * 11), (u8)(b * 5), (u8)(128 + b), (u8)(255 - b) };
+        fill_gradient(pixels[b], from, to);
+    }
+
+    for (u32 f = 0; f < sizeof(s_formats) / sizeof(s_formats[0]); f++)
+    {
+        u8 simd[16], scalar[16];
+        for (u32 b = 0; b < 64; b++)
+        {
+            texture_compress_set_simd(1);
+            texture_compress(simd, &pixels[b][0][0], 4, 4, s_formats[f]);
+            texture_compress_set_simd(0);
+            texture_compress(scalar, &pixels[b][0][0], 4, 4, s_formats[f]);
+
+            b32 same = memcmp(simd, scalar, texture_block_bytes(s_formats[f])) == 0;
+            if (!same)
+                printf("texture_compress_test.c: format %u block %u differs between SSE2 and scalar\n", s_formats[f], b);
+            CHECK(same);
+        }
+    }
+    texture_compress_set_simd(1);
+}
+
+// Solid blocks only lose what the endpoint precision can't hold
+internal void test_solid_blocks()
+{
+    const u8 colors[][4] = { { 0, 0, 0, 0 }, { 255, 255, 255, 255 }, { 200, 100, 50, 128 }, { 17, 230, 99, 3 } };
+    for (u32 i = 0; i < sizeof(colors) / sizeof(colors[0]); i++)
+    {
+        u8 pixels[16][4];
+        fill_gradient(pixels, colors[i], colors[i]);
+
+        u8 encoded[16];
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC1_RGBA_UNORM_BLOCK);
+        CHECK(block_max_error(pixels, encoded, VK_FORMAT_BC1_RGBA_UNORM_BLOCK) <= 4);
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC4_UNORM_BLOCK);
+        CHECK(block_max_error(pixels, encoded, VK_FORMAT_BC4_UNORM_BLOCK) == 0);
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC5_UNORM_BLOCK);
+        CHECK(block_max_error(pixels, encoded, VK_FORMAT_BC5_UNORM_BLOCK) == 0);
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC7_UNORM_BLOCK);
+        CHECK(block_max_error(pixels, encoded, VK_FORMAT_BC7_UNORM_BLOCK) <= 1);
+    }
+}
+
+// Gradients both ways round. Pixel 0 lands on either end, so BC7 has to swap endpoints to keep the anchor
+// index's top bit clear for half of them. The fitted BC1 endpoints come out in 565 order for some colour pairs
+// and reversed for others, and only c0 > c1 decodes in the 4 colour mode.
+internal void test_gradients()
+{
+    const u8 dark[4] = { 10, 40, 20, 30 };
+    const u8 bright[4] = { 240, 200, 250, 220 };
+    const u8 red[4] = { 250, 5, 5, 255 };
+    const u8 blue[4] = { 5, 5, 250, 0 };
+    const u8 maroon[4] = { 60, 0, 0, 128 };
+    const u8* ends[][2] = { { dark, bright }, { bright, dark }, { red, blue }, { blue, red }, { maroon, blue }, { blue, maroon } };
+
+    for (u32 i = 0; i < sizeof(ends) / sizeof(ends[0]); i++)
+    {
+        u8 pixels[16][4];
+        fill_gradient(pixels, ends[i][0], ends[i][1]);
+
+        // Half the spacing of the palette a format spans the widest channel with, plus endpoint rounding
+        i32 range = 0;
+        for (u32 c = 0; c < 4; c++)
+            range = max(range, abs((i32)ends[i][0][c] - (i32)ends[i][1][c]));
+
+        u8 encoded[16];
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC1_RGBA_UNORM_BLOCK);
+        u16 c0 = (u16)(encoded[0] | (encoded[1] << 8));
+        u16 c1 = (u16)(encoded[2] | (encoded[3] << 8));
+        CHECK(c0 > c1);
+        CHECK(block_max_error(pixels, encoded, VK_FORMAT_BC1_RGBA_UNORM_BLOCK) <= range / 6 + 5);
+
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC4_UNORM_BLOCK);
+        CHECK(encoded[0] > encoded[1]);
+        CHECK(block_max_error(pixels, encoded, VK_FORMAT_BC4_UNORM_BLOCK) <= range / 14 + 2);
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC5_UNORM_BLOCK);
+        CHECK(block_max_error(pixels, encoded, VK_FORMAT_BC5_UNORM_BLOCK) <= range / 14 + 2);
+
+        texture_compress(encoded, &pixels[0][0], 4, 4, VK_FORMAT_BC7_UNORM_BLOCK);
+        i32 bc7_error = block_max_error(pixels, encoded, VK_FORMAT_BC7_UNORM_BLOCK);
+        CHECK(bc7_error >= 0 && bc7_error <= range / 30 + 3);
+    }
+}
+
+// Noise can't be held by one line through colour space, the bound only catches a broken encoding
+internal void test_noise_bound()
+{
+    for (u32 b = 0; b < 32; b++)
+    {
+        u8 pixels[16][4];
+        fill_noise(pixels, 1000 + b);
+        for (u32 f = 0; f < sizeof(s_formats) / sizeof(s_formats[0]); f++)
+        {
+            u8 encoded[16];
+            texture_compress(encoded, &pixels[0][0], 4, 4, s_formats[f]);
+            i32 error = block_max_error(pixels, encoded, s_formats[f]);
+            CHECK(error >= 0 && error < 255);
+        }
+    }
+}
+
+int main()
+{
+    test_paths_match();
+    test_solid_blocks();
+    test_gradients();
+    test_noise_bound();
+
+    printf("texture_compress_test: %s (%u failed)\n", s_failures ? "FAILED" : "passed", s_failures);
+    return (int)s_failures;
+}
@@ -0,0 +1,84 @@
+// CPU checks that the SIMD mip filters match the scalar reference byte for byte, every role and path the CPU
+// runs. Exits with the number of failed checks.
+#include <resource/texture_mips.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+internal u32 s_failures;
+
+#define CHECK(condition) check((condition), #condition, __LINE__)
+
+internal void check(b32 passed, const char* expression, u32 line)
+{
+    if (!passed)
+    {
+        printf("texture_mips_test.c:%u: failed %s\n", line, expression);
+        s_failures++;
+    }
+}
+
+// Deterministic noise, with a few solid and zero length normal texels mixed in
+internal void fill_image(u8* pixels, u32 width, u32 height, u32 seed)
+{
+    u32 state = seed * 747796405u + 2891336453u;
+    for (u32 i = 0; i < width * height * 4; i++)
+    {
+        state = state * 1664525u + 1013904223u;
+        pixels[i] = (u8)(state >> 24);
+    }
+
+    for (u32 i = 0; i < width * height; i += 7)
+        memset(pixels + i * 4, i % 2 ? 0xff : 0x80, 3);
+}
+
+internal void test_paths_match(u32 width, u32 height)
+{
+    u32 dst_width = max(width >> 1, 1);
+    u32 dst_height = max(height >> 1, 1);
+    u8* src = malloc(width * height * 4);
+    u8* reference = malloc(dst_width * dst_height * 4);
+    u8* result = malloc(dst_width * dst_height * 4);
+
+    for (u32 role = TEXTURE_ROLE_ALBEDO; role <= TEXTURE_ROLE_DATA; role++)
+    {
+        fill_image(src, width, height, width * 31 + height * 7 + role);
+
+        texture_mips_set_path(TEXTURE_MIPS_PATH_SCALAR);
+        texture_downsample(reference, src, width, height, role);
+
+        for (u32 path = TEXTURE_MIPS_PATH_SSE2; path <= texture_mips_supported_path(); path++)
+        {
+            texture_mips_set_path(path);
+            memset(result, 0, dst_width * dst_height * 4);
+            texture_downsample(result, src, width, height, role);
+
+            b32 same = memcmp(reference, result, dst_width * dst_height * 4) == 0;
+            if (!same)
+                printf("texture_mips_test.c: %ux%u role %u path %u differs from scalar\n", width, height, role, path);
+            CHECK(same);
+        }
+    }
+
+    texture_mips_set_path(texture_mips_supported_path());
+    free(result);
+    free(reference);
+    free(src);
+}
+
+int main()
+{
+    texture_mips_init();
+    printf("texture_mips_test: fastest path %u\n", texture_mips_supported_path());
+
+    // Even, odd edges and single rows/columns, so the scalar tails after every SIMD loop get exercised
+    test_paths_match(64, 64);
+    test_paths_match(37, 23);
+    test_paths_match(9, 1);
+    test_paths_match(1, 9);
+    test_paths_match(2, 2);
+
+    printf("texture_mips_test: %s (%u failed)\n", s_failures ? "FAILED" : "passed", s_failures);
+    return (int)s_failures;
+}